@@ -63,8 +63,10 @@ Features:
      better cache locality.  Based on that, it's also faster to
      intersect two skiplists.
 
-  4. Lazy removal with GC support.  The removed nodes get deleted when
-     the last Accessor to the skiplist is destroyed.
+  4. Lazy removal with epoch based reclamation (atlas/container/epoch.h).
+     Every operation of an Accessor pins its thread while it runs, like
+     an iterator or a Skipper while it lives.  The removed nodes get
+     deleted in the background once no pinned thread can still see them.
 
 Caveats:
 
@@ -82,20 +84,17 @@ Caveats:
 
   5. Currently x64 only, due to use of MicroSpinLock.
 
-  6. Freed nodes will not be reclaimed as long as there are ongoing
-     uses of the list.
+  6. Removed nodes will not be reclaimed while an iterator or a Skipper
+     made before their removal is alive.  An Accessor can be shared,
+     copied and destroyed by any thread, the iterators and the Skippers
+     belong to the thread which made them.
 
 Sample usage:
 
      typedef ConcurrentSkipList<int> SkipListT;
      shared_ptr<SkipListT> sl(SkipListT::createInstance(init_head_height);
      {
-       // It's usually good practice to hold an accessor only during
-       // its necessary life cycle (but not in a tight loop as
-       // Accessor creation incurs ref-counting overhead).
-       //
-       // Holding it longer delays garbage-collecting the deleted
-       // nodes in the list.
+       // An accessor holds no pin, it can be kept as long as the list.
        SkipListT::Accessor accessor(sl);
        accessor.insert(23);
        accessor.erase(2);
@@ -121,7 +120,7 @@ Sample usage:
          CHECK_LE(30, *skipper);
        }
        ...  ...
-       // GC may happen when the accessor gets destructed.
+       // the nodes removed meanwhile may be freed once the skipper is gone.
      }
 */
 
@@ -130,5 +129,6 @@ Sample usage:
 
 #include <atlas/container/skip_list/concurrent_skip_list.tcc>
 #include <atlas/container/skip_list/concurrent_skip_list.h>
+#include <atlas/container/skip_list/concurrent_skip_list_map.h>
 
 #endif /* ATLAS_CONTAINER_SKIP_LIST_H_ */
@@ -0,0 +1,327 @@
+/*
+ * epoch.h
+ *
+ *  Created on: Nov 6, 2013
+ *      Author: vincent
+ */
+
+#ifndef ATLAS_CONTAINER_EPOCH_H_
+#define ATLAS_CONTAINER_EPOCH_H_
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <condition_variable>
+
+#include <atlas/singleton.h>
+
+namespace atlas {
+
+  struct epoch_stats {
+    uint64_t epoch;
+    uint64_t retired;    // objects handed to retire()
+    uint64_t reclaimed;  // objects freed
+    size_t threads;      // threads registered right now
+  };
+
+  class __epoch_thread;
+
+  /*
+   * Epoch based reclamation : a reader pins the global epoch while it holds pointers to shared
+   * objects, a writer retires the objects it unlinks instead of freeing them. The global epoch
+   * moves on once every pinned thread has seen it, and an object retired in epoch e is freed once
+   * the epoch reaches e + 2, when no reader can hold it any more.
+   *
+   * Every thread has its own record, on its own cache line, so pinning writes no shared data.
+   * The retired objects are kept in a bag by thread, the full bags are tagged with the epoch and
+   * freed by a background thread. A retiring thread collects itself when too much is pending,
+   * so the garbage stays bounded as long as no thread stays pinned for long.
+   * */
+  class epoch_domain : public atlas::singleton<epoch_domain> {
+  public:
+
+    typedef void (*deleter_type)(void*);
+
+    static const size_t batch_size = 64;           // retired objects per bag
+    static const size_t high_watermark = 1 << 16;  // pending objects before the retiring threads help
+
+  public:
+
+    epoch_domain() :
+      _epoch(0), _records(nullptr), _retired(0), _reclaimed(0), _pending(0),
+      _interval(std::chrono::milliseconds(5)), _stopped(false) {}
+
+    // no thread may be pinned any more, everything still pending is freed
+    ~epoch_domain() {
+      {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _stopped = true;
+      }
+      _wakeup.notify_one();
+
+      if (_collector.joinable()) _collector.join();
+
+      for (bag& b : _bags) __free(b.objects);
+
+      while (__record* r = _records.load(std::memory_order_relaxed)) {
+        _records.store(r->next, std::memory_order_relaxed);
+        r->~__record();
+        free(r);
+      }
+    }
+
+    epoch_domain(const epoch_domain&) = delete;
+    epoch_domain& operator=(const epoch_domain&) = delete;
+
+  public:
+
+    // free obj with deleter once no pinned thread can see it, call it after obj is unlinked
+    static void retire(void* obj, deleter_type deleter);
+
+    // hand the bag of the calling thread to the collector, e.g. before it goes idle
+    static void flush();
+
+    // how often the background thread moves the epoch on and frees what it can
+    void set_collect_interval(std::chrono::milliseconds interval) {
+      std::lock_guard<std::mutex> guard(_mutex);
+      _interval = interval;
+    }
+
+    // move the epoch on if every pinned thread has seen the current one
+    bool try_advance() {
+      uint64_t e = _epoch.load(std::memory_order_seq_cst);
+
+      for (__record* r = _records.load(std::memory_order_acquire); r; r = r->next) {
+        uint64_t s = r->state.load(std::memory_order_seq_cst);
+        if ((s & 1) && (s >> 1) != e) return false;
+      }
+
+      return _epoch.compare_exchange_strong(e, e + 1, std::memory_order_seq_cst);
+    }
+
+    // free the bags retired two epochs ago or more, returns the number of objects freed
+    size_t collect() {
+      try_advance();
+      uint64_t e = _epoch.load(std::memory_order_seq_cst);
+
+      std::vector<bag> ready;
+      {
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        size_t kept = 0;
+        for (size_t i = 0; i < _bags.size(); ++i) {
+          if (_bags[i].epoch + 2 <= e) ready.push_back(std::move(_bags[i]));
+          else if (kept++ != i) _bags[kept - 1] = std::move(_bags[i]);
+        }
+        _bags.resize(kept);
+      }
+
+      size_t n = 0;
+      for (bag& b : ready) {
+        n += b.objects.size();
+        __free(b.objects);
+      }
+
+      _pending.fetch_sub(n, std::memory_order_relaxed);
+      _reclaimed.fetch_add(n, std::memory_order_relaxed);
+
+      return n;
+    }
+
+    epoch_stats stats() const {
+      size_t threads = 0;
+      for (__record* r = _records.load(std::memory_order_acquire); r; r = r->next) {
+        if (r->in_use.load(std::memory_order_relaxed)) ++threads;
+      }
+
+      return epoch_stats {
+        _epoch.load(std::memory_order_relaxed), _retired.load(std::memory_order_relaxed),
+        _reclaimed.load(std::memory_order_relaxed), threads
+      };
+    }
+
+  private:
+
+    friend class __epoch_thread;
+
+    // the state is (epoch << 1) | 1 while the thread is pinned, 0 otherwise
+    struct __record {
+      __record() : state(0), in_use(true), next(nullptr) {}
+
+      std::atomic<uint64_t> state;
+      std::atomic<bool> in_use;
+      __record* next;
+    } __attribute__((aligned(64)));
+
+    struct retired {
+      void* obj;
+      deleter_type deleter;
+    };
+
+    struct bag {
+      uint64_t epoch; // the epoch when the bag was handed over, after all its objects were unlinked
+      std::vector<retired> objects;
+    };
+
+    // the records of the exited threads are reused, never freed before the domain
+    __record* __acquire_record() {
+      for (__record* r = _records.load(std::memory_order_acquire); r; r = r->next) {
+        bool free = false;
+        if (!r->in_use.load(std::memory_order_relaxed) && r->in_use.compare_exchange_strong(free, true)) return r;
+      }
+
+      // a cache line of its own, operator new ignores the alignment
+      void* p = nullptr;
+      if (posix_memalign(&p, 64, sizeof(__record)) != 0) throw std::bad_alloc();
+      __record* r = new (p) __record();
+      r->next = _records.load(std::memory_order_relaxed);
+      while (!_records.compare_exchange_weak(r->next, r, std::memory_order_release, std::memory_order_relaxed)) {}
+
+      return r;
+    }
+
+    void __release_record(__record* r) {
+      r->state.store(0, std::memory_order_release);
+      r->in_use.store(false, std::memory_order_release);
+    }
+
+    uint64_t __pin_epoch() const { return _epoch.load(std::memory_order_seq_cst); }
+
+    void __hand_over(std::vector<retired>& objects) {
+      if (objects.empty()) return;
+
+      size_t n = objects.size();
+      _retired.fetch_add(n, std::memory_order_relaxed);
+      size_t pending = _pending.fetch_add(n, std::memory_order_relaxed) + n;
+
+      {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _bags.push_back(bag { _epoch.load(std::memory_order_seq_cst), std::move(objects) });
+      }
+      objects.clear();
+
+      std::call_once(_collector_started, [this]() { _collector = std::thread(&epoch_domain::__run_collector, this); });
+
+      if (pending >= high_watermark) collect();
+      else _wakeup.notify_one();
+    }
+
+    static void __free(std::vector<retired>& objects) {
+      for (retired& r : objects) r.deleter(r.obj);
+      objects.clear();
+    }
+
+    void __run_collector() {
+      std::unique_lock<std::mutex> lock(_mutex);
+
+      while (!_stopped) {
+        _wakeup.wait_for(lock, _interval);
+        if (_stopped) break;
+
+        lock.unlock();
+        collect();
+        lock.lock();
+      }
+    }
+
+  private:
+
+    std::atomic<uint64_t> _epoch;
+    std::atomic<__record*> _records;
+
+    std::atomic<uint64_t> _retired;
+    std::atomic<uint64_t> _reclaimed;
+    std::atomic<size_t> _pending;
+
+    std::mutex _mutex;
+    std::vector<bag> _bags;
+    std::chrono::milliseconds _interval;
+
+    std::once_flag _collector_started;
+    std::thread _collector;
+    std::condition_variable _wakeup;
+    bool _stopped;
+  };
+
+  // The registration of a thread in the epoch_domain, created on first use by the thread,
+  // its bag is handed over when the thread exits.
+  class __epoch_thread {
+  public:
+
+    static __epoch_thread& local() {
+      static thread_local __epoch_thread t;
+      return t;
+    }
+
+    __epoch_thread() : _domain(epoch_domain::ptr()), _record(_domain->__acquire_record()), _depth(0) {
+      _bag.reserve(epoch_domain::batch_size);
+    }
+
+    ~__epoch_thread() {
+      _domain->__hand_over(_bag);
+      _domain->__release_record(_record);
+    }
+
+    __epoch_thread(const __epoch_thread&) = delete;
+    __epoch_thread& operator=(const __epoch_thread&) = delete;
+
+  public:
+
+    // the pins nest, only the outermost one publishes the epoch
+    void enter() {
+      if (_depth++ == 0) _record->state.store((_domain->__pin_epoch() << 1) | 1, std::memory_order_seq_cst);
+    }
+
+    void leave() {
+      if (--_depth == 0) _record->state.store(0, std::memory_order_release);
+    }
+
+    void retire(void* obj, epoch_domain::deleter_type deleter) {
+      _bag.push_back(epoch_domain::retired { obj, deleter });
+      if (_bag.size() >= epoch_domain::batch_size) __flush();
+    }
+
+    void __flush() {
+      _domain->__hand_over(_bag);
+      _bag.reserve(epoch_domain::batch_size);
+    }
+
+  private:
+
+    std::shared_ptr<epoch_domain> _domain; // outlives the thread locals of the main thread
+    epoch_domain::__record* _record;
+    size_t _depth;
+    std::vector<epoch_domain::retired> _bag;
+  };
+
+  inline void epoch_domain::retire(void* obj, deleter_type deleter) { __epoch_thread::local().retire(obj, deleter); }
+
+  inline void epoch_domain::flush() { __epoch_thread::local().__flush(); }
+
+  // Pin the calling thread while the guard lives, the guards of a thread nest. A copy pins again,
+  // on the thread which makes it : a guard must be destroyed by the thread which created it.
+  class epoch_guard {
+  public:
+
+    epoch_guard() : _thread(__epoch_thread::local()) { _thread.enter(); }
+
+    epoch_guard(const epoch_guard&) : _thread(__epoch_thread::local()) { _thread.enter(); }
+
+    epoch_guard& operator=(const epoch_guard&) { return *this; }
+
+    ~epoch_guard() { _thread.leave(); }
+
+  private:
+
+    __epoch_thread& _thread;
+  };
+
+} // atlas
+
+#endif /* ATLAS_CONTAINER_EPOCH_H_ */
@@ -0,0 +1,413 @@
+/*
+ * flat_map128.h
+ *
+ *  Created on: Oct 31, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+#ifndef ATLAS_FLAT_MAP128_H_
+#define ATLAS_FLAT_MAP128_H_
+
+#include <new>
+#include <tuple>
+#include <memory>
+#include <utility>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <type_traits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace atlas {
+
+  // mix all the 128 bits of a key, the keys can be random or sequential
+  template<typename Key>
+  struct hash128 {
+
+    size_t operator()(const Key& key) const {
+      uint64_t lo, hi;
+      std::memcpy(&lo, &key, sizeof lo);
+      std::memcpy(&hi, reinterpret_cast<const char*>(&key) + sizeof lo, sizeof hi);
+
+      uint64_t h = (lo ^ (hi * 0x9e3779b97f4a7c15ULL));
+      h ^= h >> 29;
+      h *= 0xbf58476d1ce4e5b9ULL;
+      h ^= h >> 32;
+
+      return static_cast<size_t>(h);
+    }
+  };
+
+  /*
+   * An open addressing hash map for 16 bytes keys, e.g. uuids, stored flat in one array.
+   *
+   * Every slot has a control byte : empty, or the 7 low bits of the hash of its key. A lookup
+   * probes linearly from the home slot of the key, comparing 16 control bytes at a time with SSE2,
+   * and reads a key only when its control byte matches, so a miss rarely touches the slots.
+   * The probe ends at the first empty slot. An erase shifts the following entries of the cluster
+   * back instead of leaving a tombstone, so lookups never slow down with the churn.
+   *
+   * The hash picks the home slot with its bits from the 8th up, don't derive a sharding of the
+   * keys from the same bits. The load factor is at most 3/4.
+   *
+   * Inserting may move all the entries, erasing moves some of them : both invalidate the
+   * iterators and the references.
+   * */
+  template<typename Key, typename Value, typename Hash = hash128<Key>>
+  class flat_map128 {
+  public:
+
+    static_assert(sizeof(Key) == 16, "flat_map128 is for 128 bits keys");
+    static_assert(std::is_trivially_copyable<Key>::value, "the keys are compared and copied as raw bytes");
+
+    typedef Key key_type;
+    typedef Value mapped_type;
+    typedef std::pair<const Key, Value> value_type;
+    typedef size_t size_type;
+
+  private:
+
+    static const size_t group_size = 16;
+    static const size_t min_capacity = 16;
+    static const int8_t empty_ctrl = -128; // 0x80, a hash byte is in [0, 127]
+
+    typedef typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type slot_type;
+
+  public:
+
+    template<bool Const>
+    class basic_iterator {
+    public:
+
+      typedef std::forward_iterator_tag iterator_category;
+      typedef typename flat_map128::value_type value_type;
+      typedef std::ptrdiff_t difference_type;
+      typedef typename std::conditional<Const, const value_type*, value_type*>::type pointer;
+      typedef typename std::conditional<Const, const value_type&, value_type&>::type reference;
+
+    public:
+
+      basic_iterator() : _map(nullptr), _i(0) {}
+
+      // a const iterator from an iterator
+      template<bool C, typename = typename std::enable_if<Const && !C>::type>
+      basic_iterator(const basic_iterator<C>& it) : _map(it._map), _i(it._i) {}
+
+      reference operator*() const { return *_map->__at(_i); }
+
+      pointer operator->() const { return _map->__at(_i); }
+
+      basic_iterator& operator++() {
+        _i = _map->__next_full(_i + 1);
+        return *this;
+      }
+
+      basic_iterator operator++(int) {
+        basic_iterator it(*this);
+        ++*this;
+        return it;
+      }
+
+      bool operator==(const basic_iterator& other) const { return _i == other._i; }
+
+      bool operator!=(const basic_iterator& other) const { return _i != other._i; }
+
+    private:
+
+      friend class flat_map128;
+      template<bool> friend class basic_iterator;
+
+      typedef typename std::conditional<Const, const flat_map128*, flat_map128*>::type map_pointer;
+
+      basic_iterator(map_pointer map, size_t i) : _map(map), _i(i) {}
+
+      map_pointer _map;
+      size_t _i;
+    };
+
+    typedef basic_iterator<false> iterator;
+    typedef basic_iterator<true> const_iterator;
+
+  public:
+
+    flat_map128() : _ctrl(nullptr), _slots(nullptr), _capacity(0), _size(0) {}
+
+    explicit flat_map128(size_t n) : flat_map128() { reserve(n); }
+
+    flat_map128(const flat_map128& other) : flat_map128() {
+      reserve(other.size());
+      for (const value_type& v : other) __insert_unique(v.first, v.second);
+    }
+
+    flat_map128(flat_map128&& other) : flat_map128() { swap(other); }
+
+    ~flat_map128() {
+      clear();
+      __release();
+    }
+
+    flat_map128& operator=(flat_map128 other) {
+      swap(other);
+      return *this;
+    }
+
+    void swap(flat_map128& other) {
+      std::swap(_ctrl, other._ctrl);
+      std::swap(_slots, other._slots);
+      std::swap(_capacity, other._capacity);
+      std::swap(_size, other._size);
+    }
+
+  public:
+
+    size_t size() const { return _size; }
+
+    bool empty() const { return _size == 0; }
+
+    size_t capacity() const { return _capacity; }
+
+    iterator begin() { return iterator(this, __next_full(0)); }
+
+    iterator end() { return iterator(this, _capacity); }
+
+    const_iterator begin() const { return const_iterator(this, __next_full(0)); }
+
+    const_iterator end() const { return const_iterator(this, _capacity); }
+
+    iterator find(const Key& key) { return iterator(this, __find(key)); }
+
+    const_iterator find(const Key& key) const { return const_iterator(this, __find(key)); }
+
+    size_t count(const Key& key) const { return __find(key) != _capacity; }
+
+    // construct the value in place if the key is not there yet, like std::map::emplace
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(const Key& key, Args&&... args) {
+      size_t hash = Hash()(key);
+
+      size_t i = __find(key, hash);
+      if (i != _capacity) return std::make_pair(iterator(this, i), false);
+
+      if ((_size + 1) * 4 > _capacity * 3) {
+        __rehash(_capacity ? _capacity * 2 : min_capacity);
+      }
+
+      i = __construct(hash, key, std::forward<Args>(args)...);
+      return std::make_pair(iterator(this, i), true);
+    }
+
+    std::pair<iterator, bool> insert(const value_type& v) { return emplace(v.first, v.second); }
+
+    std::pair<iterator, bool> insert(value_type&& v) { return emplace(v.first, std::move(v.second)); }
+
+    Value& operator[](const Key& key) { return emplace(key).first->second; }
+
+    size_t erase(const Key& key) {
+      size_t i = __find(key);
+      if (i == _capacity) return 0;
+
+      __erase(i);
+      return 1;
+    }
+
+    // the entries after it may move into its slot, so the iterator is not advanced
+    void erase(const_iterator it) { __erase(it._i); }
+
+    void clear() {
+      if (!_size) return;
+
+      for (size_t i = 0; i < _capacity; ++i) {
+        if (_ctrl[i] != empty_ctrl) __at(i)->~value_type();
+      }
+
+      std::memset(_ctrl, empty_ctrl, _capacity + group_size);
+      _size = 0;
+    }
+
+    // make room for n entries without rehashing
+    void reserve(size_t n) {
+      size_t capacity = min_capacity;
+      while (capacity * 3 < n * 4) capacity *= 2;
+
+      if (capacity > _capacity) __rehash(capacity);
+    }
+
+  private:
+
+    value_type* __at(size_t i) { return reinterpret_cast<value_type*>(&_slots[i]); }
+
+    const value_type* __at(size_t i) const { return reinterpret_cast<const value_type*>(&_slots[i]); }
+
+    static bool __equal(const Key& a, const Key& b) {
+      uint64_t a0, a1, b0, b1;
+      std::memcpy(&a0, &a, 8);
+      std::memcpy(&a1, reinterpret_cast<const char*>(&a) + 8, 8);
+      std::memcpy(&b0, &b, 8);
+      std::memcpy(&b1, reinterpret_cast<const char*>(&b) + 8, 8);
+
+      return ((a0 ^ b0) | (a1 ^ b1)) == 0;
+    }
+
+    static int8_t __h2(size_t hash) { return static_cast<int8_t>(hash & 0x7f); }
+
+    size_t __home(size_t hash) const { return (hash >> 7) & (_capacity - 1); }
+
+    // the first group_size control bytes are mirrored after the last one, so a group loaded near
+    // the end of the array reads the beginning, without a wrap around test
+    void __set_ctrl(size_t i, int8_t c) {
+      _ctrl[i] = c;
+      if (i < group_size) _ctrl[_capacity + i] = c;
+    }
+
+    // bit k is set if the control byte i + k matches, and if it is empty
+    void __match(size_t i, int8_t h2, uint32_t& hits, uint32_t& empties) const {
+#if defined(__SSE2__)
+      __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(_ctrl + i));
+      hits = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(h2))));
+      empties = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(empty_ctrl))));
+#else
+      hits = empties = 0;
+      for (size_t k = 0; k < group_size; ++k) {
+        if (_ctrl[i + k] == h2) hits |= 1u << k;
+        if (_ctrl[i + k] == empty_ctrl) empties |= 1u << k;
+      }
+#endif
+    }
+
+    size_t __find(const Key& key) const { return _size ? __find(key, Hash()(key)) : _capacity; }
+
+    // the slot of the key, or _capacity
+    size_t __find(const Key& key, size_t hash) const {
+      if (!_size) return _capacity;
+
+      int8_t h2 = __h2(hash);
+      size_t mask = _capacity - 1;
+
+      for (size_t i = __home(hash);; i = (i + group_size) & mask) {
+        uint32_t hits, empties;
+        __match(i, h2, hits, empties);
+
+        // only the candidates before the first empty slot belong to the probe
+        if (empties) hits &= (empties & -empties) - 1;
+
+        for (; hits; hits &= hits - 1) {
+          size_t j = (i + __builtin_ctz(hits)) & mask;
+          if (__equal(__at(j)->first, key)) return j;
+        }
+
+        if (empties) return _capacity;
+      }
+    }
+
+    // the first empty slot from the home slot, there is always one
+    size_t __free_slot(size_t hash) const {
+      size_t mask = _capacity - 1;
+
+      for (size_t i = __home(hash);; i = (i + group_size) & mask) {
+        uint32_t hits, empties;
+        __match(i, 0, hits, empties);
+
+        if (empties) return (i + __builtin_ctz(empties)) & mask;
+      }
+    }
+
+    template<typename... Args>
+    size_t __construct(size_t hash, const Key& key, Args&&... args) {
+      size_t i = __free_slot(hash);
+
+      new (&_slots[i]) value_type(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...));
+      __set_ctrl(i, __h2(hash));
+      ++_size;
+
+      return i;
+    }
+
+    template<typename V>
+    void __insert_unique(const Key& key, V&& v) {
+      if ((_size + 1) * 4 > _capacity * 3) __rehash(_capacity ? _capacity * 2 : min_capacity);
+      __construct(Hash()(key), key, std::forward<V>(v));
+    }
+
+    // Backward shift : walk the cluster after the hole, an entry whose home slot is not in
+    // (hole, entry] cyclically may fill the hole, which moves to where the entry was.
+    void __erase(size_t hole) {
+      size_t mask = _capacity - 1;
+
+      __at(hole)->~value_type();
+
+      for (size_t j = (hole + 1) & mask; _ctrl[j] != empty_ctrl; j = (j + 1) & mask) {
+        size_t home = __home(Hash()(__at(j)->first));
+
+        bool stays = (hole <= j) ? (hole < home && home <= j) : (hole < home || home <= j);
+        if (stays) continue;
+
+        new (&_slots[hole]) value_type(std::move(*__at(j)));
+        __at(j)->~value_type();
+        __set_ctrl(hole, _ctrl[j]);
+
+        hole = j;
+      }
+
+      __set_ctrl(hole, empty_ctrl);
+      --_size;
+    }
+
+    size_t __next_full(size_t i) const {
+      while (i < _capacity && _ctrl[i] == empty_ctrl) ++i;
+      return i;
+    }
+
+    void __rehash(size_t capacity) {
+      int8_t* ctrl = _ctrl;
+      slot_type* slots = _slots;
+      size_t old_capacity = _capacity;
+
+      _ctrl = static_cast<int8_t*>(std::malloc(capacity + group_size));
+      _slots = static_cast<slot_type*>(std::malloc(capacity * sizeof(slot_type)));
+      if (!_ctrl || !_slots) {
+        std::free(_ctrl);
+        std::free(_slots);
+        _ctrl = ctrl;
+        _slots = slots;
+        throw std::bad_alloc();
+      }
+
+      std::memset(_ctrl, empty_ctrl, capacity + group_size);
+      _capacity = capacity;
+      _size = 0;
+
+      for (size_t i = 0; i < old_capacity; ++i) {
+        if (ctrl[i] == empty_ctrl) continue;
+
+        value_type* v = reinterpret_cast<value_type*>(&slots[i]);
+        __construct(Hash()(v->first), v->first, std::move(v->second));
+        v->~value_type();
+      }
+
+      std::free(ctrl);
+      std::free(slots);
+    }
+
+    void __release() {
+      std::free(_ctrl);
+      std::free(_slots);
+      _ctrl = nullptr;
+      _slots = nullptr;
+      _capacity = 0;
+    }
+
+  private:
+
+    int8_t* _ctrl;      // _capacity + group_size control bytes
+    slot_type* _slots;
+    size_t _capacity;   // a power of 2, or 0
+    size_t _size;
+  };
+
+} // atlas
+
+#endif /* ATLAS_FLAT_MAP128_H_ */
@@ -30,14 +30,24 @@
 #include <atomic>
 #include <thread>
 #include <memory>
+#include <limits>
+#include <functional>
 
 #include <boost/iterator/iterator_facade.hpp>
 
 #include <atlas/likely.h>
 #include <atlas/lock.h>
+#include <atlas/container/epoch.h>
 
 namespace atlas {
 
+  template<typename K, typename V, typename Comp, int MAX_HEIGHT>
+  class concurrent_skip_list_map;
+
+  /*
+   * The lookups take any key the comparator can compare with the data, e.g. the key alone
+   * for the entries of concurrent_skip_list_map.
+   * */
   template<typename T, typename Comp = std::less<T>, int MAX_HEIGHT = 24>
   class concurrent_skip_list {
 
@@ -61,6 +71,8 @@ namespace atlas {
     class Accessor;
     class Skipper;
 
+    template<typename, typename, typename, int> friend class concurrent_skip_list_map;
+
     // convenient function to get an Accessor to a new instance.
     static Accessor create(int height = 1) {
       return Accessor(createInstance(height));
@@ -81,8 +93,8 @@ namespace atlas {
     // Please see concurrent_skip_list::Accessor for stdlib-like APIs.
     //===================================================================
 
+    // the removed nodes are not reachable from head_ any more, the epoch_domain frees them
     ~concurrent_skip_list() {
-      // CHECK_EQ(recycler_.refs(), 0);
       while (NodeType* current = head_.load(std::memory_order_relaxed)) {
         NodeType* tmp = current->skip(0);
         NodeType::destroy(current);
@@ -92,15 +104,18 @@ namespace atlas {
 
   private:
 
-    static bool greater(const value_type &data, const NodeType *node) {
+    template<typename Key>
+    static bool greater(const Key &data, const NodeType *node) {
       return node && Comp()(node->data(), data);
     }
 
-    static bool less(const value_type &data, const NodeType *node) {
+    template<typename Key>
+    static bool less(const Key &data, const NodeType *node) {
       return (node == nullptr) || Comp()(data, node->data());
     }
 
-    static int findInsertionPoint(NodeType *cur, int cur_layer, const value_type &data, NodeType *preds[],
+    template<typename Key>
+    static int findInsertionPoint(NodeType *cur, int cur_layer, const Key &data, NodeType *preds[],
         NodeType *succs[]) {
       int foundLayer = -1;
       NodeType *pred = cur;
@@ -125,76 +140,7 @@ namespace atlas {
       return foundLayer;
     }
 
-    struct Recycler: private boost::noncopyable {
-      Recycler() : refs_(0), dirty_(false) { lock_.init(); }
-
-      ~Recycler() {
-        if (nodes_) {
-          for (auto& node : *nodes_) {
-            NodeType::destroy(node);
-          }
-        }
-      }
-
-      void add(NodeType* node) {
-        std::lock_guard<micro_spin_lock> g(lock_);
-        if (nodes_.get() == nullptr) { nodes_.reset(new std::vector<NodeType*>(1, node)); }
-        else { nodes_->push_back(node); }
-
-        // DCHECK_GT(refs(), 0);
-        dirty_.store(true, std::memory_order_relaxed);
-      }
-
-      int refs() const { return refs_.load(std::memory_order_relaxed); }
-
-      int addRef() { return refs_.fetch_add(1, std::memory_order_relaxed); }
-
-      int release() {
-        // We don't expect to clean the recycler immediately everytime it is OK
-        // to do so. Here, it is possible that multiple accessors all release at
-        // the same time but nobody would clean the recycler here. If this
-        // happens, the recycler will usually still get cleaned when
-        // such a race doesn't happen. The worst case is the recycler will
-        // eventually get deleted along with the skiplist.
-        if (likely(!dirty_.load(std::memory_order_relaxed) || refs() > 1)) {
-          return refs_.fetch_add(-1, std::memory_order_relaxed);
-        }
-
-        std::unique_ptr<std::vector<NodeType*> > newNodes;
-        {
-          std::lock_guard<micro_spin_lock> g(lock_);
-          if (nodes_.get() == nullptr || refs() > 1) {
-            return refs_.fetch_add(-1, std::memory_order_relaxed);
-          }
-          // once refs_ reaches 1 and there is no other accessor, it is safe to
-          // remove all the current nodes in the recycler, as we already acquired
-          // the lock here so no more new nodes can be added, even though new
-          // accessors may be added after that.
-          newNodes.swap(nodes_);
-          dirty_.store(false, std::memory_order_relaxed);
-        }
-
-        // TODO(xliu) should we spawn a thread to do this when there are large
-        // number of nodes in the recycler?
-        for (auto& node : *newNodes) {
-          NodeType::destroy(node);
-        }
-
-        // decrease the ref count at the very end, to minimize the
-        // chance of other threads acquiring lock_ to clear the deleted
-        // nodes again.
-        return refs_.fetch_add(-1, std::memory_order_relaxed);
-      }
-
-    private:
-
-      std::unique_ptr<std::vector<NodeType*>> nodes_;
-      std::atomic<int32_t> refs_; // current number of visitors to the list
-      std::atomic<bool> dirty_; // whether *nodes_ is non-empty
-      micro_spin_lock lock_; // protects access to *nodes_
-    };  // class concurrent_skip_list::Recycler
-
-    explicit concurrent_skip_list(int height) : head_(NodeType::create(height, value_type(), true)), size_(0) {}
+    explicit concurrent_skip_list(int height) : head_(NodeType::createHead(height)), size_(0) {}
 
     size_t size() const { return size_.load(std::memory_order_relaxed); }
     int height() const { return head_.load(std::memory_order_consume)->height(); }
@@ -203,7 +149,8 @@ namespace atlas {
     size_t incrementSize(int delta) { return size_.fetch_add(delta, std::memory_order_relaxed) + delta; }
 
     // Returns the node if found, nullptr otherwise.
-    NodeType* find(const value_type &data) {
+    template<typename Key>
+    NodeType* find(const Key &data) {
       auto ret = findNode(data);
       if (ret.second && !ret.first->markedForRemoval()) return ret.first;
       return nullptr;
@@ -242,6 +189,13 @@ namespace atlas {
     //     0 means not added, otherwise reutrns the new size.
     template<typename U>
     std::pair<NodeType*, size_t> addOrGetData(U &&data) {
+      return emplaceOrGetData(data, std::forward<U>(data));
+    }
+
+    // Like addOrGetData(), the node data is constructed from args only if
+    // no data equals the key, so the args are never consumed otherwise.
+    template<typename Key, typename... Args>
+    std::pair<NodeType*, size_t> emplaceOrGetData(const Key &data, Args&&... args) {
       NodeType *preds[MAX_HEIGHT], *succs[MAX_HEIGHT];
       NodeType *newNode;
       size_t newSize;
@@ -263,7 +217,7 @@ namespace atlas {
         }
 
         // need to capped at the original height -- the real height may have grown
-        int nodeHeight = detail::SkipListRandomHeight::ref()->
+        int nodeHeight = detail::SkipListRandomHeight::instance()->
         getHeight(max_layer + 1);
 
         scoped_locker guards[MAX_HEIGHT];
@@ -272,7 +226,7 @@ namespace atlas {
         }
 
         // locks acquired and all valid, need to modify the links under the locks.
-        newNode = NodeType::create(nodeHeight, std::forward<U>(data));
+        newNode = NodeType::create(nodeHeight, std::forward<Args>(args)...);
         for (int layer = 0; layer < nodeHeight; ++layer) {
           newNode->setSkip(layer, succs[layer]);
           preds[layer]->setSkip(layer, newNode);
@@ -285,7 +239,7 @@ namespace atlas {
 
       int hgt = height();
       size_t sizeLimit =
-      detail::SkipListRandomHeight::ref()->getSizeLimit(hgt);
+      detail::SkipListRandomHeight::instance()->getSizeLimit(hgt);
 
       if (hgt < MAX_HEIGHT && newSize > sizeLimit) {
         growHeight(hgt + 1);
@@ -295,7 +249,8 @@ namespace atlas {
       return std::make_pair(newNode, newSize);
     }
 
-    bool remove(const value_type &data) {
+    template<typename Key>
+    bool remove(const Key &data) {
       NodeType *nodeToDelete = nullptr;
       scoped_locker nodeGuard;
       bool isMarked = false;
@@ -360,7 +315,8 @@ namespace atlas {
     }
 
     // find node for insertion/deleting
-    int findInsertionPointGetMaxLayer(const value_type &data, NodeType *preds[], NodeType *succs[], int *max_layer) const {
+    template<typename Key>
+    int findInsertionPointGetMaxLayer(const Key &data, NodeType *preds[], NodeType *succs[], int *max_layer) const {
       *max_layer = maxLayer();
       return findInsertionPoint(head_.load(std::memory_order_consume), *max_layer, data, preds, succs);
     }
@@ -370,14 +326,16 @@ namespace atlas {
     // pair.second = 1 when the data value is founded, or 0 otherwise.
     // This is like lower_bound, but not exact: we could have the node marked for
     // removal so still need to check that.
-    std::pair<NodeType*, int> findNode(const value_type &data) const {
+    template<typename Key>
+    std::pair<NodeType*, int> findNode(const Key &data) const {
       return findNodeDownRight(data);
     }
 
     // Find node by first stepping down then stepping right. Based on benchmark
     // results, this is slightly faster than findNodeRightDown for better
     // localality on the skipping pointers.
-    std::pair<NodeType*, int> findNodeDownRight(const value_type &data) const {
+    template<typename Key>
+    std::pair<NodeType*, int> findNodeDownRight(const Key &data) const {
       NodeType *pred = head_.load(std::memory_order_consume);
       int ht = pred->height();
       NodeType *node = nullptr;
@@ -401,7 +359,8 @@ namespace atlas {
 
     // find node by first stepping right then stepping down.
     // We still keep this for reference purposes.
-    std::pair<NodeType*, int> findNodeRightDown(const value_type &data) const {
+    template<typename Key>
+    std::pair<NodeType*, int> findNodeRightDown(const Key &data) const {
       NodeType *pred = head_.load(std::memory_order_consume);
       NodeType *node = nullptr;
       auto top = maxLayer();
@@ -417,7 +376,8 @@ namespace atlas {
       return std::make_pair(node, found);
     }
 
-    NodeType* lower_bound(const value_type &data) const {
+    template<typename Key>
+    NodeType* lower_bound(const Key &data) const {
       auto node = findNode(data).first;
       while (node != nullptr && node->markedForRemoval()) {
         node = node->skip(0);
@@ -431,7 +391,7 @@ namespace atlas {
         return;
       }
 
-      NodeType* newHead = NodeType::create(height, value_type(), true);
+      NodeType* newHead = NodeType::createHead(height);
 
       { // need to guard the head node in case others are adding/removing
         // nodes linked to the head.
@@ -449,17 +409,19 @@ namespace atlas {
       recycle(oldHead);
     }
 
+    // freed once no thread in an operation, or holding an iterator, can still see it
     void recycle(NodeType *node) {
-      recycler_.add(node);
+      epoch_domain::retire(node, &NodeType::destroyRetired);
     }
 
     private:
 
     std::atomic<NodeType*> head_;
-    Recycler recycler_;
     std::atomic<size_t> size_;
   };
 
+  // Every operation pins the calling thread while it runs, the Accessor itself holds no pin :
+  // it can be shared, copied and destroyed by any thread, and kept for as long as the list.
   template<typename T, typename Comp, int MAX_HEIGHT>
   class concurrent_skip_list<T, Comp, MAX_HEIGHT>::Accessor {
     typedef detail::SkipListNode<T> NodeType;
@@ -485,44 +447,37 @@ namespace atlas {
         slHolder_(std::move(skip_list)) {
       sl_ = slHolder_.get();
       // DCHECK(sl_ != nullptr);
-      sl_->recycler_.addRef();
     }
 
     // Unsafe initializer: the caller assumes the responsibility to keep
     // skip_list valid during the whole life cycle of the Acessor.
     explicit Accessor(concurrent_skip_list *skip_list) : sl_(skip_list) {
       // DCHECK(sl_ != nullptr);
-      sl_->recycler_.addRef();
     }
 
-    Accessor(const Accessor &accessor) : sl_(accessor.sl_), slHolder_(accessor.slHolder_) {
-      sl_->recycler_.addRef();
-    }
+    Accessor(const Accessor &accessor) : sl_(accessor.sl_), slHolder_(accessor.slHolder_) {}
 
     Accessor& operator=(const Accessor &accessor) {
       if (this != &accessor) {
         slHolder_ = accessor.slHolder_;
-        sl_->recycler_.release();
         sl_ = accessor.sl_;
-        sl_->recycler_.addRef();
       }
       return *this;
     }
 
-    ~Accessor() { sl_->recycler_.release(); }
-
     bool empty() const { return sl_->size() == 0; }
     size_t size() const { return sl_->size(); }
     size_type max_size() const { return std::numeric_limits<size_type>::max(); }
 
     // returns end() if the value is not in the list, otherwise returns an
     // iterator pointing to the data, and it's guaranteed that the data is valid
-    // as far as the Accessor is hold.
-    iterator find(const key_type &value) { return iterator(sl_->find(value)); }
-    const_iterator find(const key_type &value) const { return iterator(sl_->find(value)); }
+    // as far as the iterator is hold.
+    iterator find(const key_type &value) { epoch_guard g; return iterator(sl_->find(value)); }
+    const_iterator find(const key_type &value) const { epoch_guard g; return iterator(sl_->find(value)); }
     size_type count(const key_type &data) const { return contains(data); }
 
     iterator begin() const {
+      epoch_guard g;
       NodeType* head = sl_->head_.load(std::memory_order_consume);
       return iterator(head->next());
     }
@@ -533,14 +488,15 @@ namespace atlas {
 
     template<typename U, typename = typename std::enable_if<std::is_convertible<U, T>::value>::type>
     std::pair<iterator, bool> insert(U&& data) {
+      epoch_guard g;
       auto ret = sl_->addOrGetData(std::forward<U>(data));
       return std::make_pair(iterator(ret.first), ret.second);
     }
     size_t erase(const key_type &data) {return remove(data);}
 
-    iterator lower_bound(const key_type &data) const { return iterator(sl_->lower_bound(data)); }
+    iterator lower_bound(const key_type &data) const { epoch_guard g; return iterator(sl_->lower_bound(data)); }
 
-    size_t height() const {return sl_->height();}
+    size_t height() const { epoch_guard g; return sl_->height(); }
 
     // first() returns pointer to the first element in the skiplist, or
     // nullptr if empty.
@@ -553,8 +509,11 @@ namespace atlas {
     //   last() is not guaranteed to be the max_element(), and both of them can
     //   be invalid (i.e. nullptr), so we name them differently from front() and
     //   tail() here.
-    const key_type *first() const {return sl_->first();}
-    const key_type *last() const {return sl_->last();}
+    //
+    // The pointers stay valid while the node is in the list, or while the
+    // thread holds an iterator or an epoch_guard taken before the call.
+    const key_type *first() const { epoch_guard g; return sl_->first(); }
+    const key_type *last() const { epoch_guard g; return sl_->last(); }
 
     // Try to remove the last element in the skip list.
     //
@@ -562,11 +521,13 @@ namespace atlas {
     // or a race condition happened (i.e. the used-to-be last element
     // was already removed by another thread).
     bool pop_back() {
+      epoch_guard g;
       auto last = sl_->last();
       return last ? sl_->remove(*last) : false;
     }
 
     std::pair<key_type*, bool> addOrGetData(const key_type &data) {
+      epoch_guard g;
       auto ret = sl_->addOrGetData(data);
       return std::make_pair(&ret.first->data(), ret.second);
     }
@@ -577,9 +538,9 @@ namespace atlas {
     // TODO:(xliu) remove these.
     // Returns true if the node is added successfully, false if not, i.e. the
     // node with the same key already existed in the list.
-    bool contains(const key_type &data) const {return sl_->find(data);}
-    bool add(const key_type &data) {return sl_->addOrGetData(data).second;}
-    bool remove(const key_type &data) {return sl_->remove(data);}
+    bool contains(const key_type &data) const { epoch_guard g; return sl_->find(data); }
+    bool add(const key_type &data) { epoch_guard g; return sl_->addOrGetData(data).second; }
+    bool remove(const key_type &data) { epoch_guard g; return sl_->remove(data); }
 
   private:
     skip_list_type *sl_;
@@ -587,6 +548,8 @@ namespace atlas {
   };
 
 // implements forward iterator concept.
+  // An iterator pins the thread which makes it, so the nodes it reaches stay valid while it lives,
+  // it must be destroyed by that thread.
   template<typename ValT, typename NodeT>
   class detail::csl_iterator: public boost::iterator_facade<csl_iterator<ValT, NodeT>, ValT,
       boost::forward_traversal_tag> {
@@ -619,6 +582,7 @@ namespace atlas {
 
     value_type& dereference() const { return node_->data(); }
 
+    epoch_guard guard_;
     NodeT* node_;
   };
 
@@ -714,6 +678,7 @@ namespace atlas {
 
     NodeType* head() const { return accessor_.skiplist()->head_.load(std::memory_order_consume); }
 
+    epoch_guard guard_; // the Skipper keeps nodes between the calls, it belongs to its thread
     Accessor accessor_;
     int headHeight_;
     NodeType *succs_[MAX_HEIGHT], *preds_[MAX_HEIGHT];
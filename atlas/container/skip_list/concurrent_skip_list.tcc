@@ -22,9 +22,17 @@
 #include <type_traits>
 #include <climits>
 #include <cmath>
+#include <cassert>
+#include <cstdlib>
+#include <limits>
+#include <atomic>
+#include <mutex>
 
+#include <boost/noncopyable.hpp>
 #include <boost/random.hpp>
 
+#include <atlas/lock.h>
+
 namespace atlas {
   namespace detail {
 
@@ -39,16 +47,20 @@ namespace atlas {
 
       typedef T value_type;
 
-      template<typename U, typename = typename std::enable_if<std::is_convertible<U, T>::value>::type>
-      static SkipListNode* create(int height, U&& data, bool isHead = false) {
-        // DCHECK(height >= 1 && height < 64) << height;
+      // the data is constructed in place from the arguments
+      template<typename... U>
+      static SkipListNode* create(int height, U&&... data) {
+        return new (allocate(height)) SkipListNode(height, false, std::forward<U>(data)...);
+      }
 
-          size_t size = sizeof(SkipListNode) +
-          height * sizeof(std::atomic<SkipListNode*>);
-          auto* node = static_cast<SkipListNode*>(malloc(size));
-          // do placement new
-          new (node) SkipListNode(height, std::forward<U>(data), isHead);
-          return node;
+      // a head node holds a default constructed data
+      static SkipListNode* createHead(int height) {
+        return new (allocate(height)) SkipListNode(height, true);
+      }
+
+        static void* allocate(int height) {
+          // DCHECK(height >= 1 && height < 64) << height;
+          return malloc(sizeof(SkipListNode) + height * sizeof(std::atomic<SkipListNode*>));
         }
 
         static void destroy(SkipListNode* node) {
@@ -56,9 +68,14 @@ namespace atlas {
           free(node);
         }
 
+        // the deleter handed to the epoch_domain
+        static void destroyRetired(void* node) {
+          destroy(static_cast<SkipListNode*>(node));
+        }
+
         // copy the head node to a new head node assuming lock acquired
         SkipListNode* copyHead(SkipListNode* node) {
-          std::assert(node != nullptr && height_ > node->height_);
+          assert(node != nullptr && height_ > node->height_);
 
           setFlags(node->getFlags());
           for (int i = 0; i < node->height_; ++i) {
@@ -68,7 +85,7 @@ namespace atlas {
         }
 
         inline SkipListNode* skip(int layer) const {
-          std::assert(layer < height_);
+          assert(layer < height_);
 
           return skip_[layer].load(std::memory_order_consume);
         }
@@ -83,7 +100,7 @@ namespace atlas {
         }
 
         void setSkip(uint8_t h, SkipListNode* next) {
-          std::assert(h < height_);
+          assert(h < height_);
 
           skip_[h].store(next, std::memory_order_release);
         }
@@ -108,9 +125,9 @@ namespace atlas {
       private:
 
         // Note! this can only be called from create() as a placement new.
-        template<typename U>
-        SkipListNode(uint8_t height, U&& data, bool isHead) :
-        height_(height), data_(std::forward<U>(data)) {
+        template<typename... U>
+        SkipListNode(uint8_t height, bool isHead, U&&... data) :
+        height_(height), data_(std::forward<U>(data)...) {
           spinLock_.init();
           setFlags(0);
           if (isHead) setIsHeadNode();
@@ -198,7 +215,7 @@ namespace atlas {
       static double randomProb() {
         // TODO : check thread_local
         static thread_local boost::lagged_fibonacci2281 rng_;
-        return (*rng_)();
+        return rng_();
       }
 
       double lookupTable_[kMaxHeight];
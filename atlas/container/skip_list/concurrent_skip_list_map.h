@@ -0,0 +1,170 @@
+/*
+ * concurrent_skip_list_map.h
+ *
+ *  Created on: Nov 5, 2013
+ *      Author: vincent
+ */
+
+#ifndef ATLAS_CONTAINER_CONCURRENT_SKIP_LIST_MAP_H_
+#define ATLAS_CONTAINER_CONCURRENT_SKIP_LIST_MAP_H_
+
+#include <tuple>
+#include <memory>
+#include <utility>
+#include <functional>
+
+#include <atlas/container/skip_list/concurrent_skip_list.tcc>
+#include <atlas/container/skip_list/concurrent_skip_list.h>
+
+namespace atlas {
+  namespace detail {
+
+    // order the entries of a concurrent_skip_list_map by their keys, and compare them with bare keys
+    template<typename K, typename V, typename Comp>
+    struct csl_map_compare {
+      typedef std::pair<const K, V> entry_type;
+
+      bool operator()(const entry_type& a, const entry_type& b) const { return Comp()(a.first, b.first); }
+      bool operator()(const entry_type& a, const K& b) const { return Comp()(a.first, b); }
+      bool operator()(const K& a, const entry_type& b) const { return Comp()(a, b.first); }
+    };
+
+  } // detail
+
+  /*
+   * A sorted map over concurrent_skip_list : the nodes hold std::pair<const K, V>, the lookups
+   * take the key alone. Reads of the structure are lock-free like for the set. A value is updated
+   * in place under the spin lock of its own node, by insert_or_assign() and compute_if_present(),
+   * so the entries are never removed and inserted again to change them.
+   *
+   * Reading a value through an iterator is not synchronized with these updates, use get() to copy
+   * it under the node lock. The head node holds a default constructed entry, so K and V must be
+   * default constructible.
+   *
+   * Like the Accessor of the set, every operation pins the calling thread while it runs, so a long
+   * lived Accessor does not hold back the reclamation of the erased entries.
+   *
+   *     auto accessor = concurrent_skip_list_map<int, std::string>::create();
+   *     accessor.emplace(1, "one");
+   *     accessor.insert_or_assign(1, "uno");
+   *     accessor.compute_if_present(1, [](std::string& v) { v += "!"; });
+   * */
+  template<typename K, typename V, typename Comp = std::less<K>, int MAX_HEIGHT = 24>
+  class concurrent_skip_list_map {
+  public:
+
+    typedef concurrent_skip_list<std::pair<const K, V>, detail::csl_map_compare<K, V, Comp>, MAX_HEIGHT> skip_list_type;
+
+    class Accessor;
+
+    static Accessor create(int height = 1) { return Accessor(createInstance(height)); }
+
+    static std::shared_ptr<skip_list_type> createInstance(int height = 1) { return skip_list_type::createInstance(height); }
+  };
+
+  template<typename K, typename V, typename Comp, int MAX_HEIGHT>
+  class concurrent_skip_list_map<K, V, Comp, MAX_HEIGHT>::Accessor {
+
+    typedef typename skip_list_type::NodeType NodeType;
+    typedef std::unique_lock<micro_spin_lock> scoped_locker;
+
+  public:
+
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<const K, V> value_type;
+    typedef size_t size_type;
+    typedef Comp key_compare;
+
+    typedef typename skip_list_type::iterator iterator;
+    typedef typename skip_list_type::const_iterator const_iterator;
+
+    explicit Accessor(std::shared_ptr<skip_list_type> skip_list) :
+      accessor_(std::move(skip_list)), sl_(accessor_.skiplist()) {}
+
+    // Unsafe initializer: the caller keeps the skip list alive during the whole life of the Accessor.
+    explicit Accessor(skip_list_type* skip_list) : accessor_(skip_list), sl_(skip_list) {}
+
+    bool empty() const { return sl_->size() == 0; }
+    size_t size() const { return sl_->size(); }
+
+    iterator begin() const { return accessor_.begin(); }
+    iterator end() const { return accessor_.end(); }
+
+    iterator find(const key_type& key) const { epoch_guard g; return iterator(sl_->find(key)); }
+    iterator lower_bound(const key_type& key) const { epoch_guard g; return iterator(sl_->lower_bound(key)); }
+
+    bool contains(const key_type& key) const { epoch_guard g; return sl_->find(key) != nullptr; }
+    size_type count(const key_type& key) const { return contains(key); }
+
+    // copy the value under the node lock, false if there is no such key
+    bool get(const key_type& key, mapped_type& value) const {
+      epoch_guard g;
+      NodeType* node = sl_->find(key);
+      if (!node) return false;
+
+      scoped_locker guard = node->acquireGuard();
+      if (node->markedForRemoval()) return false;
+
+      value = node->data().second;
+      return true;
+    }
+
+    // the value is constructed from args only if the key is not there yet
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(const key_type& key, Args&&... args) {
+      epoch_guard g;
+      auto ret = sl_->emplaceOrGetData(key, std::piecewise_construct,
+          std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...));
+
+      return std::make_pair(iterator(ret.first), ret.second != 0);
+    }
+
+    std::pair<iterator, bool> insert(const value_type& entry) { return emplace(entry.first, entry.second); }
+
+    // insert the value, or assign it in place to the existing one, true if inserted
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const key_type& key, M&& value) {
+      epoch_guard g;
+      for (;;) {
+        auto ret = sl_->emplaceOrGetData(key, std::piecewise_construct,
+            std::forward_as_tuple(key), std::forward_as_tuple(std::forward<M>(value)));
+        if (ret.second) return std::make_pair(iterator(ret.first), true);
+
+        NodeType* node = ret.first;
+        scoped_locker guard = node->acquireGuard();
+        if (node->markedForRemoval()) continue; // erased meanwhile, insert a new entry
+
+        node->data().second = std::forward<M>(value);
+        return std::make_pair(iterator(node), false);
+      }
+    }
+
+    // Run f(mapped_type&) under the node lock if the key is there, keep it short : the lock
+    // is a spin lock, and it also guards linking the nodes next to this one.
+    template<typename F>
+    bool compute_if_present(const key_type& key, F f) {
+      epoch_guard g;
+      NodeType* node = sl_->find(key);
+      if (!node) return false;
+
+      scoped_locker guard = node->acquireGuard();
+      if (node->markedForRemoval()) return false;
+
+      f(node->data().second);
+      return true;
+    }
+
+    size_t erase(const key_type& key) { epoch_guard g; return sl_->remove(key); }
+
+    skip_list_type* skiplist() const { return sl_; }
+
+  private:
+
+    typename skip_list_type::Accessor accessor_;
+    skip_list_type* sl_;
+  };
+
+} // atlas
+
+#endif /* ATLAS_CONTAINER_CONCURRENT_SKIP_LIST_MAP_H_ */
@@ -0,0 +1,199 @@
+/*
+ * spsc_ring.h
+ *
+ *  Created on: Oct 23, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+#ifndef ATLAS_SPSC_RING_H_
+#define ATLAS_SPSC_RING_H_
+
+#include <atomic>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+
+namespace atlas {
+
+  // The indexes of a ring, they only grow, the position in the ring is index & (capacity - 1).
+  // It is a standard layout block, so that a ring can live in memory shared by two processes.
+  struct spsc_ring_control {
+
+    spsc_ring_control() : head(0), tail(0) {}
+
+    alignas(64) std::atomic<uint64_t> head; // written by the consumer
+    alignas(64) std::atomic<uint64_t> tail; // written by the producer
+  };
+
+  /*
+   * A lock free single producer single consumer ring of variable size messages.
+   *
+   * Every message is a 4 bytes length followed by the bytes, padded to 8 bytes. A message never
+   * wraps around : if it does not fit before the end of the storage, a skip mark fills the rest and
+   * the message starts over at the beginning. So the consumer always sees a contiguous message and
+   * reads it in place. A message takes at most capacity / 2 bytes.
+   *
+   * The consumer checks every length against the storage and the published tail, since a peer
+   * process may write anything in shared memory. A frame which does not fit marks the ring broken :
+   * try_pop() returns false from then on and never reads past the storage.
+   * */
+  class spsc_ring {
+  public:
+
+    static const size_t frame_header_size = 8;
+
+  public:
+
+    // a ring which owns its storage, capacity is rounded up to a power of 2
+    explicit spsc_ring(size_t capacity) :
+      _owned_control(__new_control()), _owned_data(new char[__round_up(capacity)]),
+      _control(_owned_control.get()), _data(_owned_data.get()), _capacity(__round_up(capacity)),
+      _broken(false)
+    {}
+
+    // a ring over external storage, e.g. shared memory, capacity must be a power of 2
+    spsc_ring(spsc_ring_control* control, char* data, size_t capacity) :
+      _control(control), _data(data), _capacity(capacity), _broken(false)
+    {
+      if (capacity < 64 || (capacity & (capacity - 1)) != 0) throw std::invalid_argument("bad spsc_ring capacity");
+    }
+
+    spsc_ring(const spsc_ring&) = delete;
+    spsc_ring& operator=(const spsc_ring&) = delete;
+
+  public:
+
+    size_t capacity() const { return _capacity; }
+
+    size_t max_message_size() const { return _capacity / 2 - frame_header_size; }
+
+    // producer side, returns false if the ring is full, throws if the message can never fit
+    bool try_push(const char* p, size_t n) {
+      return try_push(p, n, nullptr, 0);
+    }
+
+    // push the concatenation of two pieces as one message, e.g. a header and a body
+    bool try_push(const char* p1, size_t n1, const char* p2, size_t n2) {
+      size_t n = n1 + n2;
+      if (n > max_message_size()) throw std::length_error("message too large for the spsc_ring");
+
+      uint64_t tail = _control->tail.load(std::memory_order_relaxed);
+      uint64_t head = _control->head.load(std::memory_order_acquire);
+
+      size_t frame = __frame_size(n);
+      size_t offset = tail & (_capacity - 1);
+      size_t gap = (_capacity - offset < frame) ? _capacity - offset : 0;
+
+      if (tail + gap + frame - head > _capacity) return false;
+
+      if (gap) {
+        __write_length(offset, skip_mark);
+        tail += gap;
+        offset = 0;
+      }
+
+      __write_length(offset, static_cast<uint32_t>(n));
+      std::memcpy(_data + offset + frame_header_size, p1, n1);
+      if (n2) std::memcpy(_data + offset + frame_header_size + n1, p2, n2);
+
+      _control->tail.store(tail + frame, std::memory_order_release);
+
+      return true;
+    }
+
+    // consumer side, f(const char*, size_t) reads the message in place, returns false if the ring is
+    // empty or broken
+    template<typename F>
+    bool try_pop(F f) {
+      if (_broken) return false;
+
+      uint64_t head = _control->head.load(std::memory_order_relaxed);
+      uint64_t tail = _control->tail.load(std::memory_order_acquire);
+      if (head == tail) return false;
+      if (tail - head > _capacity) return __break();
+
+      size_t offset = head & (_capacity - 1);
+      uint32_t n = __read_length(offset);
+
+      // the skip mark fills the end of the storage, a whole frame follows it at the beginning
+      if (n == skip_mark) {
+        if (offset == 0 || tail - head < _capacity - offset + frame_header_size) return __break();
+
+        head += _capacity - offset;
+        offset = 0;
+        n = __read_length(offset);
+      }
+
+      if (n > _capacity - offset - frame_header_size || __frame_size(n) > tail - head) return __break();
+
+      f(static_cast<const char*>(_data + offset + frame_header_size), static_cast<size_t>(n));
+
+      _control->head.store(head + __frame_size(n), std::memory_order_release);
+
+      return true;
+    }
+
+    // a corrupt frame was met, the ring is not read any more
+    bool broken() const { return _broken; }
+
+    bool empty() const {
+      return _control->head.load(std::memory_order_acquire) == _control->tail.load(std::memory_order_acquire);
+    }
+
+  private:
+
+    static const uint32_t skip_mark = 0xffffffff;
+
+    static size_t __frame_size(size_t n) { return (frame_header_size + n + 7) & ~size_t(7); }
+
+    void __write_length(size_t offset, uint32_t n) { std::memcpy(_data + offset, &n, sizeof n); }
+
+    uint32_t __read_length(size_t offset) const {
+      uint32_t n;
+      std::memcpy(&n, _data + offset, sizeof n);
+      return n;
+    }
+
+    bool __break() {
+      _broken = true;
+      return false;
+    }
+
+    static size_t __round_up(size_t n) {
+      size_t r = 64;
+      while (r < n) r <<= 1;
+      return r;
+    }
+
+    // the indexes are on cache lines of their own, operator new ignores the alignment
+    struct __control_deleter {
+      void operator()(spsc_ring_control* control) const {
+        control->~spsc_ring_control();
+        free(control);
+      }
+    };
+
+    static spsc_ring_control* __new_control() {
+      void* p = nullptr;
+      if (posix_memalign(&p, alignof(spsc_ring_control), sizeof(spsc_ring_control)) != 0) throw std::bad_alloc();
+
+      return new (p) spsc_ring_control;
+    }
+
+  private:
+
+    std::unique_ptr<spsc_ring_control, __control_deleter> _owned_control;
+    std::unique_ptr<char[]> _owned_data;
+
+    spsc_ring_control* _control;
+    char* _data;
+    size_t _capacity;
+    bool _broken; // consumer side only
+  };
+
+} // atlas
+
+#endif /* ATLAS_SPSC_RING_H_ */
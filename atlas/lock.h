@@ -42,6 +42,10 @@
 
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <array>
+#include <type_traits>
 
 namespace atlas {
   namespace {
@@ -131,7 +135,7 @@ namespace atlas {
     }
 
     void unlock() {
-      std::assert(_lock == LOCKED);
+      assert(_lock == LOCKED);
 
       asm volatile("" : : : "memory");
       _lock = FREE; // release barrier on x86
@@ -177,7 +181,7 @@ namespace atlas {
      * (This doesn't use a constructor because we want to be a POD.)
      */
     void init(IntType initialValue = 0) {
-      std::assert(!(initialValue & kLockBitMask_));
+      assert(!(initialValue & kLockBitMask_));
 
       _lock = initialValue;
     }
@@ -202,7 +206,7 @@ namespace atlas {
      * guaranteed that no other threads may be trying to use this.
      */
     void set_data(IntType w) {
-      std::assert(!(w & kLockBitMask_));
+      assert(!(w & kLockBitMask_));
       _lock = (_lock & kLockBitMask_) | w;
     }
 
@@ -286,12 +290,6 @@ namespace atlas {
 // TODO: generate it from configure (`getconf LEVEL1_DCACHE_LINESIZE`)
 #define FOLLY_CACHE_LINE_SIZE 64
 
-#if __cplusplus <= 201103
-  // TODO : char c?
-  struct max_align_t { char c; } __attribute__((aligned));
-  constexpr static const int alignof(max_align_t) { return sizeof(max_align_t); }
-#endif
-
   template<class T, size_t N>
   struct spin_lock_array {
 
@@ -314,8 +312,9 @@ namespace atlas {
     static_assert(sizeof(padded_spin_lock) == FOLLY_CACHE_LINE_SIZE, "Invalid size of padded_spin_lock");
 
     // Check if T can theoretically cross a cache line.
-    // BAD : not implemented yet in gcc-4.7.2
-    constexpr static const int align = alignof(max_align_t());
+    // gcc-4.7 has no std::max_align_t, take the most aligned scalars
+    struct max_align { long long ll; long double ld; void* p; };
+    constexpr static const int align = alignof(max_align);
     static_assert(align > 0 && FOLLY_CACHE_LINE_SIZE % align == 0 && sizeof(T) <= align,
         "T may cross cache line boundaries");
 
@@ -0,0 +1,236 @@
+/*
+ * admission.h
+ *
+ *  Created on: Oct 29, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_RPC_ADMISSION_H_
+#define ATLAS_RPC_ADMISSION_H_
+
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+#include <condition_variable>
+
+namespace atlas {
+  namespace rpc {
+
+    // A token bucket, not synchronized : rate tokens per second, at most burst of them saved up
+    class token_bucket {
+    public:
+
+      typedef std::chrono::steady_clock clock_type;
+
+    public:
+
+      token_bucket(double rate = 0, double burst = 1) { reset(rate, burst); }
+
+      // a rate of 0 disables the limit
+      void reset(double rate, double burst) {
+        _rate = rate;
+        _burst = std::max(burst, 1.0);
+        _tokens = _burst;
+        _last = clock_type::now();
+      }
+
+      bool enabled() const { return _rate > 0; }
+
+      bool try_take(clock_type::time_point now) {
+        if (!enabled()) return true;
+
+        __refill(now);
+        if (_tokens < 1) return false;
+
+        _tokens -= 1;
+        return true;
+      }
+
+      // how long until a token is available
+      clock_type::duration wait_time(clock_type::time_point now) {
+        if (!enabled()) return clock_type::duration::zero();
+
+        __refill(now);
+        if (_tokens >= 1) return clock_type::duration::zero();
+
+        return std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>((1 - _tokens) / _rate))
+            + clock_type::duration(1);
+      }
+
+    private:
+
+      void __refill(clock_type::time_point now) {
+        if (now <= _last) return;
+
+        _tokens = std::min(_burst, _tokens + std::chrono::duration<double>(now - _last).count() * _rate);
+        _last = now;
+      }
+
+    private:
+
+      double _rate;
+      double _burst;
+      double _tokens;
+      clock_type::time_point _last;
+    };
+
+    struct admission_stats {
+      size_t in_flight;   // admitted calls whose session is not complete yet
+      size_t waiting;     // callers blocked for a slot or a token, i.e. the queue depth
+      uint64_t admitted;
+      uint64_t rejected;
+    };
+
+    // Marks the calling thread as one which delivers responses while it lives, i.e. an IO, polling
+    // or timer thread. A call admitted there could only wait for slots released by this very thread,
+    // so a blocking admission_control rejects it at once instead.
+    class transport_thread {
+    public:
+
+      transport_thread() { __flag() = true; }
+
+      ~transport_thread() { __flag() = false; }
+
+      transport_thread(const transport_thread&) = delete;
+      transport_thread& operator=(const transport_thread&) = delete;
+
+      static bool current() { return __flag(); }
+
+    private:
+
+      static bool& __flag() {
+        static thread_local bool flag = false;
+        return flag;
+      }
+    };
+
+    /*
+     * Bound the sessions of a destination, or of any set of callers sharing the control :
+     * at most max_in_flight sessions at a time, and optionally a token bucket on the call rate.
+     * Beyond that, acquire() blocks, up to a deadline, or rejects at once. It never blocks a
+     * transport_thread, e.g. a callback calling again : the call is rejected there.
+     *
+     * An admitted call holds a ticket, the slot is released when the last copy of the ticket is gone.
+     * Create it with std::make_shared, the tickets keep the control alive.
+     * */
+    class admission_control : public std::enable_shared_from_this<admission_control> {
+    public:
+
+      enum overload { block, reject };
+
+      typedef std::shared_ptr<void> ticket_type;
+      typedef token_bucket::clock_type clock_type;
+
+    public:
+
+      // a max_in_flight of 0 means no window, e.g. only a rate limit
+      explicit admission_control(size_t max_in_flight, overload policy = block) :
+        _max_in_flight(max_in_flight), _policy(policy), _in_flight(0), _waiting(0), _admitted(0), _rejected(0)
+      {}
+
+      admission_control(const admission_control&) = delete;
+      admission_control& operator=(const admission_control&) = delete;
+
+    public:
+
+      // calls per second, 0 disables the limit
+      void set_rate_limit(double rate, double burst) {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _bucket.reset(rate, burst);
+      }
+
+      overload policy() const { return _policy; }
+
+      // a null ticket if the call is rejected
+      ticket_type acquire() { return __acquire(nullptr); }
+
+      ticket_type acquire_until(clock_type::time_point deadline) { return __acquire(&deadline); }
+
+      admission_stats stats() const {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return admission_stats { _in_flight, _waiting, _admitted, _rejected };
+      }
+
+    private:
+
+      ticket_type __acquire(const clock_type::time_point* deadline) {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        ++_waiting;
+        for (;;) {
+          clock_type::time_point now = clock_type::now();
+          bool room = _max_in_flight == 0 || _in_flight < _max_in_flight;
+
+          if (room && _bucket.try_take(now)) break;
+
+          if (_policy == reject || transport_thread::current() || (deadline && now >= *deadline)) {
+            --_waiting;
+            ++_rejected;
+            return nullptr;
+          }
+
+          if (room) {
+            // only the rate limits, sleep until the next token
+            clock_type::time_point next = now + _bucket.wait_time(now);
+            _room.wait_until(lock, deadline ? std::min(next, *deadline) : next);
+          }
+          else if (deadline) {
+            _room.wait_until(lock, *deadline);
+          }
+          else {
+            _room.wait(lock);
+          }
+        }
+
+        --_waiting;
+        ++_in_flight;
+        ++_admitted;
+
+        std::shared_ptr<admission_control> self = shared_from_this();
+        return ticket_type(self.get(), [self](void*) { self->__release(); });
+      }
+
+      void __release() {
+        {
+          std::lock_guard<std::mutex> guard(_mutex);
+          --_in_flight;
+        }
+
+        _room.notify_one();
+      }
+
+    private:
+
+      const size_t _max_in_flight;
+      const overload _policy;
+
+      mutable std::mutex _mutex;
+      std::condition_variable _room;
+      token_bucket _bucket;
+      size_t _in_flight;
+      size_t _waiting;
+      uint64_t _admitted;
+      uint64_t _rejected;
+    };
+
+  } // rpc
+} // atlas
+
+#endif /* ATLAS_RPC_ADMISSION_H_ */
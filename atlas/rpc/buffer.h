@@ -0,0 +1,178 @@
+/*
+ * buffer.h
+ *
+ *  Created on: Oct 17, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_RPC_BUFFER_H_
+#define ATLAS_RPC_BUFFER_H_
+
+#include <cstring>
+#include <string>
+#include <streambuf>
+#include <algorithm>
+
+#include <atlas/rpc/message.h>
+
+namespace atlas {
+  namespace rpc {
+
+    // A reusable output buffer for framing a message.
+    // The first request_header_size bytes are reserved for the header, the archive writes the
+    // body right after them, so the whole frame is contiguous and can be sent without any copy.
+    // clear() keeps the capacity, so a buffer owned by a long lived caller stops allocating
+    // once it has grown to the size of the biggest message.
+    class message_buffer : public std::streambuf {
+    public:
+
+      static const size_t header_size = message::request_header_size;
+
+      explicit message_buffer(size_t capacity = 512) : _storage(capacity > header_size ? capacity : header_size, '\0') {
+        clear();
+      }
+
+      message_buffer(const message_buffer&) = delete;
+      message_buffer& operator=(const message_buffer&) = delete;
+
+    public:
+
+      // drop the body, keep the header slot and the capacity
+      void clear() {
+        char* base = &_storage[0];
+        setp(base + header_size, base + _storage.size());
+      }
+
+      void reserve(size_t capacity) {
+        if (capacity > _storage.size()) __grow(capacity - size());
+      }
+
+      // write a header in the reserved slot, the length field is patched with the current size
+      void set_header(const request_header& h) {
+        std::memcpy(&_storage[0], &h, header_size);
+        header()->length = static_cast<int32_t>(size());
+      }
+
+      request_header* header() { return reinterpret_cast<request_header*>(&_storage[0]); }
+
+      const request_header* header() const { return reinterpret_cast<const request_header*>(_storage.data()); }
+
+      const char* data() const { return _storage.data(); }
+
+      size_t size() const { return pptr() - _storage.data(); }
+
+      const char* body() const { return _storage.data() + header_size; }
+
+      size_t body_size() const { return size() - header_size; }
+
+      size_t capacity() const { return _storage.size(); }
+
+      // append raw bytes to the body
+      void append(const char* s, size_t n) {
+        if (static_cast<size_t>(epptr() - pptr()) < n) __grow(n);
+
+        std::memcpy(pptr(), s, n);
+        __bump(n);
+      }
+
+      std::string str() const { return std::string(data(), size()); }
+
+    protected:
+
+      virtual int_type overflow(int_type c) {
+        if (traits_type::eq_int_type(c, traits_type::eof())) return traits_type::not_eof(c);
+
+        __grow(1);
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+
+        return c;
+      }
+
+      virtual std::streamsize xsputn(const char* s, std::streamsize n) {
+        append(s, static_cast<size_t>(n));
+        return n;
+      }
+
+    private:
+
+      void __grow(size_t n) {
+        size_t used = size();
+        size_t capacity = std::max(_storage.size() * 2, used + n);
+
+        _storage.resize(capacity);
+
+        char* base = &_storage[0];
+        setp(base + header_size, base + capacity);
+        __bump(used - header_size);
+      }
+
+      // pbump takes an int, advance in steps for very large bodies
+      void __bump(size_t n) {
+        static const size_t step = 1 << 30;
+
+        for (; n > step; n -= step) pbump(static_cast<int>(step));
+        pbump(static_cast<int>(n));
+      }
+
+    private:
+
+      std::string _storage;
+    };
+
+    // A read only stream buffer over a received body, the input archive reads the receive
+    // buffer in place instead of a std::istringstream holding a copy of it
+    class input_buffer : public std::streambuf {
+    public:
+
+      input_buffer(const char* data, size_t size) {
+        char* p = const_cast<char*>(data);
+        setg(p, p, p + size);
+      }
+
+      explicit input_buffer(const message_view& msg) : input_buffer(msg.body(), msg.body_size()) {}
+
+      input_buffer(const input_buffer&) = delete;
+      input_buffer& operator=(const input_buffer&) = delete;
+
+    public:
+
+      const char* data() const { return gptr(); }
+
+      size_t size() const { return egptr() - gptr(); }
+
+    protected:
+
+      virtual std::streamsize xsgetn(char* s, std::streamsize n) {
+        n = std::min<std::streamsize>(n, egptr() - gptr());
+
+        std::memcpy(s, gptr(), n);
+        gbump(static_cast<int>(n));
+
+        return n;
+      }
+
+      virtual std::streamsize showmanyc() {
+        return egptr() - gptr();
+      }
+    };
+
+  } // rpc
+} // atlas
+
+#endif /* ATLAS_RPC_BUFFER_H_ */
@@ -0,0 +1,219 @@
+/*
+ * capture.h
+ *
+ *  Created on: Nov 1, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_RPC_CAPTURE_H_
+#define ATLAS_RPC_CAPTURE_H_
+
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <system_error>
+
+#include <sys/uio.h>
+
+#include <atlas/singleton.h>
+
+namespace atlas {
+  namespace rpc {
+
+    enum capture_direction { captured_sent = 0, captured_received = 1 };
+
+    /*
+     * The capture file : a file header, then one record per framed message
+     *
+     *    file header : magic "ATLRPCC1", uint64 start time in ns since the epoch
+     *    record      : uint64 ns since the start, uint32 frame length, uint8 direction, 3 bytes 0,
+     *                  the frame, request_header included
+     *
+     * in the byte order of the host which wrote it, like the frames themselves.
+     * */
+    struct __capture_format {
+      static const size_t magic_size = 8;
+      static const size_t record_header_size = 16;
+
+      static const char* magic() { return "ATLRPCC1"; }
+    };
+
+    /*
+     * The tap of remote_caller and dispatcher_manager : while it is started, every framed message
+     * sent by a remote_caller and every message executed by a dispatcher is appended to the capture
+     * file. A batch is recorded as one frame when it is sent, and as its calls when it is received.
+     * When stopped, the tap costs a relaxed load per message.
+     * */
+    class capture_tap : public atlas::singleton<capture_tap> {
+    public:
+
+      typedef std::chrono::steady_clock clock_type;
+
+    public:
+
+      capture_tap() : _file(nullptr), _records(0) {}
+
+      ~capture_tap() { stop(); }
+
+      // the file is truncated, throws std::system_error if it can not be opened
+      void start(const std::string& path) {
+        std::lock_guard<std::mutex> guard(_mutex);
+        __close();
+
+        _file = std::fopen(path.c_str(), "wb");
+        if (!_file) throw std::system_error(errno, std::system_category(), "open " + path);
+        std::setvbuf(_file, nullptr, _IOFBF, 1 << 20);
+
+        uint64_t epoch_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        std::fwrite(__capture_format::magic(), 1, __capture_format::magic_size, _file);
+        std::fwrite(&epoch_ns, sizeof epoch_ns, 1, _file);
+
+        _start = clock_type::now();
+        _records = 0;
+        __active().store(true, std::memory_order_relaxed);
+      }
+
+      void stop() {
+        std::lock_guard<std::mutex> guard(_mutex);
+        __close();
+      }
+
+      static bool active() { return __active().load(std::memory_order_relaxed); }
+
+      void record(capture_direction direction, const char* frame, size_t size) {
+        struct iovec iov = { const_cast<char*>(frame), size };
+        record(direction, &iov, 1);
+      }
+
+      // the pieces make one frame
+      void record(capture_direction direction, const struct iovec* iov, int iovcnt) {
+        size_t size = 0;
+        for (int i = 0; i < iovcnt; ++i) size += iov[i].iov_len;
+
+        std::lock_guard<std::mutex> guard(_mutex);
+        if (!_file) return;
+
+        char header[__capture_format::record_header_size] = { 0 };
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - _start).count();
+        uint32_t length = static_cast<uint32_t>(size);
+        std::memcpy(header, &ns, sizeof ns);
+        std::memcpy(header + 8, &length, sizeof length);
+        header[12] = static_cast<char>(direction);
+
+        std::fwrite(header, 1, sizeof header, _file);
+        for (int i = 0; i < iovcnt; ++i) std::fwrite(iov[i].iov_base, 1, iov[i].iov_len, _file);
+
+        ++_records;
+      }
+
+      uint64_t records() const {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _records;
+      }
+
+    private:
+
+      void __close() {
+        __active().store(false, std::memory_order_relaxed);
+
+        if (_file) {
+          std::fclose(_file);
+          _file = nullptr;
+        }
+      }
+
+      static std::atomic<bool>& __active() {
+        static std::atomic<bool> active(false);
+        return active;
+      }
+
+    private:
+
+      mutable std::mutex _mutex;
+      std::FILE* _file;
+      clock_type::time_point _start;
+      uint64_t _records;
+    };
+
+    struct captured_message {
+      uint64_t time_ns;             // since the start of the capture
+      capture_direction direction;
+      std::string frame;
+    };
+
+    // read a capture file record by record
+    class capture_reader {
+    public:
+
+      explicit capture_reader(const std::string& path) : _file(std::fopen(path.c_str(), "rb")), _epoch_ns(0) {
+        if (!_file) throw std::system_error(errno, std::system_category(), "open " + path);
+
+        char magic[__capture_format::magic_size];
+        if (std::fread(magic, 1, sizeof magic, _file) != sizeof magic
+            || std::memcmp(magic, __capture_format::magic(), sizeof magic) != 0
+            || std::fread(&_epoch_ns, sizeof _epoch_ns, 1, _file) != 1) {
+          std::fclose(_file);
+          throw std::runtime_error(path + " is not an atlas rpc capture");
+        }
+      }
+
+      ~capture_reader() { std::fclose(_file); }
+
+      capture_reader(const capture_reader&) = delete;
+      capture_reader& operator=(const capture_reader&) = delete;
+
+    public:
+
+      // the wall clock time of the start of the capture
+      uint64_t epoch_ns() const { return _epoch_ns; }
+
+      // false at the end of the file, throws on a truncated record
+      bool next(captured_message& m) {
+        char header[__capture_format::record_header_size];
+        size_t n = std::fread(header, 1, sizeof header, _file);
+        if (n == 0) return false;
+        if (n != sizeof header) throw std::runtime_error("truncated capture record");
+
+        uint32_t length;
+        std::memcpy(&m.time_ns, header, sizeof m.time_ns);
+        std::memcpy(&length, header + 8, sizeof length);
+        m.direction = static_cast<capture_direction>(header[12]);
+
+        m.frame.resize(length);
+        if (length && std::fread(&m.frame[0], 1, length, _file) != length) throw std::runtime_error("truncated capture record");
+
+        return true;
+      }
+
+    private:
+
+      std::FILE* _file;
+      uint64_t _epoch_ns;
+    };
+
+  } // rpc
+} // atlas
+
+#endif /* ATLAS_RPC_CAPTURE_H_ */
@@ -0,0 +1,262 @@
+/*
+ * compression.h
+ *
+ *  Created on: Oct 27, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_RPC_COMPRESSION_H_
+#define ATLAS_RPC_COMPRESSION_H_
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <atlas/singleton.h>
+#include <atlas/rpc/message.h>
+
+namespace atlas {
+  namespace rpc {
+
+    /*
+     * A small LZ77 codec in the spirit of LZ4 : greedy matching through a hash of 4 byte
+     * sequences, 64K window, byte aligned sequences of
+     *
+     *    token (literal length : 4 bits, match length - 4 : 4 bits), [length bytes],
+     *    literals, [offset : 2 bytes, [length bytes]]
+     *
+     * the last sequence has literals only. Lengths of 15 or more continue with bytes of 255.
+     * The decoder checks every bound and throws std::runtime_error on a corrupt stream.
+     * */
+    class lz_codec {
+    public:
+
+      // append the compressed form of [src, src + n) to out
+      static void compress(const char* src, size_t n, std::string& out) {
+        thread_local uint32_t table[hash_size];
+        std::memset(table, 0, sizeof table);
+
+        const uint8_t* base = reinterpret_cast<const uint8_t*>(src);
+        const uint8_t* ip = base;
+        const uint8_t* anchor = base;
+        const uint8_t* end = base + n;
+        const uint8_t* limit = n > last_literals ? end - last_literals : base; // keep the tail literal
+
+        out.reserve(out.size() + n + n / 255 + 16);
+
+        unsigned misses = 0;
+        while (ip + min_match <= limit) {
+          uint32_t seq = __read32(ip);
+          uint32_t& slot = table[__hash(seq)];
+          const uint8_t* ref = base + slot;
+          slot = static_cast<uint32_t>(ip - base);
+
+          if (ref >= ip || ip - ref > max_offset || __read32(ref) != seq) {
+            // skip faster through incompressible data
+            ip += 1 + (misses++ >> 6);
+            continue;
+          }
+          misses = 0;
+
+          size_t len = min_match;
+          while (ip + len < limit && ref[len] == ip[len]) ++len;
+
+          __sequence(out, anchor, ip - anchor, static_cast<uint16_t>(ip - ref), len);
+
+          ip += len;
+          anchor = ip;
+        }
+
+        __sequence(out, anchor, end - anchor, 0, 0);
+      }
+
+      // decode exactly raw_size bytes into dst
+      static void decompress(const char* src, size_t n, char* dst, size_t raw_size) {
+        const uint8_t* ip = reinterpret_cast<const uint8_t*>(src);
+        const uint8_t* iend = ip + n;
+        uint8_t* op = reinterpret_cast<uint8_t*>(dst);
+        uint8_t* obase = op;
+        uint8_t* oend = op + raw_size;
+
+        for (;;) {
+          if (ip >= iend) __corrupt();
+          uint8_t token = *ip++;
+
+          size_t literals = __length(token >> 4, ip, iend);
+          if (literals > static_cast<size_t>(iend - ip) || literals > static_cast<size_t>(oend - op)) __corrupt();
+
+          std::memcpy(op, ip, literals);
+          ip += literals;
+          op += literals;
+
+          if (ip == iend) break; // the last sequence
+
+          if (iend - ip < 2) __corrupt();
+          size_t offset = ip[0] | (ip[1] << 8);
+          ip += 2;
+
+          size_t len = __length(token & 0x0f, ip, iend) + min_match;
+          if (offset == 0 || offset > static_cast<size_t>(op - obase) || len > static_cast<size_t>(oend - op)) __corrupt();
+
+          // the match may overlap the output, copy forward byte by byte in that case
+          const uint8_t* ref = op - offset;
+          if (offset >= len) {
+            std::memcpy(op, ref, len);
+            op += len;
+          }
+          else {
+            for (size_t i = 0; i < len; ++i) *op++ = *ref++;
+          }
+        }
+
+        if (op != oend) __corrupt();
+      }
+
+    private:
+
+      static const size_t hash_bits = 12;
+      static const size_t hash_size = 1 << hash_bits;
+      static const size_t min_match = 4;
+      static const size_t last_literals = 5;
+      static const ptrdiff_t max_offset = 65535;
+
+      static uint32_t __read32(const uint8_t* p) {
+        uint32_t v;
+        std::memcpy(&v, p, sizeof v);
+        return v;
+      }
+
+      static uint32_t __hash(uint32_t seq) { return (seq * 2654435761U) >> (32 - hash_bits); }
+
+      static void __length_bytes(std::string& out, size_t rest) {
+        while (rest >= 255) {
+          out.push_back(static_cast<char>(255));
+          rest -= 255;
+        }
+        out.push_back(static_cast<char>(rest));
+      }
+
+      // a match length of 0 means no match, i.e. the last sequence
+      static void __sequence(std::string& out, const uint8_t* literals, size_t literal_length, uint16_t offset, size_t match_length) {
+        size_t ml = match_length ? match_length - min_match : 0;
+
+        uint8_t token = static_cast<uint8_t>(((literal_length < 15 ? literal_length : 15) << 4) | (ml < 15 ? ml : 15));
+        out.push_back(static_cast<char>(token));
+
+        if (literal_length >= 15) __length_bytes(out, literal_length - 15);
+        out.append(reinterpret_cast<const char*>(literals), literal_length);
+
+        if (!match_length) return;
+
+        out.push_back(static_cast<char>(offset & 0xff));
+        out.push_back(static_cast<char>(offset >> 8));
+        if (ml >= 15) __length_bytes(out, ml - 15);
+      }
+
+      static size_t __length(size_t nibble, const uint8_t*& ip, const uint8_t* iend) {
+        size_t len = nibble;
+        if (nibble == 15) {
+          uint8_t b;
+          do {
+            if (ip >= iend) __corrupt();
+            b = *ip++;
+            len += b;
+          } while (b == 255);
+        }
+
+        return len;
+      }
+
+      static void __corrupt() { throw std::runtime_error("corrupt compressed rpc message"); }
+    };
+
+    struct compression_counters {
+
+      compression_counters() :
+        compressed(0), incompressible(0), raw_bytes(0), compressed_bytes(0),
+        compress_ns(0), decompressed(0), decompress_ns(0) {}
+
+      uint64_t compressed;        // messages sent compressed
+      uint64_t incompressible;    // messages above the threshold sent raw, the compression did not pay
+      uint64_t raw_bytes;         // body bytes before the compression, of the compressed messages
+      uint64_t compressed_bytes;  // body bytes after the compression
+      uint64_t compress_ns;       // CPU time spent compressing, the incompressible messages included
+      uint64_t decompressed;      // messages received compressed
+      uint64_t decompress_ns;
+
+      double ratio() const { return compressed_bytes ? double(raw_bytes) / compressed_bytes : 0.0; }
+    };
+
+    // Compression counters by function id. Only the messages above the threshold of
+    // their caller are counted, so the small calls do not pay for the lock.
+    class compression_stats : public atlas::singleton<compression_stats> {
+    public:
+
+      typedef std::chrono::steady_clock clock_type;
+
+    public:
+
+      void on_compress(int fn_id, size_t raw, size_t compressed, bool used, clock_type::duration elapsed) {
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        compression_counters& c = _counters[fn_id];
+        if (used) {
+          ++c.compressed;
+          c.raw_bytes += raw;
+          c.compressed_bytes += compressed;
+        }
+        else {
+          ++c.incompressible;
+        }
+        c.compress_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+      }
+
+      void on_decompress(int fn_id, clock_type::duration elapsed) {
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        compression_counters& c = _counters[fn_id];
+        ++c.decompressed;
+        c.decompress_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+      }
+
+      std::map<int, compression_counters> snapshot() const {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return std::map<int, compression_counters>(_counters.begin(), _counters.end());
+      }
+
+      void clear() {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _counters.clear();
+      }
+
+    private:
+
+      mutable std::mutex _mutex;
+      std::unordered_map<int, compression_counters> _counters;
+    };
+
+  } // rpc
+} // atlas
+
+#endif /* ATLAS_RPC_COMPRESSION_H_ */
@@ -24,46 +24,113 @@
 #define RFC_DISPATCHER_H_
 
 #include <deque>
+#include <vector>
+#include <unordered_map>
+#include <stdexcept>
 
 #include <boost/optional.hpp>
 #include <atlas/serialization/uuid.h>
 #include <atlas/rpc/rpc.h>
+#include <atlas/rpc/metrics.h>
 
 namespace atlas {
   namespace rpc {
 
     // dispatchers
-    typedef std::function<boost::optional<rpc_result>(int, const std::string&, const rpc_context&)> dispatcher_type;
+    typedef std::function<boost::optional<rpc_result>(int, const message_view&, const rpc_context&)> dispatcher_type;
 
-    class builtin_dispatcher {
+    // dispatchers which take a copy of the message body, prefer dispatcher_type
+    typedef std::function<boost::optional<rpc_result>(int, const std::string&, const rpc_context&)> string_dispatcher_type;
+
+    // a typed invoker : deserialize the arguments of one remote function and call it
+    typedef rpc_result (*invoker_type)(const message_view&, const rpc_context&);
+
+    template<size_t... I>
+    struct __indices {};
+
+    template<size_t N, size_t... I>
+    struct __make_indices : __make_indices<N - 1, N - 1, I...> {};
+
+    template<size_t... I>
+    struct __make_indices<0, I...> {
+      typedef __indices<I...> type;
+    };
+
+    /*
+     * The server side of a remote function : the arguments are read into a tuple on the stack,
+     * then the handler is called directly, with the context of the call in place of the last one.
+     * The message layout is the one of rf_wrapper, the handler is a template argument, so the
+     * call can be inlined.
+     * */
+    template<typename Signature, Signature* f>
+    struct remote_func_skeleton;
+
+    template<typename Res, typename... Args, Res (*f)(Args...)>
+    struct remote_func_skeleton<Res(Args...), f> {
+
+      static_assert(sizeof...(Args) > 0, "the last parameter of a remote function must be a const rpc_context&");
+
+      typedef std::tuple<typename std::decay<Args>::type...> args_type;
+
+      static rpc_result invoke(const message_view& message, const rpc_context& context) {
+        input_buffer ib(message);
+        rpc_iarchive ia(ib);
+
+        args_type args;
+        ia >> args;
+
+        return __call(args, context, typename __make_indices<sizeof...(Args) - 1>::type());
+      }
+
+    private:
+
+      // by value parameters are moved from the tuple
+      template<size_t... I>
+      static rpc_result __call(args_type& args, const rpc_context& context, __indices<I...>) {
+        return f(std::forward<typename std::tuple_element<I, std::tuple<Args...>>::type>(std::get<I>(args))..., context);
+      }
+    };
+
+    template<typename Signature, Signature* f>
+    using remote_func_invoker = remote_func_skeleton<Signature, f>;
+
+    // Map function ids to invokers, a lookup is one array probe for the ids in
+    // [min_dense_id, max_dense_id), which covers the builtin ones, or one hash probe otherwise.
+    // The table is not synchronized, bind all the functions before dispatching, usually at static init.
+    class remote_func_table {
     public:
 
-      static boost::optional<rpc_result> dispatch(int fn_id, const std::string& message, const rpc_context& context) {
-        std::istringstream iss(message);
-        rpc_iarchive ia(iss);
+      static const int min_dense_id = -64;
+      static const int max_dense_id = 4096;
+
+    public:
 
-        // std::cout << "dispatch " << fn_id << " for " << context.session_id() << " from " << context.source_ip();
+      void bind(int fn_id, invoker_type invoker) {
+        if (fn_id >= min_dense_id && fn_id < max_dense_id) {
+          size_t i = fn_id - min_dense_id;
+          if (i >= _dense.size()) _dense.resize(i + 1, nullptr);
 
-        switch (fn_id) {
-        case fn_ids::resume_thread: {
-          rf_wrapper<decltype(builtin_rfc::resume_thread)> resume_thread(builtin_rfc::resume_thread, ia, context);
-          return resume_thread();
+          _dense[i] = invoker;
         }
-        break;
-        case fn_ids::resume_task: {
-          rf_wrapper<decltype(builtin_rfc::resume_task)> resume_task(builtin_rfc::resume_task, ia, context);
-          return resume_task();
+        else {
+          _sparse[fn_id] = invoker;
         }
-        break;
-        default:
-          // not be responsible to this rpc
-          return boost::none;
-          // DLOG(INFO) << "no method " << method;
-        break;
-        } // switch
+      }
+
+      invoker_type find(int fn_id) const {
+        size_t i = static_cast<size_t>(static_cast<int64_t>(fn_id) - min_dense_id);
+        if (i < _dense.size()) return _dense[i];
+
+        if (_sparse.empty()) return nullptr;
 
-        return boost::none;
+        auto it = _sparse.find(fn_id);
+        return it == _sparse.end() ? nullptr : it->second;
       }
+
+    private:
+
+      std::vector<invoker_type> _dense;
+      std::unordered_map<int, invoker_type> _sparse;
     };
 
     class dispatcher_manager : public atlas::singleton<dispatcher_manager> {
@@ -74,8 +141,13 @@ namespace atlas {
 
     public:
 
-      // we invoke the dispatcher earlier if he comes later
-      // TODO : employ priority queue
+      // bind a function id to its invoker, see ATLAS_BIND_REMOTE_FUNC
+      void regist(int fn_id, invoker_type invoker) {
+        _functions.bind(fn_id, invoker);
+      }
+
+      // we invoke the dispatcher earlier if he comes later,
+      // dispatchers are tried only if the function id is not bound to an invoker
       void regist(dispatcher_type dispatcher) {
         using std::placeholders::_1;
         using std::placeholders::_2;
@@ -84,26 +156,95 @@ namespace atlas {
         _dispatchers.push_front(std::bind(dispatcher, _1, _2, _3));
       }
 
+      void regist(string_dispatcher_type dispatcher) {
+        _dispatchers.push_front([dispatcher](int fn_id, const message_view& message, const rpc_context& context) {
+          return dispatcher(fn_id, message.rpc_str(), context);
+        });
+      }
+
       // throw
-      void execute(remote_caller& response_caller, const message& msg, const std::string& source_ip_port) {
+      void execute(remote_caller& response_caller, const message_view& msg, const std::string& source_ip_port) {
+        if (msg.header()->fn_id == fn_ids::batch) {
+          execute_batch(response_caller, msg, source_ip_port);
+          return;
+        }
+
+        if (capture_tap::active()) capture(msg);
+
+        if (msg.header()->flags & flag_response) {
+          __resume(msg);
+          return;
+        }
+
         rpc_context context(msg.header()->client_id, msg.header()->return_type, msg.header()->session_id, source_ip_port);
 
-        auto result = atlas::rpc::dispatcher_manager::dispatch(msg.header()->fn_id, msg.rpc_str(), context);
+        auto result = atlas::rpc::dispatcher_manager::dispatch(msg.header()->fn_id, msg, context);
         if (result) respond(response_caller, context, result);
       }
 
-      void respond(remote_caller& caller, const rpc_context& context, const rpc_result& result) {
-        if (context.get_return_type() == rpc_async_callback) {
-          caller.call(builtin_rfc::resume_task, fn_ids::resume_task, context.session_id(), result, nilctx);
+      // record a received message with the capture_tap, the body may not follow the header in memory
+      static void capture(const message_view& msg) {
+        struct iovec iov[2] = {
+          { const_cast<request_header*>(msg.header()), message::request_header_size },
+          { const_cast<char*>(msg.body()), msg.body_size() }
+        };
+        capture_tap::ref().record(captured_received, iov, 2);
+      }
+
+      void execute(remote_caller& response_caller, const message& msg, const std::string& source_ip_port) {
+        execute(response_caller, message_view(msg), source_ip_port);
+      }
+
+      // execute every call of a batch in order, the responses are flushed together
+      // if the response caller batches too
+      void execute_batch(remote_caller& response_caller, const message_view& batch, const std::string& source_ip_port) {
+        const char* p = batch.body();
+        const char* end = p + batch.body_size();
+
+        while (p < end) {
+          size_t remaining = end - p;
+          if (remaining < message::request_header_size) throw std::out_of_range("truncated header in batch");
+
+          int32_t length = reinterpret_cast<const request_header*>(p)->length;
+          if (length < static_cast<int32_t>(message::request_header_size) || static_cast<size_t>(length) > remaining) {
+            throw std::out_of_range("bad message length in batch");
+          }
+
+          execute(response_caller, message_view(p, length), source_ip_port);
+          p += length;
         }
-        else if (context.get_return_type() == rpc_sync) {
-          caller.call(builtin_rfc::resume_thread, fn_ids::resume_thread, context.session_id(), result, nilctx);
+
+        response_caller.flush();
+      }
+
+      // the calls without a callback are not answered
+      void respond(remote_caller& caller, const rpc_context& context, const rpc_result& result) {
+        if (context.get_return_type() == rpc_async_callback || context.get_return_type() == rpc_sync) {
+          caller.send_response(context.get_return_type(), context.session_id(), result);
         }
       }
 
       rpc_result dispatch(int fn_id, const std::string& message, const rpc_context& context) {
-        std::istringstream iss(message);
-        rpc_iarchive ia(iss);
+        return dispatch(fn_id, message_view(nullptr, message.data(), message.size()), context);
+      }
+
+      // the call is measured by rpc_metrics when it is enabled
+      rpc_result dispatch(int fn_id, const message_view& message, const rpc_context& context) {
+        rpc_metrics_probe probe(fn_id, message.body_size());
+
+        const request_header* h = message.header();
+        rpc_result result = (h && (h->flags & flag_compressed)) ? __dispatch_compressed(fn_id, message, context)
+            : __dispatch(fn_id, message, context);
+
+        probe.done(result);
+        return result;
+      }
+
+    protected:
+
+      rpc_result __dispatch(int fn_id, const message_view& message, const rpc_context& context) {
+        invoker_type invoker = _functions.find(fn_id);
+        if (invoker) return invoker(message, context);
 
         for (const dispatcher_type& dispatcher : _dispatchers) {
           auto result = dispatcher(fn_id, message, context);
@@ -114,16 +255,73 @@ namespace atlas {
         return nullptr; // no any proper processor
       }
 
-    protected:
+      // decompress the body, then dispatch it with a header copy which does not flag it any more
+      rpc_result __dispatch_compressed(int fn_id, const message_view& message, const rpc_context& context) {
+        std::string body;
+        __decompress(fn_id, message, body);
 
-      void __init() {
-        using std::placeholders::_1;
-        using std::placeholders::_2;
-        using std::placeholders::_3;
+        request_header header = *message.header();
+        header.flags &= ~flag_compressed;
+        header.length = static_cast<int32_t>(message::request_header_size + body.size());
 
-        _dispatchers.push_front(std::bind(builtin_dispatcher::dispatch, _1, _2, _3));
+        return __dispatch(fn_id, message_view(&header, body.data(), body.size()), context);
       }
 
+      static void __decompress(int fn_id, const message_view& message, std::string& body) {
+        typedef compression_stats::clock_type clock_type;
+
+        uint32_t raw_size;
+        if (message.body_size() < sizeof raw_size) throw std::out_of_range("truncated compressed message");
+        std::memcpy(&raw_size, message.body(), sizeof raw_size);
+
+        // a sequence of the codec expands to at most 255 times its size, do not trust the peer beyond that
+        size_t compressed_size = message.body_size() - sizeof raw_size;
+        if (raw_size / 255 > compressed_size) throw std::out_of_range("bad raw size in compressed message");
+
+        auto start = clock_type::now();
+        body.assign(raw_size, '\0');
+        lz_codec::decompress(message.body() + sizeof raw_size, compressed_size, &body[0], raw_size);
+        compression_stats::ref().on_decompress(fn_id, clock_type::now() - start);
+      }
+
+      // a response frame, see remote_caller::send_response
+      void __resume(const message_view& msg) {
+        const request_header* h = msg.header();
+        rpc_metrics_probe probe(h->fn_id, msg.body_size());
+
+        const char* body = msg.body();
+        size_t size = msg.body_size();
+
+        std::string decompressed;
+        if (h->flags & flag_compressed) {
+          __decompress(h->fn_id, msg, decompressed);
+          body = decompressed.data();
+          size = decompressed.size();
+        }
+
+        int32_t err;
+        if (size < sizeof err) throw std::out_of_range("truncated response");
+        std::memcpy(&err, body, sizeof err);
+
+        std::string data(body + sizeof err, size - sizeof err);
+        if (h->fn_id == fn_ids::resume_thread) {
+          sync_task_manager::ref().resume(h->session_id, std::move(data), err);
+        }
+        else {
+          async_task_manager::ref().resume(h->session_id, data, err);
+        }
+
+        probe.done(nullptr);
+      }
+
+      void __init() {
+        regist(fn_ids::resume_thread,
+            &remote_func_skeleton<decltype(builtin_rfc::resume_thread), builtin_rfc::resume_thread>::invoke);
+        regist(fn_ids::resume_task,
+            &remote_func_skeleton<decltype(builtin_rfc::resume_task), builtin_rfc::resume_task>::invoke);
+      }
+
+      remote_func_table _functions;
       std::deque<dispatcher_type> _dispatchers;
     };
 
@@ -146,4 +344,26 @@ namespace atlas { \
   } \
 }
 
+// Bind a remote function declared by ATLAS_REGISTER_REMOTE_FUNC to its handler at static init,
+// use it in the namespace where ATLAS_REGISTER_REMOTE_FUNC is used, e.g.
+//
+//    ATLAS_REGISTER_REMOTE_FUNC(add, 1);
+//    ATLAS_BIND_REMOTE_FUNC(add, calculator::add);
+//
+// the handler must be a function or a static member function, taking a rpc_context as the last argument,
+// its signature must be the registered one if ATLAS_REGISTER_TYPED_REMOTE_FUNC is used
+#define ATLAS_BIND_REMOTE_FUNC(func_name, handler) \
+static_assert(::atlas::rpc::__handler_matches<fn_stubs::func_name, decltype(handler)>::value, \
+    "the handler of " #func_name " does not match the registered signature"); \
+namespace remote_func_binders_for_##func_name { \
+    class remote_func_binder { \
+    public: \
+      remote_func_binder() { \
+        ::atlas::rpc::dispatcher_manager::ref().regist(fn_ids::func_name, \
+            &::atlas::rpc::remote_func_skeleton<decltype(handler), handler>::invoke); \
+      } \
+    }; \
+    static remote_func_binder bind_remote_func_##func_name; \
+}
+
 #endif // RFC_DISPATCHER_H_
@@ -0,0 +1,229 @@
+/*
+ * future.h
+ *
+ *  Created on: Oct 22, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_RPC_FUTURE_H_
+#define ATLAS_RPC_FUTURE_H_
+
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include <vector>
+#include <utility>
+#include <stdexcept>
+#include <functional>
+#include <type_traits>
+#include <condition_variable>
+
+#include <atlas/rpc/result.h>
+
+namespace atlas {
+  namespace rpc {
+
+    template<typename T> class rpc_future;
+    template<typename T> class rpc_promise;
+
+    template<typename T>
+    struct __future_state {
+
+      __future_state() : ready(false), waiters(0) {}
+
+      std::mutex mutex;
+      std::condition_variable cond;
+      bool ready;
+      int waiters;
+      T value;
+      std::vector<std::function<void(const T&)>> continuations;
+    };
+
+    // The producer side, the first value set wins and the others are ignored,
+    // so a promise can be completed by a response, a timeout or a cancellation alike.
+    template<typename T>
+    class rpc_promise {
+    public:
+
+      rpc_promise() : _state(std::make_shared<__future_state<T>>()) {}
+
+    public:
+
+      rpc_future<T> get_future() const { return rpc_future<T>(_state); }
+
+      // the continuations run in the calling thread, after the lock is released
+      bool set_value(const T& value) {
+        std::vector<std::function<void(const T&)>> continuations;
+
+        {
+          std::lock_guard<std::mutex> guard(_state->mutex);
+          if (_state->ready) return false;
+
+          _state->value = value;
+          _state->ready = true;
+          continuations.swap(_state->continuations);
+
+          if (_state->waiters > 0) _state->cond.notify_all();
+        }
+
+        for (auto& f : continuations) f(_state->value);
+
+        return true;
+      }
+
+    private:
+
+      std::shared_ptr<__future_state<T>> _state;
+    };
+
+    // A copyable future completed by the thread which receives the response. Unlike std::future,
+    // nothing is blocked unless get() or wait() is called, chain the work with then() instead.
+    template<typename T>
+    class rpc_future {
+    public:
+
+      typedef T value_type;
+
+    public:
+
+      rpc_future() = default;
+
+      explicit rpc_future(std::shared_ptr<__future_state<T>> state) : _state(state) {}
+
+    public:
+
+      bool valid() const { return _state.operator bool(); }
+
+      bool ready() const {
+        std::lock_guard<std::mutex> guard(_state->mutex);
+        return _state->ready;
+      }
+
+      void wait() const {
+        std::unique_lock<std::mutex> lock(_state->mutex);
+
+        ++_state->waiters;
+        _state->cond.wait(lock, [this]() { return _state->ready; });
+        --_state->waiters;
+      }
+
+      // returns false on timeout
+      template<typename Rep, typename Period>
+      bool wait_for(const std::chrono::duration<Rep, Period>& timeout) const {
+        std::unique_lock<std::mutex> lock(_state->mutex);
+
+        ++_state->waiters;
+        bool ready = _state->cond.wait_for(lock, timeout, [this]() { return _state->ready; });
+        --_state->waiters;
+
+        return ready;
+      }
+
+      const T& get() const {
+        wait();
+        return _state->value;
+      }
+
+      // Call f(value) once the value is set, immediately if it is already set.
+      // Returns a future of the result of f, which must not be void.
+      template<typename F>
+      rpc_future<typename std::result_of<F(const T&)>::type> then(F f) const {
+        typedef typename std::result_of<F(const T&)>::type result_type;
+        static_assert(!std::is_void<result_type>::value, "the continuation must return a value");
+
+        rpc_promise<result_type> next;
+        on_ready([next, f](const T& value) mutable { next.set_value(f(value)); });
+
+        return next.get_future();
+      }
+
+      // the low level hook used by then(), when_all() and when_any()
+      void on_ready(std::function<void(const T&)> f) const {
+        {
+          std::lock_guard<std::mutex> guard(_state->mutex);
+          if (!_state->ready) {
+            _state->continuations.push_back(std::move(f));
+            return;
+          }
+        }
+
+        f(_state->value);
+      }
+
+    private:
+
+      std::shared_ptr<__future_state<T>> _state;
+    };
+
+    // a future of all the values, in the order of the futures
+    template<typename T>
+    rpc_future<std::vector<T>> when_all(const std::vector<rpc_future<T>>& futures) {
+      struct context {
+        std::mutex mutex;
+        std::vector<T> values;
+        size_t remaining;
+        rpc_promise<std::vector<T>> promise;
+      };
+
+      auto ctx = std::make_shared<context>();
+      ctx->values.resize(futures.size());
+      ctx->remaining = futures.size();
+
+      rpc_future<std::vector<T>> result = ctx->promise.get_future();
+      if (futures.empty()) {
+        ctx->promise.set_value(ctx->values);
+        return result;
+      }
+
+      for (size_t i = 0; i < futures.size(); ++i) {
+        futures[i].on_ready([ctx, i](const T& value) {
+          bool done = false;
+          {
+            std::lock_guard<std::mutex> guard(ctx->mutex);
+            ctx->values[i] = value;
+            done = (--ctx->remaining == 0);
+          }
+
+          if (done) ctx->promise.set_value(ctx->values);
+        });
+      }
+
+      return result;
+    }
+
+    // a future of the first value set and the index of its future,
+    // throws std::invalid_argument if there is no future, it would never complete
+    template<typename T>
+    rpc_future<std::pair<size_t, T>> when_any(const std::vector<rpc_future<T>>& futures) {
+      if (futures.empty()) throw std::invalid_argument("when_any of no future");
+
+      rpc_promise<std::pair<size_t, T>> promise;
+
+      for (size_t i = 0; i < futures.size(); ++i) {
+        futures[i].on_ready([promise, i](const T& value) mutable {
+          promise.set_value(std::make_pair(i, value));
+        });
+      }
+
+      return promise.get_future();
+    }
+
+  } // rpc
+} // atlas
+
+#endif /* ATLAS_RPC_FUTURE_H_ */
@@ -0,0 +1,121 @@
+/*
+ * gather.h
+ *
+ *  Created on: Oct 22, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_RPC_GATHER_H_
+#define ATLAS_RPC_GATHER_H_
+
+#include <string>
+#include <memory>
+#include <functional>
+
+#include <atlas/rpc/result.h>
+#include <atlas/rpc/task.h>
+#include <atlas/rpc/future.h>
+
+namespace atlas {
+  namespace rpc {
+
+    template<typename Acc>
+    struct gather_result {
+
+      gather_result() : responses(0), errors(0), err(0) {}
+
+      Acc value;
+      size_t responses; // folded into value
+      size_t errors;    // responses with a non zero error code, they are folded too
+      int err;          // rpc_timeout, rpc_cancelled, rpc_rejected or rpc_no_quorum if the quorum was not reached, otherwise 0
+    };
+
+    /*
+     * Scatter-gather for broadcast calls : every response is folded into the accumulator as soon
+     * as it arrives, reduce(acc, data, err), and is not kept. The future is completed by the
+     * quorum-th response, or with the partial result when the session times out, is cancelled,
+     * or ends with all its expected responses before the quorum (rpc_no_quorum). Like for the
+     * task, a quorum of 0 means all the expected responses.
+     * Pass it to remote_caller::gather_call(), the responses after the quorum are dropped.
+     * */
+    template<typename Acc>
+    class scatter_gather {
+    public:
+
+      typedef std::function<void(Acc&, const std::string&, int)> reducer_type;
+
+    public:
+
+      scatter_gather(size_t quorum, const Acc& init, reducer_type reduce) : _state(std::make_shared<state>()) {
+        _state->quorum = quorum;
+        _state->result.value = init;
+        _state->reduce = reduce;
+        _state->done = false;
+      }
+
+    public:
+
+      size_t quorum() const { return _state->quorum; }
+
+      rpc_future<gather_result<Acc>> get_future() const { return _state->promise.get_future(); }
+
+      // The callbacks of a task never run concurrently, so the state needs no lock of its own.
+      // The quorum of the task is the number of responses which end its session.
+      rpc_callback_type callback() const {
+        std::shared_ptr<state> s = _state;
+
+        return [s](const std::string& data, int err, async_task& task) {
+          if (s->done) return;
+
+          if (err == rpc_timeout || err == rpc_cancelled || err == rpc_rejected) {
+            s->result.err = err;
+          }
+          else {
+            s->reduce(s->result.value, data, err);
+            if (err != 0) ++s->result.errors;
+
+            ++s->result.responses;
+            size_t quorum = s->quorum ? s->quorum : task.expected_response_count();
+            if (s->result.responses < quorum) {
+              if (s->result.responses < task.quorum()) return;
+              s->result.err = rpc_no_quorum; // the last response of the session
+            }
+          }
+
+          s->done = true;
+          s->promise.set_value(s->result);
+        };
+      }
+
+    private:
+
+      struct state {
+        size_t quorum;
+        gather_result<Acc> result;
+        reducer_type reduce;
+        bool done;
+        rpc_promise<gather_result<Acc>> promise;
+      };
+
+      std::shared_ptr<state> _state;
+    };
+
+  } // rpc
+} // atlas
+
+#endif /* ATLAS_RPC_GATHER_H_ */
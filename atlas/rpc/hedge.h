@@ -0,0 +1,430 @@
+/*
+ * hedge.h
+ *
+ *  Created on: Nov 3, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_RPC_HEDGE_H_
+#define ATLAS_RPC_HEDGE_H_
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include <condition_variable>
+
+#include <atlas/rpc/rpc.h>
+#include <atlas/rpc/task.h>
+#include <atlas/rpc/future.h>
+#include <atlas/rpc/timer_wheel.h>
+#include <atlas/rpc/session_table.h>
+
+namespace atlas {
+  namespace rpc {
+
+    struct hedge_stats {
+      uint64_t calls;           // calls with a session
+      uint64_t hedged;          // duplicates sent
+      uint64_t over_budget;     // duplicates not sent, the budget was spent
+      uint64_t not_idempotent;  // calls of the functions not registered idempotent, never hedged
+    };
+
+    // The recent latencies of one function, the hedge delay is their percentile,
+    // recomputed every few samples. Not synchronized.
+    class __latency_window {
+    public:
+
+      static const size_t capacity = 256;
+      static const size_t min_samples = 32;
+      static const size_t recompute_every = 16;
+
+      __latency_window() : _count(0), _delay_ns(-1) {}
+
+      void add(int64_t ns, double q) {
+        _samples[_count++ % capacity] = ns;
+        if (_count < min_samples || _count % recompute_every != 0) return;
+
+        size_t n = _count < capacity ? static_cast<size_t>(_count) : capacity;
+        int64_t sorted[capacity];
+        std::copy(_samples, _samples + n, sorted);
+
+        size_t k = static_cast<size_t>(q * (n - 1));
+        std::nth_element(sorted, sorted + k, sorted + n);
+        _delay_ns = sorted[k];
+      }
+
+      // -1 until there are enough samples
+      int64_t delay_ns() const { return _delay_ns; }
+
+    private:
+
+      int64_t _samples[capacity];
+      uint64_t _count;
+      int64_t _delay_ns;
+    };
+
+    /*
+     * Hedged requests over several targets, i.e. the remote_callers of several replicas of a service.
+     * A call goes to one target, round robin, and if it has not been answered after the hedge delay,
+     * the very same frame goes to the next target. Both copies carry the same session id, so the
+     * first answer completes the session and the task manager drops the later ones.
+     *
+     * The hedge delay of a function is the percentile (0.95 by default) of its recent latencies as
+     * seen by this caller, or the initial delay until enough calls are measured. Only the functions
+     * registered with ATLAS_REGISTER_[TYPED_]IDEMPOTENT_REMOTE_FUNC are hedged, the others just go
+     * to one target. The budget bounds the extra load, e.g. 0.1 for at most one duplicate per ten calls.
+     *
+     * The hedged_caller frames the calls itself and hands the frames to the targets as they are :
+     * the admission control, the batching and the compression of the targets do not apply, the
+     * hedged traffic is not admission limited, and enable_compression() of the hedged_caller sets
+     * the compression of its frames.
+     *
+     * The hedges are sent by a timer thread, so the targets must not be used directly while the
+     * hedged_caller lives. Like a remote_caller, it is used by one thread at a time.
+     * */
+    class hedged_caller {
+    public:
+
+      typedef std::chrono::steady_clock clock_type;
+
+    public:
+
+      explicit hedged_caller(const std::vector<remote_caller*>& targets, int client = 0,
+          clock_type::duration tick = std::chrono::milliseconds(1)) :
+        _targets(targets), _target_mutexes(targets.size()), _message_builder(client), _timeout(0),
+        _next(0), _max_hedges(targets.size() > 1 ? 1 : 0), _state(std::make_shared<__state>()), _timers(tick), _stopped(false)
+      {
+        if (_targets.empty()) throw std::invalid_argument("hedged_caller needs at least one target");
+      }
+
+      ~hedged_caller() {
+        {
+          std::lock_guard<std::mutex> guard(_timer_mutex);
+          _stopped = true;
+        }
+        _timer_cond.notify_one();
+
+        if (_timer_thread.joinable()) _timer_thread.join();
+      }
+
+      hedged_caller(const hedged_caller&) = delete;
+      hedged_caller& operator=(const hedged_caller&) = delete;
+
+    public:
+
+      void set_timeout(std::chrono::milliseconds timeout) { _timeout = timeout; }
+
+      std::chrono::milliseconds timeout() const { return _timeout; }
+
+      // like remote_caller::enable_compression(), for the frames sent to all the targets
+      void enable_compression(size_t threshold = 4096) { _message_builder.set_compression_threshold(threshold ? threshold : 1); }
+
+      void disable_compression() { _message_builder.set_compression_threshold(0); }
+
+      // the latency percentile to wait for before hedging, in (0, 1)
+      void set_hedge_percentile(double q) {
+        std::lock_guard<std::mutex> guard(_state->mutex);
+        _state->percentile = q;
+      }
+
+      // the delay before a function has enough measured calls, and the lower bound of any delay
+      void set_hedge_delay(clock_type::duration initial, clock_type::duration min = clock_type::duration::zero()) {
+        std::lock_guard<std::mutex> guard(_state->mutex);
+        _state->initial_delay = initial;
+        _state->min_delay = min;
+      }
+
+      // duplicates per call at most, each one to another target
+      void set_max_hedges(size_t n) { _max_hedges = std::min(n, _targets.size() - 1); }
+
+      // duplicates per call on average at most, 0 means no budget
+      void set_hedge_budget(double ratio) { _state->budget = ratio; }
+
+      clock_type::duration hedge_delay(int fn_id) const { return _state->delay(fn_id); }
+
+      hedge_stats stats() const {
+        return hedge_stats {
+          _state->calls.load(std::memory_order_relaxed), _state->hedged.load(std::memory_order_relaxed),
+          _state->over_budget.load(std::memory_order_relaxed), _state->not_idempotent.load(std::memory_order_relaxed)
+        };
+      }
+
+      // no session, no hedge
+      template<typename Functor, typename ... Args>
+      void call(Functor f, int fn_id, Args ... args) {
+        _message_builder.set_return_type(rpc_async_no_callback);
+        _message_builder.build(_buffer, f, fn_id, std::forward<Args>(args)...);
+
+        __send(__next_target(), _buffer.data(), _buffer.size(), fn_id);
+      }
+
+      template<typename Functor, typename ... Args>
+      void call(Functor f, int fn_id, rpc_callback_type cb, Args ... args) {
+        __call(f, fn_id, cb, std::forward<Args>(args)...);
+      }
+
+      template<typename Functor, typename ... Args>
+      rpc_future<rpc_result> async_call(Functor f, int fn_id, Args ... args) {
+        rpc_promise<rpc_result> promise;
+
+        rpc_callback_type cb = [promise](const std::string& result, int err, async_task&) mutable {
+          promise.set_value(rpc_result(result, err));
+        };
+        __call(f, fn_id, cb, std::forward<Args>(args)...);
+
+        return promise.get_future();
+      }
+
+      template<typename Functor, typename ... Args>
+      rpc_result sync_call(Functor f, int fn_id, Args ... args) {
+        _message_builder.set_return_type(rpc_sync);
+        _message_builder.build(_buffer, f, fn_id, std::forward<Args>(args)...);
+
+        uuid id = _message_builder.session_id();
+        std::future<rpc_result> future = sync_task_manager::ref().expect(id);
+
+        clock_type::time_point start = clock_type::now();
+        try {
+          __send_hedgeable(id, fn_id, start);
+        }
+        catch (...) {
+          sync_task_manager::ref().discard(id);
+          throw;
+        }
+
+        rpc_result result = _timeout.count() > 0 ? sync_task_manager::ref().wait_until(id, future, clock_type::now() + _timeout)
+            : future.get();
+
+        _state->complete(id, fn_id, result.err(), clock_type::now() - start);
+        return result;
+      }
+
+    private:
+
+      // a session waiting for its next hedge
+      struct __hedge {
+        std::string frame;
+        int fn_id;
+        size_t target;      // the next one to try
+        size_t hedges_left;
+      };
+
+      typedef std::shared_ptr<__hedge> hedge_ptr;
+
+      // shared with the callbacks, which may run after the caller is gone
+      struct __state {
+
+        __state() :
+          percentile(0.95), initial_delay(std::chrono::milliseconds(10)), min_delay(0), budget(0),
+          calls(0), hedged(0), over_budget(0), not_idempotent(0) {}
+
+        // the answers which are not measured, e.g. a timeout says nothing of the latency
+        static bool measured(int err) { return err != rpc_timeout && err != rpc_cancelled && err != rpc_rejected; }
+
+        void complete(const uuid& id, int fn_id, int err, clock_type::duration elapsed) {
+          pending.erase(id);
+          if (!measured(err)) return;
+
+          std::lock_guard<std::mutex> guard(mutex);
+          windows[fn_id].add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), percentile);
+        }
+
+        clock_type::duration delay(int fn_id) const {
+          std::lock_guard<std::mutex> guard(mutex);
+
+          auto it = windows.find(fn_id);
+          if (it == windows.end() || it->second.delay_ns() < 0) return initial_delay;
+
+          return std::max<clock_type::duration>(std::chrono::nanoseconds(it->second.delay_ns()), min_delay);
+        }
+
+        bool within_budget() {
+          if (budget <= 0) return true;
+          return hedged.load(std::memory_order_relaxed) + 1 <= budget * calls.load(std::memory_order_relaxed);
+        }
+
+        mutable std::mutex mutex;
+        double percentile;
+        clock_type::duration initial_delay;
+        clock_type::duration min_delay;
+        std::unordered_map<int, __latency_window> windows;
+
+        std::atomic<double> budget;
+        session_table<hedge_ptr> pending;
+
+        std::atomic<uint64_t> calls;
+        std::atomic<uint64_t> hedged;
+        std::atomic<uint64_t> over_budget;
+        std::atomic<uint64_t> not_idempotent;
+      };
+
+    private:
+
+      template<typename Functor, typename ... Args>
+      void __call(Functor f, int fn_id, rpc_callback_type cb, Args ... args) {
+        _message_builder.set_return_type(rpc_async_callback);
+        _message_builder.build(_buffer, f, fn_id, std::forward<Args>(args)...);
+
+        uuid id = _message_builder.session_id();
+        clock_type::time_point start = clock_type::now();
+
+        // the first answer completes the session and measures the latency, later ones never get here
+        std::shared_ptr<__state> state = _state;
+        rpc_callback_type hedged_cb = [state, cb, id, fn_id, start](const std::string& result, int err, async_task& task) {
+          state->complete(id, fn_id, err, clock_type::now() - start);
+          if (cb) cb(result, err, task);
+        };
+
+        if (_timeout.count() > 0) {
+          async_task_manager::ref().suspend(id, hedged_cb, 1, 0, start + _timeout);
+        }
+        else {
+          async_task_manager::ref().suspend(id, hedged_cb, 1, 0);
+        }
+
+        try {
+          __send_hedgeable(id, fn_id, start);
+        }
+        catch (...) {
+          async_task_manager::ref().discard(id);
+          throw;
+        }
+      }
+
+      // send the built frame to the next target, and schedule its hedge if the function allows it
+      void __send_hedgeable(const uuid& id, int fn_id, clock_type::time_point start) {
+        _state->calls.fetch_add(1, std::memory_order_relaxed);
+
+        size_t target = __next_target();
+
+        bool hedging = _max_hedges > 0 && idempotent_functions::ref().contains(fn_id);
+        if (!hedging) {
+          if (_max_hedges > 0) _state->not_idempotent.fetch_add(1, std::memory_order_relaxed);
+          __send(target, _buffer.data(), _buffer.size(), fn_id);
+          return;
+        }
+
+        // registered before the send, the answer may come back before it returns
+        hedge_ptr h(new __hedge { std::string(_buffer.data(), _buffer.size()), fn_id, (target + 1) % _targets.size(), _max_hedges });
+        _state->pending.insert(id, h);
+
+        try {
+          __send(target, _buffer.data(), _buffer.size(), fn_id);
+        }
+        catch (...) {
+          _state->pending.erase(id);
+          throw;
+        }
+
+        __schedule(start + _state->delay(fn_id), id);
+      }
+
+      // on the timer thread : the session is still pending, send its frame to the next target
+      void __hedge_expired(const uuid& id) {
+        hedge_ptr h;
+        if (!_state->pending.take(id, h)) return;
+
+        if (!_state->within_budget()) {
+          _state->over_budget.fetch_add(1, std::memory_order_relaxed);
+          return;
+        }
+
+        _state->hedged.fetch_add(1, std::memory_order_relaxed);
+
+        size_t target = h->target;
+        try {
+          __send(target, h->frame.data(), h->frame.size(), h->fn_id);
+        }
+        catch (const std::exception&) {
+          // the session still waits for the other copies, or for its timeout
+        }
+
+        if (--h->hedges_left == 0) return;
+
+        h->target = (target + 1) % _targets.size();
+        clock_type::duration delay = _state->delay(h->fn_id);
+        _state->pending.insert(id, h);
+        __schedule(clock_type::now() + delay, id);
+      }
+
+      size_t __next_target() { return _next++ % _targets.size(); }
+
+      // a target is shared by the calling thread and the timer thread, the frame skips its batch
+      void __send(size_t target, const char* frame, size_t size, int fn_id) {
+        std::lock_guard<std::mutex> guard(_target_mutexes[target].mutex);
+
+        _targets[target]->__send_frame(frame, size);
+        rpc_metrics::on_send(fn_id, size);
+      }
+
+      void __schedule(clock_type::time_point deadline, const uuid& id) {
+        std::call_once(_timer_started, [this]() { _timer_thread = std::thread(&hedged_caller::__run_timer, this); });
+        _timers.schedule(deadline, id);
+      }
+
+      void __run_timer() {
+        std::unique_lock<std::mutex> lock(_timer_mutex);
+
+        while (!_stopped) {
+          _timer_cond.wait_for(lock, _timers.tick());
+          if (_stopped) break;
+
+          lock.unlock();
+          _timers.advance(clock_type::now(), [this](const uuid& id) { __hedge_expired(id); });
+          lock.lock();
+        }
+      }
+
+    private:
+
+      struct __target_mutex {
+        std::mutex mutex;
+        char padding[64];
+      };
+
+      std::vector<remote_caller*> _targets;
+      std::vector<__target_mutex> _target_mutexes;
+
+      message_builder _message_builder;
+      message_buffer _buffer;
+      std::chrono::milliseconds _timeout;
+      size_t _next;
+      size_t _max_hedges;
+
+      std::shared_ptr<__state> _state;
+
+      timer_wheel<uuid> _timers;
+      std::once_flag _timer_started;
+      std::thread _timer_thread;
+      std::mutex _timer_mutex;
+      std::condition_variable _timer_cond;
+      bool _stopped;
+    };
+
+  } // rpc
+} // atlas
+
+#endif /* ATLAS_RPC_HEDGE_H_ */
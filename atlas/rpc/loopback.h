@@ -0,0 +1,220 @@
+/*
+ * loopback.h
+ *
+ *  Created on: Oct 23, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_RPC_LOOPBACK_H_
+#define ATLAS_RPC_LOOPBACK_H_
+
+#include <string>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <stdexcept>
+
+#include <sys/uio.h>
+
+#include <atlas/container/spsc_ring.h>
+#include <atlas/rpc/rpc.h>
+#include <atlas/rpc/dispatcher.h>
+
+namespace atlas {
+  namespace rpc {
+
+    // Wait for a ring : spin, then yield, then sleep, so that an idle side does not burn a core
+    // while a busy one reacts within a few hundred nanoseconds.
+    class ring_backoff {
+    public:
+
+      ring_backoff() : _count(0) {}
+
+      void reset() { _count = 0; }
+
+      void wait() {
+        if (_count < 64) {
+          ++_count;
+        }
+        else if (_count < 1024) {
+          ++_count;
+          std::this_thread::yield();
+        }
+        else {
+          std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+      }
+
+    private:
+
+      unsigned _count;
+    };
+
+    // A remote_caller writing its messages into a ring, it must be the only producer of the ring,
+    // so it is used by one thread at a time, like any other caller. A full ring blocks the sender,
+    // until the stop flag is set : the consumer may be gone, so the message is dropped then.
+    // Override pushed() to wake up a sleeping consumer.
+    class ring_caller : public remote_caller {
+    public:
+
+      explicit ring_caller(spsc_ring& ring, int client = 0, int response_expected = 1) :
+        remote_caller(client, response_expected), _ring(ring), _stopped(nullptr)
+      {}
+
+      virtual ~ring_caller() { flush(); }
+
+      // the flag of the transport, set when it stops
+      void set_stop_flag(const std::atomic<bool>& stopped) { _stopped = &stopped; }
+
+    protected:
+
+      using remote_caller::send;
+
+      virtual void send(const char* message, size_t size) {
+        __push(message, size, nullptr, 0);
+      }
+
+      virtual void send(const struct iovec* iov, int iovcnt) {
+        if (iovcnt > 2) {
+          remote_caller::send(iov, iovcnt);
+          return;
+        }
+
+        __push(static_cast<const char*>(iov[0].iov_base), iov[0].iov_len,
+            iovcnt == 2 ? static_cast<const char*>(iov[1].iov_base) : nullptr, iovcnt == 2 ? iov[1].iov_len : 0);
+      }
+
+      // called after every message pushed
+      virtual void pushed() {}
+
+    private:
+
+      void __push(const char* p1, size_t n1, const char* p2, size_t n2) {
+        ring_backoff backoff;
+        while (!_ring.try_push(p1, n1, p2, n2)) {
+          if (_stopped && _stopped->load(std::memory_order_relaxed)) return;
+          backoff.wait();
+        }
+
+        pushed();
+      }
+
+    private:
+
+      spsc_ring& _ring;
+      const std::atomic<bool>* _stopped;
+    };
+
+    /*
+     * An in-process transport : requests and responses go through two lock free SPSC rings,
+     * one polling thread serves the requests and another one delivers the responses.
+     *
+     * The messages are copied once into the ring and dispatched in place from it. Callbacks run
+     * on the response thread, they must not call through client(), which has a single producer.
+     * */
+    class loopback_transport {
+    public:
+
+      explicit loopback_transport(size_t ring_capacity = 1 << 20, const std::string& address = "loopback:0") :
+        _requests(ring_capacity), _responses(ring_capacity),
+        _client(_requests), _server(_responses), _address(address), _stopped(false),
+        _served(0), _delivered(0)
+      {
+        _client.set_stop_flag(_stopped);
+        _server.set_stop_flag(_stopped);
+
+        _server_thread = std::thread([this]() { __poll(_requests, _server, _served); });
+        _client_thread = std::thread([this]() { __poll(_responses, _no_response, _delivered); });
+      }
+
+      ~loopback_transport() {
+        _client.flush();
+
+        _stopped = true;
+        _server_thread.join();
+        _client_thread.join();
+      }
+
+      loopback_transport(const loopback_transport&) = delete;
+      loopback_transport& operator=(const loopback_transport&) = delete;
+
+    public:
+
+      // the caller for the requests
+      remote_caller& client() { return _client; }
+
+      size_t requests_served() const { return _served.load(std::memory_order_relaxed); }
+
+      size_t responses_delivered() const { return _delivered.load(std::memory_order_relaxed); }
+
+    private:
+
+      // the responses are never answered, and the response thread must not touch the client
+      class __no_response_caller : public remote_caller {
+      protected:
+        virtual void send(const char*, size_t) {}
+      };
+
+      // the messages left in the ring when the transport stops are dropped
+      void __poll(spsc_ring& in, remote_caller& responder, std::atomic<size_t>& counter) {
+        transport_thread marker;
+        ring_backoff backoff;
+
+        while (!_stopped.load(std::memory_order_relaxed)) {
+          bool got = in.try_pop([this, &responder](const char* p, size_t n) {
+            try {
+              dispatcher_manager::ref().execute(responder, message_view(p, n), _address);
+            }
+            catch (const std::exception&) {
+              // a malformed message is dropped, the transport goes on
+            }
+          });
+
+          if (got) {
+            counter.fetch_add(1, std::memory_order_relaxed);
+            backoff.reset();
+          }
+          else {
+            responder.flush();
+            backoff.wait();
+          }
+        }
+      }
+
+    private:
+
+      spsc_ring _requests;
+      spsc_ring _responses;
+
+      ring_caller _client;
+      ring_caller _server;
+      __no_response_caller _no_response;
+
+      std::string _address;
+      std::atomic<bool> _stopped;
+      std::atomic<size_t> _served;
+      std::atomic<size_t> _delivered;
+
+      std::thread _server_thread;
+      std::thread _client_thread;
+    };
+
+  } // rpc
+} // atlas
+
+#endif /* ATLAS_RPC_LOOPBACK_H_ */
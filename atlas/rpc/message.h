@@ -24,6 +24,10 @@
 #define ATLAS_RFC_MESSAGE_H_
 
 #include <cstring>
+#include <cstdint>
+#include <string>
+#include <ostream>
+#include <stdexcept>
 
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_io.hpp>
@@ -35,6 +39,12 @@ namespace atlas {
 
     enum return_type { rpc_sync, rpc_async_callback, rpc_async_no_callback };
 
+    // the bits of request_header::flags
+    enum message_flags {
+      flag_compressed = 0x1, // the body is [uint32 raw size][lz_codec stream]
+      flag_response = 0x2    // a response frame : the body is [int32 error code][result data]
+    };
+
     // TODO : check the alignment, when should be 4 and when 8? what's the difference?
 #pragma pack(4)
 
@@ -45,11 +55,13 @@ namespace atlas {
       int32_t client_id;        // 4 client id, indicate where the request comes from
       uuid    session_id;       // 5 the current session id
       int32_t resp_expect;      // 6 expected response count
+      uint16_t priority;        // 7 dispatch priority on the serving side, higher first
+      uint16_t flags;           // 8 see message_flags, e.g. a compressed body
     };
 
 #pragma pack()
 
-    std::ostream& operator<<(std::ostream& os, const request_header& h) {
+    inline std::ostream& operator<<(std::ostream& os, const request_header& h) {
       os << "l:" << h.length << ", c:" << h.client_id << ", s: " << h.session_id;
 
       return os;
@@ -70,6 +82,8 @@ namespace atlas {
           0,                                  // client id
           session_id,                         // session id
           1,                                  // resp_expect
+          0,                                  // priority
+          0                                   // flags
         };
       }
 
@@ -102,6 +116,51 @@ namespace atlas {
       std::string _body;
     };
 
+    // A non-owning view over a received message, nothing is copied, so the receive buffer
+    // must outlive the view. Prefer this to message on the inbound path.
+    class message_view {
+    public:
+
+      // throws std::out_of_range if the frame is shorter than the header
+      message_view(const char* data, size_t size) :
+        _header(reinterpret_cast<const request_header*>(data)),
+        _body(data + message::request_header_size),
+        _body_size(__body_size(size)) {}
+
+      explicit message_view(const std::string& data) : message_view(data.data(), data.size()) {}
+
+      explicit message_view(const message& msg) :
+        _header(msg.header()), _body(msg.rpc_str().data()), _body_size(msg.rpc_str().size()) {}
+
+      // the header can be null if only the body is known
+      message_view(const request_header* header, const char* body, size_t body_size) :
+        _header(header), _body(body), _body_size(body_size) {}
+
+    public:
+
+      const request_header* header() const { return _header; }
+
+      const char* body() const { return _body; }
+
+      size_t body_size() const { return _body_size; }
+
+      // copy the body out, use body() and body_size() to avoid the copy
+      std::string rpc_str() const { return std::string(_body, _body_size); }
+
+    private:
+
+      static size_t __body_size(size_t size) {
+        if (size < message::request_header_size) throw std::out_of_range("message shorter than its header");
+        return size - message::request_header_size;
+      }
+
+    private:
+
+      const request_header* _header;
+      const char* _body;
+      size_t _body_size;
+    };
+
   } // rpc
 } // atlas
 
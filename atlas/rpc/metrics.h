@@ -0,0 +1,364 @@
+/*
+ * metrics.h
+ *
+ *  Created on: Oct 28, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_RPC_METRICS_H_
+#define ATLAS_RPC_METRICS_H_
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
+
+#include <atlas/singleton.h>
+#include <atlas/rpc/result.h>
+#include <atlas/rpc/task.h>
+
+namespace atlas {
+  namespace rpc {
+
+    // the metrics of one function id, merged from all the threads
+    struct rpc_fn_metrics {
+
+      // the bucket i counts the latencies in [2^i, 2^(i+1)) nanoseconds, the last one counts the rest
+      static const size_t latency_buckets = 40;
+
+      rpc_fn_metrics() :
+        calls(0), in_flight(0), errors(0), timeouts(0), cancelled(0), rejected(0), exceptions(0),
+        bytes_in(0), bytes_out(0), sent(0), sent_bytes(0), latency_ns(0)
+      {
+        std::fill(latency, latency + latency_buckets, 0);
+      }
+
+      // served by this process
+      uint64_t calls;       // dispatched, the running ones included
+      uint64_t in_flight;   // running now
+      uint64_t errors;      // results with a non zero err(), the codes below included
+      uint64_t timeouts;    // the calls of this process which timed out are counted too
+      uint64_t cancelled;
+      uint64_t rejected;    // so are the calls its admission control rejected
+      uint64_t exceptions;  // the handler or the message decoding threw
+      uint64_t bytes_in;    // request bodies, as received
+      uint64_t bytes_out;   // result data
+      // called by this process
+      uint64_t sent;
+      uint64_t sent_bytes;  // framed requests, header included
+
+      uint64_t latency_ns;  // total handler time
+      uint64_t latency[latency_buckets];
+
+      uint64_t completed() const { return calls - in_flight; }
+
+      double mean_latency_ns() const { return completed() ? double(latency_ns) / completed() : 0.0; }
+
+      // the upper bound of the bucket holding the q quantile, q in [0, 1]
+      uint64_t latency_percentile_ns(double q) const {
+        uint64_t total = 0;
+        for (uint64_t n : latency) total += n;
+        if (total == 0) return 0;
+
+        uint64_t rank = static_cast<uint64_t>(q * total);
+        if (rank >= total) rank = total - 1;
+
+        uint64_t seen = 0;
+        for (size_t i = 0; i < latency_buckets; ++i) {
+          seen += latency[i];
+          if (seen > rank) return (uint64_t(1) << (i + 1)) - 1;
+        }
+
+        return uint64_t(1) << latency_buckets;
+      }
+    };
+
+    struct rpc_metrics_snapshot {
+      std::map<int, rpc_fn_metrics> functions;
+
+      size_t sync_in_flight;   // sessions waited for by sync_call
+      size_t async_in_flight;  // sessions waiting for their callback
+    };
+
+    // The counters of one function id in one thread. Only that thread writes them, with plain
+    // load and store pairs, no locked instruction, the readers merge them with relaxed loads.
+    struct __fn_metrics_cell {
+
+      __fn_metrics_cell() : calls(), finished(), errors(), timeouts(), cancelled(), rejected(), exceptions(),
+        bytes_in(), bytes_out(), sent(), sent_bytes(), latency_ns(), latency() {}
+
+      static void add(std::atomic<uint64_t>& counter, uint64_t n) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+      }
+
+      void merge_into(rpc_fn_metrics& m) const {
+        uint64_t c = calls.load(std::memory_order_relaxed);
+        uint64_t f = finished.load(std::memory_order_relaxed);
+
+        m.calls += c;
+        m.in_flight += c > f ? c - f : 0;
+        m.errors += errors.load(std::memory_order_relaxed);
+        m.timeouts += timeouts.load(std::memory_order_relaxed);
+        m.cancelled += cancelled.load(std::memory_order_relaxed);
+        m.rejected += rejected.load(std::memory_order_relaxed);
+        m.exceptions += exceptions.load(std::memory_order_relaxed);
+        m.bytes_in += bytes_in.load(std::memory_order_relaxed);
+        m.bytes_out += bytes_out.load(std::memory_order_relaxed);
+        m.sent += sent.load(std::memory_order_relaxed);
+        m.sent_bytes += sent_bytes.load(std::memory_order_relaxed);
+        m.latency_ns += latency_ns.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < rpc_fn_metrics::latency_buckets; ++i) m.latency[i] += latency[i].load(std::memory_order_relaxed);
+      }
+
+      std::atomic<uint64_t> calls, finished, errors, timeouts, cancelled, rejected, exceptions;
+      std::atomic<uint64_t> bytes_in, bytes_out, sent, sent_bytes, latency_ns;
+      std::atomic<uint64_t> latency[rpc_fn_metrics::latency_buckets];
+    };
+
+    // The cells of one thread, an array for the usual function ids, a map for the others.
+    // The owner thread creates the cells, the readers may walk them at the same time.
+    class __metrics_shard {
+    public:
+
+      static const int min_dense_id = -64;
+      static const int max_dense_id = 4096;
+
+    public:
+
+      __metrics_shard() : _dense(new std::atomic<__fn_metrics_cell*>[max_dense_id - min_dense_id]()) {}
+
+      ~__metrics_shard() {
+        for (int i = 0; i < max_dense_id - min_dense_id; ++i) delete _dense[i].load(std::memory_order_relaxed);
+      }
+
+      __metrics_shard(const __metrics_shard&) = delete;
+      __metrics_shard& operator=(const __metrics_shard&) = delete;
+
+    public:
+
+      // called by the owner thread only
+      __fn_metrics_cell& cell(int fn_id) {
+        if (fn_id >= min_dense_id && fn_id < max_dense_id) {
+          std::atomic<__fn_metrics_cell*>& slot = _dense[fn_id - min_dense_id];
+
+          __fn_metrics_cell* c = slot.load(std::memory_order_relaxed);
+          if (!c) {
+            c = new __fn_metrics_cell;
+            slot.store(c, std::memory_order_release);
+          }
+
+          return *c;
+        }
+
+        std::lock_guard<std::mutex> guard(_sparse_mutex);
+        std::unique_ptr<__fn_metrics_cell>& c = _sparse[fn_id];
+        if (!c) c.reset(new __fn_metrics_cell);
+
+        return *c;
+      }
+
+      void merge_into(std::map<int, rpc_fn_metrics>& functions) const {
+        for (int i = 0; i < max_dense_id - min_dense_id; ++i) {
+          const __fn_metrics_cell* c = _dense[i].load(std::memory_order_acquire);
+          if (c) c->merge_into(functions[i + min_dense_id]);
+        }
+
+        std::lock_guard<std::mutex> guard(_sparse_mutex);
+        for (auto& p : _sparse) p.second->merge_into(functions[p.first]);
+      }
+
+    private:
+
+      std::unique_ptr<std::atomic<__fn_metrics_cell*>[]> _dense;
+
+      mutable std::mutex _sparse_mutex;
+      std::unordered_map<int, std::unique_ptr<__fn_metrics_cell>> _sparse;
+    };
+
+    /*
+     * Per function id metrics of the calls served and sent by this process.
+     *
+     * Every thread counts into its own cells, a snapshot() merges them, so that recording costs
+     * a few uncontended stores and two clock reads per call. The counts of the exited threads are
+     * kept. The counters are read while being written, a snapshot is consistent per counter only.
+     *
+     * Off by default, the recording is a good part of the cost of a short call : set_enabled(true)
+     * to measure.
+     * */
+    class rpc_metrics : public atlas::singleton<rpc_metrics> {
+    public:
+
+      typedef std::chrono::steady_clock clock_type;
+
+    public:
+
+      rpc_metrics() {}
+
+      ~rpc_metrics() {
+        for (__metrics_shard* s : _shards) delete s;
+      }
+
+      // off by default
+      static void set_enabled(bool enabled) { __enabled().store(enabled, std::memory_order_relaxed); }
+
+      static bool enabled() { return __enabled().load(std::memory_order_relaxed); }
+
+      // a request framed by a remote_caller
+      static void on_send(int fn_id, size_t bytes) {
+        if (!enabled()) return;
+
+        __fn_metrics_cell& c = cell(fn_id);
+        __fn_metrics_cell::add(c.sent, 1);
+        __fn_metrics_cell::add(c.sent_bytes, bytes);
+      }
+
+      // the cell of the calling thread
+      static __fn_metrics_cell& cell(int fn_id) { return __local().shard->cell(fn_id); }
+
+      rpc_metrics_snapshot snapshot() const {
+        rpc_metrics_snapshot s;
+        {
+          std::lock_guard<std::mutex> guard(_mutex);
+
+          s.functions = _retired;
+          for (const __metrics_shard* shard : _shards) shard->merge_into(s.functions);
+        }
+
+        s.sync_in_flight = sync_task_manager::ref().size();
+        s.async_in_flight = async_task_manager::ref().size();
+
+        return s;
+      }
+
+    private:
+
+      // registers a shard for the thread, folds its counts into the retired ones when the thread exits
+      struct __local_shard {
+
+        __local_shard() : owner(rpc_metrics::ptr()), shard(new __metrics_shard) {
+          std::lock_guard<std::mutex> guard(owner->_mutex);
+          owner->_shards.push_back(shard);
+        }
+
+        ~__local_shard() {
+          std::lock_guard<std::mutex> guard(owner->_mutex);
+
+          shard->merge_into(owner->_retired);
+          owner->_shards.erase(std::find(owner->_shards.begin(), owner->_shards.end(), shard));
+          delete shard;
+        }
+
+        std::shared_ptr<rpc_metrics> owner;
+        __metrics_shard* shard;
+      };
+
+      static __local_shard& __local() {
+        thread_local __local_shard local;
+        return local;
+      }
+
+      static std::atomic<bool>& __enabled() {
+        static std::atomic<bool> enabled(false);
+        return enabled;
+      }
+
+    private:
+
+      mutable std::mutex _mutex; // guards the shard list and the retired counts
+      std::vector<__metrics_shard*> _shards;
+      std::map<int, rpc_fn_metrics> _retired;
+    };
+
+    // Measure one dispatched call : construct it before the handler, done() after it.
+    // A probe destroyed without done() counts an exception.
+    class rpc_metrics_probe {
+    public:
+
+      rpc_metrics_probe(int fn_id, size_t bytes_in) : _cell(nullptr), _done(false) {
+        if (!rpc_metrics::enabled()) return;
+
+        _cell = &rpc_metrics::cell(fn_id);
+        __fn_metrics_cell::add(_cell->calls, 1);
+        __fn_metrics_cell::add(_cell->bytes_in, bytes_in);
+        _start = rpc_metrics::clock_type::now();
+      }
+
+      ~rpc_metrics_probe() {
+        if (_cell && !_done) {
+          __fn_metrics_cell::add(_cell->exceptions, 1);
+          __finish();
+        }
+      }
+
+      rpc_metrics_probe(const rpc_metrics_probe&) = delete;
+      rpc_metrics_probe& operator=(const rpc_metrics_probe&) = delete;
+
+    public:
+
+      void done(const rpc_result& result) {
+        if (!_cell) return;
+        _done = true;
+
+        if (result) {
+          __fn_metrics_cell::add(_cell->bytes_out, result.data().size());
+          if (result.err() != 0) on_error(*_cell, result.err());
+        }
+
+        __finish();
+      }
+
+      static void on_error(__fn_metrics_cell& c, int err) {
+        __fn_metrics_cell::add(c.errors, 1);
+
+        switch (err) {
+        case rpc_timeout: __fn_metrics_cell::add(c.timeouts, 1); break;
+        case rpc_cancelled: __fn_metrics_cell::add(c.cancelled, 1); break;
+        case rpc_rejected: __fn_metrics_cell::add(c.rejected, 1); break;
+        default: break;
+        }
+      }
+
+    private:
+
+      void __finish() {
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(rpc_metrics::clock_type::now() - _start).count();
+
+        size_t bucket = 0;
+        for (uint64_t v = ns; v > 1 && bucket + 1 < rpc_fn_metrics::latency_buckets; v >>= 1) ++bucket;
+
+        __fn_metrics_cell::add(_cell->latency[bucket], 1);
+        __fn_metrics_cell::add(_cell->latency_ns, ns);
+        __fn_metrics_cell::add(_cell->finished, 1);
+      }
+
+    private:
+
+      __fn_metrics_cell* _cell;
+      bool _done;
+      rpc_metrics::clock_type::time_point _start;
+    };
+
+  } // rpc
+} // atlas
+
+#endif /* ATLAS_RPC_METRICS_H_ */
@@ -0,0 +1,290 @@
+/*
+ * pooled_dispatcher.h
+ *
+ *  Created on: Oct 26, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_RPC_POOLED_DISPATCHER_H_
+#define ATLAS_RPC_POOLED_DISPATCHER_H_
+
+#include <deque>
+#include <string>
+#include <stdexcept>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <unordered_map>
+#include <condition_variable>
+
+#include <atlas/thread_pool.h>
+#include <atlas/rpc/rpc.h>
+#include <atlas/rpc/dispatcher.h>
+#include <atlas/rpc/session_table.h>
+
+namespace atlas {
+  namespace rpc {
+
+    // wrap a job into the task type of the pool, the priority is ignored by the fifo pool
+    inline boostplus::threadpool::task_func __pool_task(fifo_thread_pool*, unsigned, std::function<void()> f) {
+      return f;
+    }
+
+    inline boostplus::threadpool::prio_task_func __pool_task(prio_thread_pool*, unsigned priority, std::function<void()> f) {
+      return boostplus::threadpool::prio_task_func(priority, f);
+    }
+
+    /*
+     * Run the remote functions on a thread pool instead of the thread which received them.
+     *
+     * The calls of one client (or one session) are queued on a strand and run one after
+     * another in arrival order, the strands run concurrently. With a prio_thread_pool, a strand
+     * is scheduled at the priority of the request_header which made it runnable.
+     *
+     * At most max_pending calls wait in the dispatcher, beyond that execute() blocks the receiving
+     * thread, which pushes back on the peer, or rejects the call with rpc_rejected.
+     *
+     * The responses are sent through the responder given with the call, under a lock per responder,
+     * so the transport must not use the responder from another thread meanwhile.
+     * */
+    template<typename Pool = fifo_thread_pool>
+    class pooled_dispatcher {
+    public:
+
+      enum ordering { per_client, per_session, unordered };
+      enum overload { block, reject };
+
+      typedef std::shared_ptr<remote_caller> responder_ptr;
+
+    public:
+
+      explicit pooled_dispatcher(size_t threads, size_t max_pending = 65536, ordering order = per_client, overload policy = block) :
+        _max_pending(max_pending), _order(order), _policy(policy), _pending(0), _unordered_key(0), _pool(threads)
+      {}
+
+      // the pool is destroyed first, it waits for all the tasks
+      ~pooled_dispatcher() { wait(); }
+
+      pooled_dispatcher(const pooled_dispatcher&) = delete;
+      pooled_dispatcher& operator=(const pooled_dispatcher&) = delete;
+
+    public:
+
+      // The message is copied, the builtin functions run inline.
+      // Returns false if the call, or a call of a batch, is rejected.
+      bool execute(const responder_ptr& responder, const message_view& msg, const std::string& source_ip_port) {
+        const request_header* h = msg.header();
+
+        if (h->fn_id == fn_ids::batch) return __execute_batch(responder, msg, source_ip_port);
+
+        if (h->fn_id < 0) {
+          dispatcher_manager::ref().execute(*responder, msg, source_ip_port);
+          return true;
+        }
+
+        if (capture_tap::active()) dispatcher_manager::capture(msg);
+
+        if (!__admit()) {
+          if (rpc_metrics::enabled()) rpc_metrics_probe::on_error(rpc_metrics::cell(h->fn_id), rpc_rejected);
+          __respond(responder, rpc_context(h->client_id, h->return_type, h->session_id, source_ip_port), rpc_result("", rpc_rejected));
+          return false;
+        }
+
+        // the body may not follow the header in memory
+        job j { responder, std::string(reinterpret_cast<const char*>(h), sizeof(request_header)), source_ip_port };
+        j.message.append(msg.body(), msg.body_size());
+
+        uint64_t key;
+        {
+          std::lock_guard<std::mutex> guard(_mutex);
+
+          key = __key(*h);
+          strand& s = _strands[key];
+          s.jobs.push_back(std::move(j));
+          if (s.running) return true;
+
+          s.running = true;
+        }
+
+        __schedule(key, h->priority);
+
+        return true;
+      }
+
+      // the calls waiting or running
+      size_t pending() const {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _pending;
+      }
+
+      // block until all the calls are done
+      void wait() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _drained.wait(lock, [this]() { return _pending == 0; });
+      }
+
+    private:
+
+      struct job {
+        responder_ptr responder;
+        std::string message;
+        std::string source;
+      };
+
+      struct strand {
+        strand() : running(false) {}
+
+        bool running;
+        std::deque<job> jobs;
+      };
+
+      // a strand runs a few calls, then yields the pool thread to the other strands
+      static const size_t strand_quota = 16;
+
+      bool __execute_batch(const responder_ptr& responder, const message_view& batch, const std::string& source_ip_port) {
+        const char* p = batch.body();
+        const char* end = p + batch.body_size();
+        bool all = true;
+
+        while (p < end) {
+          size_t remaining = end - p;
+          if (remaining < message::request_header_size) throw std::out_of_range("truncated header in batch");
+
+          int32_t length = reinterpret_cast<const request_header*>(p)->length;
+          if (length < static_cast<int32_t>(message::request_header_size) || static_cast<size_t>(length) > remaining) {
+            throw std::out_of_range("bad message length in batch");
+          }
+
+          all = execute(responder, message_view(p, length), source_ip_port) && all;
+          p += length;
+        }
+
+        return all;
+      }
+
+      bool __admit() {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        if (_pending >= _max_pending) {
+          if (_policy == reject) return false;
+          _room.wait(lock, [this]() { return _pending < _max_pending; });
+        }
+
+        ++_pending;
+        return true;
+      }
+
+      // called under the lock
+      uint64_t __key(const request_header& h) {
+        switch (_order) {
+        case per_client: return static_cast<uint32_t>(h.client_id);
+        case per_session: return session_id_hash()(h.session_id);
+        default: return ++_unordered_key; // a strand per call
+        }
+      }
+
+      void __schedule(uint64_t key, unsigned priority) {
+        _pool.schedule(__pool_task(static_cast<Pool*>(nullptr), priority, [this, key]() { __run(key); }));
+      }
+
+      void __run(uint64_t key) {
+        for (size_t i = 0; i < strand_quota; ++i) {
+          job j;
+          {
+            std::lock_guard<std::mutex> guard(_mutex);
+            auto it = _strands.find(key);
+            if (it->second.jobs.empty()) {
+              _strands.erase(it);
+              return;
+            }
+
+            j = std::move(it->second.jobs.front());
+            it->second.jobs.pop_front();
+          }
+
+          __invoke(j);
+        }
+
+        // more calls wait on the strand, requeue it behind the others
+        unsigned priority = 0;
+        {
+          std::lock_guard<std::mutex> guard(_mutex);
+          auto it = _strands.find(key);
+          if (it->second.jobs.empty()) {
+            _strands.erase(it);
+            return;
+          }
+
+          priority = reinterpret_cast<const request_header*>(it->second.jobs.front().message.data())->priority;
+        }
+
+        __schedule(key, priority);
+      }
+
+      void __invoke(job& j) {
+        message_view msg(j.message.data(), j.message.size());
+        const request_header* h = msg.header();
+        rpc_context context(h->client_id, h->return_type, h->session_id, j.source);
+
+        try {
+          rpc_result result = dispatcher_manager::ref().dispatch(h->fn_id, msg, context);
+          if (result) __respond(j.responder, context, result);
+        }
+        catch (const std::exception&) {
+          // a bad message or a failed response, the call is dropped like on the inline path
+        }
+
+        {
+          std::lock_guard<std::mutex> guard(_mutex);
+          --_pending;
+          if (_pending < _max_pending) _room.notify_one();
+          if (_pending == 0) _drained.notify_all();
+        }
+      }
+
+      void __respond(const responder_ptr& responder, const rpc_context& context, const rpc_result& result) {
+        std::mutex& m = _respond_mutexes[std::hash<remote_caller*>()(responder.get()) % respond_stripes];
+
+        std::lock_guard<std::mutex> guard(m);
+        dispatcher_manager::ref().respond(*responder, context, result);
+      }
+
+    private:
+
+      static const size_t respond_stripes = 64;
+
+      const size_t _max_pending;
+      const ordering _order;
+      const overload _policy;
+
+      mutable std::mutex _mutex; // guards the strands and the counters
+      std::condition_variable _room;
+      std::condition_variable _drained;
+      std::unordered_map<uint64_t, strand> _strands;
+      size_t _pending;
+      uint64_t _unordered_key;
+
+      std::mutex _respond_mutexes[respond_stripes];
+
+      Pool _pool; // the last member, so that no task runs while the others are destroyed
+    };
+
+  } // rpc
+} // atlas
+
+#endif /* ATLAS_RPC_POOLED_DISPATCHER_H_ */
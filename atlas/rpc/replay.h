@@ -0,0 +1,167 @@
+/*
+ * replay.h
+ *
+ *  Created on: Nov 1, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_RPC_REPLAY_H_
+#define ATLAS_RPC_REPLAY_H_
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+
+#include <atlas/rpc/rpc.h>
+#include <atlas/rpc/dispatcher.h>
+#include <atlas/rpc/capture.h>
+
+namespace atlas {
+  namespace rpc {
+
+    struct replay_options {
+
+      replay_options() : speed(1.0), direction(captured_received), source_ip_port("replay:0") {}
+
+      double speed;                   // 1 for the captured pace, N for N times faster, 0 for as fast as possible
+      capture_direction direction;    // the side of the capture to replay
+      std::string source_ip_port;
+    };
+
+    struct replay_report {
+
+      replay_report() : executed(0), skipped(0), failed(0), responses(0), bytes(0), elapsed_ns(0), max_lag_ns(0) {}
+
+      uint64_t executed;      // frames executed, a batch counts once
+      uint64_t skipped;       // the other direction, and the response frames : no session waits for them
+      uint64_t failed;        // the dispatcher threw
+      uint64_t responses;     // the responses the handlers produced, they are dropped
+      uint64_t bytes;
+      uint64_t elapsed_ns;
+      uint64_t max_lag_ns;    // how late a frame was executed behind its schedule, paced replays only
+
+      std::vector<uint64_t> latency_ns; // the time spent in execute, by frame, sorted
+
+      double throughput() const { return elapsed_ns ? executed * 1e9 / elapsed_ns : 0.0; }
+
+      uint64_t latency_percentile_ns(double q) const {
+        if (latency_ns.empty()) return 0;
+
+        size_t i = static_cast<size_t>(q * (latency_ns.size() - 1) + 0.5);
+        return latency_ns[std::min(i, latency_ns.size() - 1)];
+      }
+    };
+
+    /*
+     * Feed a capture of capture_tap back through the dispatcher_manager of this process, offline :
+     * the handlers of the captured function ids must be bound in the process replaying it. The calls
+     * run on the calling thread in the captured order, their responses are counted and dropped.
+     * */
+    class capture_replayer {
+    public:
+
+      typedef std::chrono::steady_clock clock_type;
+
+    public:
+
+      explicit capture_replayer(const replay_options& options = replay_options()) : _options(options) {}
+
+      // throws if the capture can not be read
+      replay_report run(const std::string& path) {
+        capture_reader reader(path);
+        replay_report report;
+        __counting_caller responder(report.responses);
+
+        captured_message m;
+        bool first = true;
+        uint64_t first_ns = 0;
+        clock_type::time_point start = clock_type::now();
+
+        while (reader.next(m)) {
+          if (!__replayable(m)) {
+            ++report.skipped;
+            continue;
+          }
+
+          if (first) {
+            first = false;
+            first_ns = m.time_ns;
+            start = clock_type::now();
+          }
+
+          if (_options.speed > 0) {
+            auto due = start + std::chrono::duration_cast<clock_type::duration>(
+                std::chrono::duration<double, std::nano>((m.time_ns - first_ns) / _options.speed));
+
+            auto now = clock_type::now();
+            if (now < due) std::this_thread::sleep_until(due);
+            else report.max_lag_ns = std::max<uint64_t>(report.max_lag_ns,
+                std::chrono::duration_cast<std::chrono::nanoseconds>(now - due).count());
+          }
+
+          auto begin = clock_type::now();
+          try {
+            dispatcher_manager::ref().execute(responder, message_view(m.frame), _options.source_ip_port);
+          }
+          catch (const std::exception&) {
+            ++report.failed;
+          }
+          auto end = clock_type::now();
+
+          ++report.executed;
+          report.bytes += m.frame.size();
+          report.latency_ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+        }
+
+        report.elapsed_ns = first ? 0 : std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count();
+        std::sort(report.latency_ns.begin(), report.latency_ns.end());
+
+        return report;
+      }
+
+    private:
+
+      class __counting_caller : public remote_caller {
+      public:
+        explicit __counting_caller(uint64_t& count) : _count(count) {}
+      protected:
+        virtual void send(const char*, size_t) { ++_count; }
+      private:
+        uint64_t& _count;
+      };
+
+      bool __replayable(const captured_message& m) const {
+        if (m.direction != _options.direction) return false;
+        if (m.frame.size() < message::request_header_size) return false;
+
+        const request_header* h = reinterpret_cast<const request_header*>(m.frame.data());
+        return !(h->flags & flag_response) && static_cast<size_t>(h->length) == m.frame.size();
+      }
+
+    private:
+
+      replay_options _options;
+    };
+
+  } // rpc
+} // atlas
+
+#endif /* ATLAS_RPC_REPLAY_H_ */
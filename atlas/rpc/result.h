@@ -25,61 +25,173 @@
 
 #include <string>
 #include <memory>
+#include <atomic>
 
 namespace atlas {
   namespace rpc {
 
-    struct __rpc_result {
-      __rpc_result(const std::string& data = "", int ec = 0) : data(data), ec(ec) {}
-
-      __rpc_result(std::string&& data, int ec) : data(data), ec(ec) { }
+    // error codes reported by the library itself, negative like the builtin function ids
+    enum rpc_error {
+      rpc_timeout = -1,   // no response before the deadline
+      rpc_cancelled = -2, // the caller gave up the session
+      rpc_rejected = -3,  // the server is overloaded, the call was not executed
+      rpc_no_quorum = -4  // a gather got all the responses of its session, fewer than its quorum
+    };
 
-      __rpc_result(const __rpc_result& other) : data(other.data), ec(other.ec) {}
+    struct __rpc_result {
+      __rpc_result() : ec(0), refs(1), next(nullptr) {}
 
       std::string data;
       int ec;
+      std::atomic<int> refs;
+      __rpc_result* next; // free list link while pooled
+    };
+
+    // A per thread free list of result nodes : a node is released to the pool of the thread which
+    // drops the last reference, the pooled nodes keep the capacity of their data strings.
+    class __rpc_result_pool {
+    public:
+
+      static const size_t max_pooled = 256;
+      static const size_t max_pooled_capacity = 4096;
+
+    public:
+
+      ~__rpc_result_pool() {
+        __dead() = true;
+
+        while (_head) {
+          __rpc_result* r = _head;
+          _head = r->next;
+          delete r;
+        }
+      }
+
+    public:
+
+      static __rpc_result* acquire() {
+        if (!__dead()) {
+          __rpc_result_pool& pool = __local();
+          if (pool._head) {
+            __rpc_result* r = pool._head;
+            pool._head = r->next;
+            --pool._size;
+
+            r->next = nullptr;
+            r->refs.store(1, std::memory_order_relaxed);
+            return r;
+          }
+        }
+
+        return new __rpc_result();
+      }
+
+      static void release(__rpc_result* r) {
+        if (!__dead()) {
+          __rpc_result_pool& pool = __local();
+          if (pool._size < max_pooled) {
+            // do not pin large buffers
+            if (r->data.capacity() > max_pooled_capacity) std::string().swap(r->data);
+            else r->data.clear();
+            r->ec = 0;
+            r->next = pool._head;
+            pool._head = r;
+            ++pool._size;
+            return;
+          }
+        }
+
+        delete r;
+      }
+
+    private:
+
+      __rpc_result_pool() : _head(nullptr), _size(0) {}
+
+      static __rpc_result_pool& __local() {
+        thread_local __rpc_result_pool pool;
+        return pool;
+      }
+
+      // trivially destructible, so it is still readable while the thread locals are being destroyed
+      static bool& __dead() {
+        thread_local bool dead = false;
+        return dead;
+      }
+
+    private:
+
+      __rpc_result* _head;
+      size_t _size;
     };
 
     // the result of the function call to the remote side
     // every result brings the result data and an error code, 0 means no error
     // null result means we no response to the remote caller
+    // the copies share an intrusively counted node taken from a per thread pool, reset() detaches
     class rpc_result {
     public:
 
       // null result must be the final result
-      rpc_result(std::nullptr_t) {}
+      rpc_result(std::nullptr_t) : _impl(nullptr) {}
 
-      rpc_result(const std::string& data = "", int ec = 0) : _impl(new __rpc_result(data, ec)) { }
+      rpc_result(const std::string& data = "", int ec = 0) : _impl(__rpc_result_pool::acquire()) {
+        _impl->data.assign(data);
+        _impl->ec = ec;
+      }
 
-      rpc_result(std::string&& data, int ec = 0) : _impl(new __rpc_result(data, ec)) { }
+      rpc_result(std::string&& data, int ec = 0) : _impl(__rpc_result_pool::acquire()) {
+        _impl->data = std::move(data);
+        _impl->ec = ec;
+      }
+
+      rpc_result(const char* data, int ec = 0) : _impl(__rpc_result_pool::acquire()) {
+        _impl->data.assign(data);
+        _impl->ec = ec;
+      }
 
-      rpc_result(const rpc_result& other) {
-        if (other._impl) _impl.reset(new __rpc_result(*other._impl));
+      rpc_result(const rpc_result& other) : _impl(other._impl) {
+        if (_impl) _impl->refs.fetch_add(1, std::memory_order_relaxed);
       }
 
-      rpc_result(rpc_result&& r) : _impl(std::move(r._impl)) {}
+      rpc_result(rpc_result&& r) : _impl(r._impl) { r._impl = nullptr; }
+
+      ~rpc_result() { __release(); }
 
       rpc_result& operator=(const rpc_result& other) {
-        if (std::addressof(other) == this) return *this;
+        if (other._impl == _impl) return *this;
+
+        if (other._impl) other._impl->refs.fetch_add(1, std::memory_order_relaxed);
+        __release();
+        _impl = other._impl;
 
-        if (other._impl) _impl.reset(new __rpc_result(*other._impl));
         return *this;
       }
 
       rpc_result& operator=(rpc_result&& other) {
         if (std::addressof(other) == this) return *this;
 
+        __release();
         _impl = other._impl;
+        other._impl = nullptr;
+
         return *this;
       }
 
     public:
 
+      // the node is reused in place if it is not shared
       void reset(const std::string& data = "", int ec = 0) {
-        _impl.reset(new __rpc_result(data, ec));
+        if (!_impl || _impl->refs.load(std::memory_order_acquire) != 1) {
+          __release();
+          _impl = __rpc_result_pool::acquire();
+        }
+
+        _impl->data.assign(data);
+        _impl->ec = ec;
       }
 
-      operator bool() const { return _impl.operator bool(); }
+      operator bool() const { return _impl != nullptr; }
 
     public:
 
@@ -88,7 +200,16 @@ namespace atlas {
 
     private:
 
-      std::shared_ptr<__rpc_result> _impl;
+      void __release() {
+        if (_impl && _impl->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+          __rpc_result_pool::release(_impl);
+        }
+        _impl = nullptr;
+      }
+
+    private:
+
+      __rpc_result* _impl;
     };
 
   } // rpc
@@ -26,6 +26,12 @@
 #include <string>
 #include <functional>
 #include <tuple>
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include <unordered_set>
+
+#include <sys/uio.h>
 
 #include <boost/lexical_cast.hpp>
 
@@ -33,23 +39,40 @@
 #include <boost/uuid/random_generator.hpp>
 #include <boost/uuid/nil_generator.hpp>
 
-#ifdef ATLAS_DEBUG_RPC
+#include <boost/serialization/split_free.hpp>
+
+#if defined(ATLAS_DEBUG_RPC)
 
+#include <boost/utility/base_from_member.hpp>
 #include <boost/archive/text_iarchive.hpp>
 #include <boost/archive/text_oarchive.hpp>
 
-#else
+#elif defined(ATLAS_RPC_BOOST_ARCHIVE)
 
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/archive/binary_oarchive.hpp>
 
+#else
+
+#include <atlas/serialization/compact_archive.h>
+
 #endif
 
 #include <atlas/serialization/tuple.h>
 #include <atlas/apply_tuple.h>
+#include <atlas/singleton.h>
+#include <atlas/inplace_string.h>
 
 #include <atlas/rpc/message.h>
+#include <atlas/rpc/buffer.h>
+#include <atlas/rpc/compression.h>
+#include <atlas/rpc/metrics.h>
+#include <atlas/rpc/admission.h>
+#include <atlas/rpc/capture.h>
+#include <atlas/rpc/session_id.h>
 #include <atlas/rpc/task.h>
+#include <atlas/rpc/future.h>
+#include <atlas/rpc/gather.h>
 
 namespace atlas {
   namespace rpc {
@@ -61,20 +84,98 @@ namespace atlas {
 
 #ifdef ATLAS_DEBUG_RPC
 
-    typedef boost::archive::text_iarchive rpc_iarchive;
-    typedef boost::archive::text_oarchive rpc_oarchive;
+    // text archives work on streams only, so hold a stream over the message buffer
+    class rpc_oarchive : private boost::base_from_member<std::ostream>, public boost::archive::text_oarchive {
+    public:
 
-#else
+      rpc_oarchive(std::streambuf& sb) :
+        boost::base_from_member<std::ostream>(&sb), boost::archive::text_oarchive(member) {}
+    };
+
+    class rpc_iarchive : private boost::base_from_member<std::istream>, public boost::archive::text_iarchive {
+    public:
+
+      rpc_iarchive(std::streambuf& sb) :
+        boost::base_from_member<std::istream>(&sb), boost::archive::text_iarchive(member) {}
+
+      rpc_iarchive(std::istream& is) :
+        boost::base_from_member<std::istream>(is.rdbuf()), boost::archive::text_iarchive(member) {}
+    };
+
+#elif defined(ATLAS_RPC_BOOST_ARCHIVE)
 
     typedef boost::archive::binary_iarchive rpc_iarchive;
     typedef boost::archive::binary_oarchive rpc_oarchive;
 
+#else
+
+    // define ATLAS_RPC_FIXED_WIDTH_INT to trade the message size for a little encoding speed
+#ifdef ATLAS_RPC_FIXED_WIDTH_INT
+    typedef atlas::serialization::fixed_int_coding rpc_int_coding;
+#else
+    typedef atlas::serialization::varint_coding rpc_int_coding;
+#endif
+
+    typedef atlas::serialization::compact_iarchive<rpc_int_coding> rpc_iarchive;
+    typedef atlas::serialization::compact_oarchive<message_buffer, rpc_int_coding> rpc_oarchive;
+
 #endif
 
 #define ATLAS_REGISTER_REMOTE_FUNC(func_name, func_id) namespace fn_ids { \
     static const int func_name = func_id; \
+}; \
+namespace fn_stubs { \
+    typedef ::atlas::rpc::remote_func_stub<func_id, void> func_name; \
+};
+
+// Register a remote function with its signature, the last parameter being a const rpc_context&, e.g.
+//
+//    ATLAS_REGISTER_TYPED_REMOTE_FUNC(add, 1, rpc_result(int, int, const rpc_context&));
+//
+// fn_stubs::add::sync_call(caller, 1, 2) then converts the arguments to the declared types at
+// compile time, and ATLAS_BIND_REMOTE_FUNC rejects a handler of another signature.
+#define ATLAS_REGISTER_TYPED_REMOTE_FUNC(func_name, func_id, signature) namespace fn_ids { \
+    static const int func_name = func_id; \
+}; \
+namespace fn_stubs { \
+    typedef ::atlas::rpc::remote_func_stub<func_id, signature> func_name; \
+};
+
+// Register a remote function which can safely run more than once for one call, e.g. a read, so that
+// a hedged_caller may send a duplicate of a late call to another target.
+#define ATLAS_REGISTER_IDEMPOTENT_REMOTE_FUNC(func_name, func_id) ATLAS_REGISTER_REMOTE_FUNC(func_name, func_id) \
+namespace fn_idempotent { \
+    static const bool func_name = ::atlas::rpc::idempotent_functions::ref().add(func_id); \
+};
+
+#define ATLAS_REGISTER_TYPED_IDEMPOTENT_REMOTE_FUNC(func_name, func_id, signature) \
+ATLAS_REGISTER_TYPED_REMOTE_FUNC(func_name, func_id, signature) \
+namespace fn_idempotent { \
+    static const bool func_name = ::atlas::rpc::idempotent_functions::ref().add(func_id); \
 };
 
+    // the function ids registered idempotent, filled at static initialization by the macros above
+    class idempotent_functions : public atlas::singleton<idempotent_functions> {
+    public:
+
+      bool add(int fn_id) {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _ids.insert(fn_id);
+
+        return true;
+      }
+
+      bool contains(int fn_id) const {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _ids.count(fn_id) > 0;
+      }
+
+    private:
+
+      mutable std::mutex _mutex;
+      std::unordered_set<int> _ids;
+    };
+
     template<typename... T>
     class rf_wrapper;
 
@@ -137,77 +238,146 @@ namespace atlas {
       std::function<Res (Args...)> _f;
     };
 
-    struct __rpc_context {
-
-      __rpc_context() : client_id(0), rt(return_type::rpc_async_no_callback) {}
-
-      __rpc_context(int client_id, int rt, const uuid& session_id, const std::string& source_ip_port) :
-        client_id(client_id), rt(rt), session_id(session_id), source_ip_port(source_ip_port)
-      {}
-
-      __rpc_context(const __rpc_context& other)
-        : client_id(other.client_id), rt(other.rt), session_id(other.session_id), source_ip_port(other.source_ip_port)
-      {}
+    // The context of a call on the serving side, a plain value : it lives on the stack of the
+    // dispatcher and copies never allocate, the source address is kept in place.
+    class rpc_context {
+    public:
 
-      int client_id;
-      int rt;
-      uuid session_id;
-      std::string source_ip_port;
-    };
+      typedef atlas::string64 address_type;
 
-    class rpc_context {
     public:
 
-      rpc_context(std::nullptr_t) {}
+      rpc_context(std::nullptr_t) : _client_id(0), _rt(return_type::rpc_async_no_callback), _session_id(nil_uuid()) {}
 
-      rpc_context() : _impl(new __rpc_context) {}
+      rpc_context() : _client_id(0), _rt(return_type::rpc_async_no_callback), _session_id(nil_uuid()) {}
 
       rpc_context(int client_id, int return_type, const uuid& session_id, const std::string& source_ip_port) :
-          _impl(new __rpc_context(client_id, return_type, session_id, source_ip_port)) {
+        _client_id(client_id), _rt(return_type), _session_id(session_id) {
+        __set_source(source_ip_port.data(), source_ip_port.size());
       }
 
-      rpc_context(const rpc_context& other) : _impl(other._impl ? new __rpc_context(*other._impl)  : nullptr) {
+      rpc_context(int client_id, int return_type, const uuid& session_id, const char* source_ip_port) :
+        _client_id(client_id), _rt(return_type), _session_id(session_id) {
+        __set_source(source_ip_port, std::char_traits<char>::length(source_ip_port));
       }
 
-      rpc_context(rpc_context&& other) : _impl(std::move(other._impl)) {}
+      void reset(int client_id, int return_type, const uuid& session_id, const std::string& source_ip_port) {
+        _client_id = client_id;
+        _rt = return_type;
+        _session_id = session_id;
+        __set_source(source_ip_port.data(), source_ip_port.size());
+      }
 
-      rpc_context operator=(const rpc_context& other) {
-        if (std::addressof(other) == this) return *this;
+      int client_id() const { return _client_id; }
 
-        if (other._impl) _impl.reset(new __rpc_context(*other._impl));
+      int get_return_type() const { return _rt; }
 
-        return *this;
+      const uuid& session_id() const { return _session_id; }
+
+      address_type source_ip() const { return address_type(_source_ip_port.data(), std::min(_source_ip_port.find(':'), _source_ip_port.size())); }
+
+      const address_type& source_ip_port() const { return _source_ip_port; }
+
+    private:
+
+      // an address longer than the inplace capacity is truncated
+      void __set_source(const char* s, size_t n) {
+        _source_ip_port.assign(s, std::min(n, _source_ip_port.capacity()));
       }
 
-      rpc_context operator=(rpc_context&& other) {
-        if (std::addressof(other) == this) return *this;
+    private:
 
-        if (other._impl) _impl = other._impl;
+      int _client_id;
+      int _rt;
+      uuid _session_id;
+      address_type _source_ip_port;
+    };
 
-        return *this;
+    // constant null value
+    const rpc_context nilctx(nullptr);
+
+    template<typename... T>
+    struct __type_list {};
+
+    // the parameter types but the last one
+    template<typename List, typename... T>
+    struct __drop_last;
+
+    template<typename... H, typename L>
+    struct __drop_last<__type_list<H...>, L> {
+      typedef __type_list<H...> type;
+      typedef L last;
+    };
+
+    template<typename... H, typename T, typename U, typename... R>
+    struct __drop_last<__type_list<H...>, T, U, R...> : __drop_last<__type_list<H..., T>, U, R...> {};
+
+    template<int Id, typename Res, typename List>
+    struct __remote_func_stub;
+
+    // the calls take the declared parameters, the arguments are converted before they are serialized,
+    // so that the message always holds what the skeleton of the function reads
+    template<int Id, typename Res, typename... P>
+    struct __remote_func_stub<Id, Res, __type_list<P...>> {
+
+      typedef Res (*pointer_type)(P..., const rpc_context&);
+
+      template<typename Caller>
+      static void call(Caller& caller, P... p) {
+        caller.call(pointer_type(), Id, p..., nilctx);
       }
 
-      void reset(int client_id, int return_type, const uuid& session_id, const std::string& source_ip_port) {
-        _impl.reset(new __rpc_context(client_id, return_type, session_id, source_ip_port));
+      template<typename Caller>
+      static void call(Caller& caller, rpc_callback_type cb, P... p) {
+        caller.call(pointer_type(), Id, cb, p..., nilctx);
       }
 
-      int client_id() const { return _impl->client_id; }
+      template<typename Caller>
+      static rpc_future<rpc_result> async_call(Caller& caller, P... p) {
+        return caller.async_call(pointer_type(), Id, p..., nilctx);
+      }
 
-      int get_return_type() const { return _impl->rt; }
+      template<typename Caller, typename Acc>
+      static rpc_future<gather_result<Acc>> gather_call(Caller& caller, const scatter_gather<Acc>& sg, P... p) {
+        return caller.gather_call(sg, pointer_type(), Id, p..., nilctx);
+      }
 
-      const uuid& session_id() const { return _impl->session_id; }
+      template<typename Caller>
+      static rpc_result sync_call(Caller& caller, P... p) {
+        return caller.sync_call(pointer_type(), Id, p..., nilctx);
+      }
+    };
 
-      std::string source_ip() const { return _impl->source_ip_port.substr(0, _impl->source_ip_port.find(":")); }
+    /*
+     * The typed client side of a remote function, declared by ATLAS_REGISTER_TYPED_REMOTE_FUNC as
+     * fn_stubs::<name>, the server side is remote_func_skeleton. ATLAS_REGISTER_REMOTE_FUNC declares
+     * an untyped one, with the id only.
+     * */
+    template<int Id, typename Signature>
+    struct remote_func_stub;
+
+    template<int Id>
+    struct remote_func_stub<Id, void> {
+      static const int id = Id;
+      typedef void signature;
+    };
 
-      const std::string& source_ip_port() const { return _impl->source_ip_port; }
+    template<int Id, typename Res, typename... Args>
+    struct remote_func_stub<Id, Res(Args...)> : __remote_func_stub<Id, Res, typename __drop_last<__type_list<>, Args...>::type> {
 
-    private:
+      static_assert(std::is_same<typename std::decay<typename __drop_last<__type_list<>, Args...>::last>::type, rpc_context>::value,
+          "the last parameter of a remote function must be a const rpc_context&");
 
-      std::shared_ptr<__rpc_context> _impl;
+      static const int id = Id;
+      typedef Res signature(Args...);
     };
 
-    // constant null value
-    const rpc_context nilctx(nullptr);
+    // an untyped registration accepts any handler
+    template<typename Stub, typename Handler>
+    struct __handler_matches : std::is_same<typename Stub::signature, Handler> {};
+
+    template<int Id, typename Handler>
+    struct __handler_matches<remote_func_stub<Id, void>, Handler> : std::true_type {};
 
     class builtin_rfc {
     public:
@@ -226,8 +396,9 @@ namespace atlas {
     };
 
     // builtin rpc
-    ATLAS_REGISTER_REMOTE_FUNC(resume_thread, -1);
-    ATLAS_REGISTER_REMOTE_FUNC(resume_task, -2);
+    ATLAS_REGISTER_TYPED_REMOTE_FUNC(resume_thread, -1, rpc_result(const uuid&, const rpc_result&, const rpc_context&));
+    ATLAS_REGISTER_TYPED_REMOTE_FUNC(resume_task, -2, rpc_result(const uuid&, const rpc_result&, const rpc_context&));
+    ATLAS_REGISTER_REMOTE_FUNC(batch, -3); // the body is a sequence of framed messages
 
   } // rpc
 } // atlas
@@ -274,45 +445,89 @@ namespace atlas {
     class message_builder {
     public:
 
-      message_builder(int client) : _client_id(client), _return_type(rpc_async_no_callback) {}
+      message_builder(int client) :
+        _client_id(client), _return_type(rpc_async_no_callback), _priority(0), _compression_threshold(0) {}
 
     public:
 
       const uuid& session_id() const { return _session_id; }
 
+      int client_id() const { return _client_id; }
+
       void set_return_type(return_type rt) { _return_type = rt; }
 
+      void set_priority(uint16_t priority) { _priority = priority; }
+
+      uint16_t priority() const { return _priority; }
+
+      // compress the bodies of at least threshold bytes, 0 disables the compression
+      void set_compression_threshold(size_t threshold) { _compression_threshold = threshold; }
+
+      size_t compression_threshold() const { return _compression_threshold; }
+
+      // Frame a remote function call into the buffer, the header is written in place and the
+      // arguments are serialized right after it, no intermediate string is involved
       template<typename Functor, typename ... Args>
-      std::string build(Functor f, int fn_id, Args&&... args) {
+      void build(message_buffer& buffer, Functor f, int fn_id, Args&&... args) {
         typedef typename std::result_of<Functor(Args&&...)>::type result_type;
 
-        _session_id = random_generator()();
+        _session_id = next_session_id();
         request_header header = message::make_header(fn_id, _session_id);
         header.client_id = _client_id;
         header.return_type = _return_type;
+        header.priority = _priority;
+
+        buffer.clear();
 
-        std::ostringstream oss;
-        std::string header_str(reinterpret_cast<char*>(&header), sizeof(header));
+        {
+          rpc_oarchive oa(buffer);
+          rf_wrapper<result_type(Args...)> rpc(f, std::forward<Args>(args)..., oa);
+        }
 
-        rpc_oarchive oa(oss);
-        rf_wrapper<result_type(Args...)> rpc(f, std::forward<Args>(args)..., oa);
+        if (_compression_threshold && buffer.body_size() >= _compression_threshold) {
+          if (compress(buffer, fn_id)) header.flags |= flag_compressed;
+        }
 
-        std::string body = oss.str();
-        std::string message(header_str);
-        message += body;
+        buffer.set_header(header);
+      }
+
+      template<typename Functor, typename ... Args>
+      std::string build(Functor f, int fn_id, Args&&... args) {
+        message_buffer buffer;
+        build(buffer, f, fn_id, std::forward<Args>(args)...);
+
+        return buffer.str();
+      }
 
-        // std::cout << body;
+      // replace the body by [raw size][compressed body] if it is smaller, the caller flags the header
+      static bool compress(message_buffer& buffer, int fn_id) {
+        typedef compression_stats::clock_type clock_type;
 
-        auto h = reinterpret_cast<request_header*>(const_cast<char*>(message.data()));
-        h->length = message.size();
+        uint32_t raw_size = static_cast<uint32_t>(buffer.body_size());
+        if (raw_size != buffer.body_size()) return false;
 
-        return std::move(message);
+        thread_local std::string scratch;
+        scratch.assign(reinterpret_cast<const char*>(&raw_size), sizeof raw_size);
+
+        auto start = clock_type::now();
+        lz_codec::compress(buffer.body(), raw_size, scratch);
+        bool smaller = scratch.size() < raw_size;
+        if (smaller) {
+          buffer.clear();
+          buffer.append(scratch.data(), scratch.size());
+        }
+
+        compression_stats::ref().on_compress(fn_id, raw_size, scratch.size(), smaller, clock_type::now() - start);
+
+        return smaller;
       }
 
     private:
 
       int _client_id;
       return_type _return_type;
+      uint16_t _priority;
+      size_t _compression_threshold;
       uuid _session_id;
     };
 
@@ -321,13 +536,119 @@ namespace atlas {
     public:
 
       remote_caller(int client = 0, int response_expected = 1) :
-        _message_builder(client), _response_expected(response_expected)
+        _message_builder(client), _response_expected(response_expected),
+        _timeout(0), _batch(new message_buffer), _batch_bytes(0), _batch_delay(0), _batch_count(0)
       {}
 
+      // NOTE : the derived class should flush() in its destructor if batching is enabled
       virtual ~remote_caller() {}
 
     public:
 
+      /*
+       * Calls with a callback and sync calls give up after the timeout, the callback is called
+       * or sync_call returns with rpc_timeout, and a late response is dropped. Zero means no timeout.
+       * */
+      void set_timeout(std::chrono::milliseconds timeout) { _timeout = timeout; }
+
+      std::chrono::milliseconds timeout() const { return _timeout; }
+
+      // the priority of the following calls, used by the servers which dispatch onto a prio_thread_pool
+      void set_priority(uint16_t priority) { _message_builder.set_priority(priority); }
+
+      /*
+       * Compress the arguments of the following calls when they serialize to threshold bytes or
+       * more and the compression makes them smaller, see compression_stats for what it costs.
+       * The responses are compressed by the caller which sends them, i.e. the one of the server.
+       * */
+      void enable_compression(size_t threshold = 4096) { _message_builder.set_compression_threshold(threshold ? threshold : 1); }
+
+      void disable_compression() { _message_builder.set_compression_threshold(0); }
+
+      /*
+       * Bound the sessions opened by this caller, share the control between the callers of one
+       * destination or client to bound them together. A call which is not admitted completes at once
+       * with rpc_rejected. A blocked call waits at most the timeout, if any, but a call made on a
+       * transport_thread, e.g. from a callback, is rejected instead of blocked. The calls without a
+       * response, which open no session, are not limited.
+       * */
+      void set_admission(const std::shared_ptr<admission_control>& control) { _admission = control; }
+
+      const std::shared_ptr<admission_control>& admission() const { return _admission; }
+
+      // the session of the last call, to cancel it with [a]sync_task_manager::cancel()
+      const uuid& session_id() const { return _message_builder.session_id(); }
+
+      /*
+       * Coalesce the calls into batches, every batch is sent as one framed message.
+       * A batch is sent when max_bytes are pending, or by the first call or flush_if_expired()
+       * issued max_delay after the first pending call. sync_call always sends at once.
+       *
+       * Nothing flushes on its own : like the calls, the flush belongs to the thread which owns
+       * the caller, so that thread must call flush_if_expired() by next_flush_deadline(), e.g.
+       * from its event loop, or flush() when it goes idle. Otherwise the last calls wait for the
+       * next one, past their timeout if they have one, and then complete with rpc_timeout.
+       * */
+      void enable_batching(size_t max_bytes, std::chrono::microseconds max_delay) {
+        _batch_bytes = max_bytes;
+        _batch_delay = max_delay;
+      }
+
+      void disable_batching() {
+        flush();
+        _batch_bytes = 0;
+      }
+
+      bool batching() const { return _batch_bytes > 0; }
+
+      // send the pending batch if any
+      void flush() {
+        std::unique_ptr<message_buffer> sending;
+        {
+          std::lock_guard<std::mutex> guard(_batch_mutex);
+          if (_batch_count == 0) return;
+
+          request_header header = message::make_header(fn_ids::batch, nil_uuid());
+          header.client_id = _message_builder.client_id();
+          header.resp_expect = _batch_count;
+          _batch->set_header(header);
+
+          // calls issued while the batch is being sent, e.g. by a loopback transport, go to another buffer
+          sending = std::move(_batch);
+          _batch = _spare_batch ? std::move(_spare_batch) : std::unique_ptr<message_buffer>(new message_buffer);
+          _batch_count = 0;
+        }
+
+        __send_frame(*sending);
+
+        sending->clear();
+        std::lock_guard<std::mutex> guard(_batch_mutex);
+        if (!_spare_batch) _spare_batch = std::move(sending);
+      }
+
+      // call it on a timer tick to bound the delay when there are no more calls
+      bool flush_if_expired() {
+        {
+          std::lock_guard<std::mutex> guard(_batch_mutex);
+          if (_batch_count == 0 || std::chrono::steady_clock::now() - _batch_start < _batch_delay) return false;
+        }
+
+        flush();
+        return true;
+      }
+
+      size_t pending_calls() const {
+        std::lock_guard<std::mutex> guard(_batch_mutex);
+        return _batch_count;
+      }
+
+      // when the pending batch is due, time_point::max() if nothing is pending
+      std::chrono::steady_clock::time_point next_flush_deadline() const {
+        std::lock_guard<std::mutex> guard(_batch_mutex);
+        if (_batch_count == 0) return std::chrono::steady_clock::time_point::max();
+        return _batch_start + _batch_delay;
+      }
+
       /*
        * 1) Serialize a remote function call with it's arguments,
        * 2) send the message to the target using the derived class's implementation
@@ -335,8 +656,10 @@ namespace atlas {
       template<typename Functor, typename ... Args>
       void call(Functor f, int fn_id, Args ... args) {
         _message_builder.set_return_type(rpc_async_no_callback);
+        _message_builder.build(_buffer, f, fn_id, std::forward<Args>(args)...);
+        rpc_metrics::on_send(fn_id, _buffer.size());
 
-        send(_message_builder.build(f, fn_id, std::forward<Args>(args)...));
+        __send();
       }
 
       /*
@@ -349,12 +672,45 @@ namespace atlas {
        * */
       template<typename Functor, typename ... Args>
       void call(Functor f, int fn_id, rpc_callback_type cb, Args ... args) {
-        _message_builder.set_return_type(rpc_async_callback);
+        __call(f, fn_id, cb, _response_expected, 0, std::forward<Args>(args)...);
+      }
+
+      /*
+       * Like the callback call, but returns a future completed by the resume_task response,
+       * or with rpc_timeout / rpc_cancelled. No thread is blocked until the future is waited for,
+       * so one thread can keep any number of calls in flight and chain them with then(),
+       * when_all() and when_any(). If more responses are expected, the first one completes the future
+       * and the others are dropped, use gather_call() to combine them.
+       * */
+      template<typename Functor, typename ... Args>
+      rpc_future<rpc_result> async_call(Functor f, int fn_id, Args ... args) {
+        rpc_promise<rpc_result> promise;
+
+        rpc_callback_type cb = [promise](const std::string& result, int err, async_task&) mutable {
+          promise.set_value(rpc_result(result, err));
+        };
+        __call(f, fn_id, cb, _response_expected, 1, std::forward<Args>(args)...);
+
+        return promise.get_future();
+      }
 
-        std::string message = _message_builder.build(f, fn_id, std::forward<Args>(args)...);
-        async_task_manager::ref().suspend(_message_builder.session_id(), cb, _response_expected);
+      /*
+       * Broadcast call answered by the given number of responses, e.g. one by target of the
+       * broadcast. They are folded by the scatter_gather as they arrive, the future is completed
+       * by its quorum, by the timeout, or with rpc_no_quorum after the last response if the
+       * quorum is more than the responses.
+       * */
+      template<typename Acc, typename Functor, typename ... Args>
+      rpc_future<gather_result<Acc>> gather_call(const scatter_gather<Acc>& sg, size_t responses, Functor f, int fn_id, Args ... args) {
+        __call(f, fn_id, sg.callback(), static_cast<int>(responses), static_cast<int>(sg.quorum()), std::forward<Args>(args)...);
+
+        return sg.get_future();
+      }
 
-        send(message);
+      // the call is answered by the responses expected by this caller
+      template<typename Acc, typename Functor, typename ... Args>
+      rpc_future<gather_result<Acc>> gather_call(const scatter_gather<Acc>& sg, Functor f, int fn_id, Args ... args) {
+        return gather_call(sg, static_cast<size_t>(_response_expected), f, fn_id, std::forward<Args>(args)...);
       }
 
       /*
@@ -363,14 +719,87 @@ namespace atlas {
       template<typename Functor, typename ... Args>
       rpc_result sync_call(Functor f, int fn_id, Args ... args) {
         typedef typename std::result_of<Functor(Args...)>::type result_type;
-        _message_builder.set_return_type(rpc_sync);
 
-        std::string message = _message_builder.build(f, fn_id, std::forward<Args>(args)...);
-        rpc_result rr = sync_task_manager::ref().suspend(_message_builder.session_id());
+        // the slot is released when the call returns
+        admission_control::ticket_type ticket = __admit();
+        if (_admission && !ticket) {
+          __count_error(fn_id, rpc_rejected);
+          return rpc_result("", rpc_rejected);
+        }
 
-        send(message);
+        _message_builder.set_return_type(rpc_sync);
 
-        return std::move(rr);
+        _message_builder.build(_buffer, f, fn_id, std::forward<Args>(args)...);
+        rpc_metrics::on_send(fn_id, _buffer.size());
+
+        // register the session first, the response may come back before send() returns
+        uuid id = _message_builder.session_id();
+        std::future<rpc_result> future = sync_task_manager::ref().expect(id);
+
+        try {
+          flush();
+          __send_frame(_buffer);
+        }
+        catch (...) {
+          sync_task_manager::ref().discard(id);
+          throw;
+        }
+
+        if (_timeout.count() > 0) {
+          rpc_result result = sync_task_manager::ref().wait_until(id, future, std::chrono::steady_clock::now() + _timeout);
+          if (result && result.err() == rpc_timeout) __count_error(fn_id, rpc_timeout);
+          return result;
+        }
+
+        return future.get();
+      }
+
+      /*
+       * Answer the session of a call with a response frame : the header carries the session and
+       * flag_response, the body is the error code followed by the result data, which is written
+       * from the result itself. The frame goes straight to the task manager of the return type
+       * on the other side, no remote function is dispatched there.
+       *
+       * Unlike the calls, the responses of one caller can be sent by several threads at once, e.g.
+       * the workers of a pooled_dispatcher and the IO thread, so nothing of the caller is used to
+       * frame them but the batch, which has its own lock.
+       * */
+      void send_response(int rt, const uuid& session_id, const rpc_result& result) {
+        static const size_t head_size = message::request_header_size + sizeof(int32_t);
+
+        request_header header = message::make_header(rt == rpc_sync ? fn_ids::resume_thread : fn_ids::resume_task, session_id);
+        header.client_id = _message_builder.client_id();
+        header.flags = flag_response;
+
+        int32_t err = result ? result.err() : 0;
+        const char* data = result ? result.data().data() : "";
+        size_t size = result ? result.data().size() : 0;
+
+        size_t threshold = _message_builder.compression_threshold();
+        bool compressing = threshold && size + sizeof err >= threshold;
+
+        // a batched or compressed response is framed in the buffer of the thread
+        if (batching() || compressing) {
+          message_buffer& buffer = __response_buffer();
+          buffer.clear();
+          buffer.append(reinterpret_cast<const char*>(&err), sizeof err);
+          buffer.append(data, size);
+          if (compressing && message_builder::compress(buffer, header.fn_id)) header.flags |= flag_compressed;
+
+          buffer.set_header(header);
+          __send(buffer);
+          return;
+        }
+
+        header.length = static_cast<int32_t>(head_size + size);
+
+        char head[head_size];
+        std::memcpy(head, &header, message::request_header_size);
+        std::memcpy(head + message::request_header_size, &err, sizeof err);
+
+        struct iovec iov[2] = { { head, head_size }, { const_cast<char*>(data), size } };
+        if (capture_tap::active()) capture_tap::ref().record(captured_sent, iov, size ? 2 : 1);
+        send(iov, size ? 2 : 1);
       }
 
     protected:
@@ -386,10 +815,146 @@ namespace atlas {
 
       virtual void send(const char* message, size_t size) = 0;
 
+      // override this function to hand the framed buffer to the network layer directly,
+      // the buffer is reused by the next call, so it must be consumed before returning
+      virtual void send(const message_buffer& buffer) {
+        send(buffer.data(), buffer.size());
+      }
+
+      // override this function to write scattered pieces with writev or alike,
+      // the default implementation has to gather them for the contiguous send
+      virtual void send(const struct iovec* iov, int iovcnt) {
+        if (iovcnt == 1) {
+          send(static_cast<const char*>(iov[0].iov_base), iov[0].iov_len);
+          return;
+        }
+
+        // per thread, like the response buffer
+        thread_local std::string gather;
+        gather.clear();
+        for (int i = 0; i < iovcnt; ++i) {
+          gather.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+        }
+
+        send(gather.data(), gather.size());
+      }
+
+    private:
+
+      // sends the frames it builds through its targets
+      friend class hedged_caller;
+
+      // the session is complete after quorum responses, 0 means all the expected responses
+      template<typename Functor, typename ... Args>
+      void __call(Functor f, int fn_id, rpc_callback_type cb, int expected, int quorum, Args ... args) {
+        if (_admission) {
+          admission_control::ticket_type ticket = __admit();
+          if (!ticket) {
+            __count_error(fn_id, rpc_rejected);
+            async_task task(cb);
+            task.run("", rpc_rejected);
+            return;
+          }
+
+          // the callback holds the slot until the session leaves the task manager, whatever the way
+          rpc_callback_type inner = cb;
+          cb = [inner, ticket](const std::string& result, int err, async_task& task) { inner(result, err, task); };
+        }
+
+        _message_builder.set_return_type(rpc_async_callback);
+
+        _message_builder.build(_buffer, f, fn_id, std::forward<Args>(args)...);
+        rpc_metrics::on_send(fn_id, _buffer.size());
+
+        uuid id = _message_builder.session_id();
+        if (_timeout.count() > 0) {
+          // the task manager does not know the function, the expiry is counted on the way to the callback
+          if (rpc_metrics::enabled()) {
+            rpc_callback_type inner = cb;
+            cb = [inner, fn_id](const std::string& result, int err, async_task& task) {
+              if (err == rpc_timeout) __count_error(fn_id, rpc_timeout);
+              inner(result, err, task);
+            };
+          }
+          async_task_manager::ref().suspend(id, cb, expected, quorum, std::chrono::steady_clock::now() + _timeout);
+        }
+        else {
+          async_task_manager::ref().suspend(id, cb, expected, quorum);
+        }
+
+        try {
+          __send();
+        }
+        catch (...) {
+          async_task_manager::ref().discard(id);
+          throw;
+        }
+      }
+
+      // the errors produced on this side never reach a probe of the server
+      static void __count_error(int fn_id, int err) {
+        if (rpc_metrics::enabled()) rpc_metrics_probe::on_error(rpc_metrics::cell(fn_id), err);
+      }
+
+      // every framed message goes through here, or through the send of send_response
+      void __send_frame(const message_buffer& buffer) {
+        if (capture_tap::active()) capture_tap::ref().record(captured_sent, buffer.data(), buffer.size());
+        send(buffer);
+      }
+
+      void __send_frame(const char* frame, size_t size) {
+        if (capture_tap::active()) capture_tap::ref().record(captured_sent, frame, size);
+        send(frame, size);
+      }
+
+      admission_control::ticket_type __admit() {
+        if (!_admission) return nullptr;
+
+        if (_timeout.count() > 0) return _admission->acquire_until(std::chrono::steady_clock::now() + _timeout);
+        return _admission->acquire();
+      }
+
+      void __send() { __send(_buffer); }
+
+      void __send(const message_buffer& buffer) {
+        if (!batching()) {
+          __send_frame(buffer);
+          return;
+        }
+
+        bool due;
+        {
+          std::lock_guard<std::mutex> guard(_batch_mutex);
+          if (_batch_count++ == 0) _batch_start = std::chrono::steady_clock::now();
+          _batch->append(buffer.data(), buffer.size());
+
+          due = _batch->body_size() >= _batch_bytes || std::chrono::steady_clock::now() - _batch_start >= _batch_delay;
+        }
+
+        if (due) flush();
+      }
+
+      static message_buffer& __response_buffer() {
+        thread_local message_buffer buffer;
+        return buffer;
+      }
+
     private:
 
       message_builder _message_builder;
+      message_buffer _buffer;
       int _response_expected;
+      std::chrono::milliseconds _timeout;
+      std::shared_ptr<admission_control> _admission;
+
+      // batching, the responses of several threads can share the batch
+      mutable std::mutex _batch_mutex; // guards the batch, its count and its start
+      std::unique_ptr<message_buffer> _batch;
+      std::unique_ptr<message_buffer> _spare_batch;
+      size_t _batch_bytes;
+      std::chrono::steady_clock::duration _batch_delay;
+      std::chrono::steady_clock::time_point _batch_start;
+      int _batch_count;
     };
 
 
@@ -0,0 +1,111 @@
+/*
+ * session_id.h
+ *
+ *  Created on: Oct 20, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_RPC_SESSION_ID_H_
+#define ATLAS_RPC_SESSION_ID_H_
+
+#include <atomic>
+#include <cstring>
+#include <cstdint>
+
+#include <boost/uuid/uuid.hpp>
+#include <boost/uuid/random_generator.hpp>
+
+namespace atlas {
+  namespace rpc {
+
+    using boost::uuids::uuid;
+
+    // Sequential session ids, unique in the process and very unlikely to collide with other processes:
+    //
+    //    bytes 0 ~ 7     a random prefix, drawn once per process
+    //    bytes 8 ~ 15    the thread slot (24 bits) and a per thread counter (40 bits)
+    //
+    // An id costs a thread local increment and two stores. The ids are not RFC 4122 uuids,
+    // they are just 128 bit values carried in a boost::uuids::uuid.
+    class sequential_session_id_generator {
+    public:
+
+      uuid operator()() const {
+        static const uint64_t counter_mask = (uint64_t(1) << 40) - 1;
+
+        thread_local uint64_t next = __next_slot();
+
+        // take a new slot when the counter of this one is exhausted
+        if ((next & counter_mask) == counter_mask) next = __next_slot();
+
+        uuid id;
+        uint64_t prefix = __prefix();
+        uint64_t sequence = next++;
+        std::memcpy(id.data, &prefix, sizeof prefix);
+        std::memcpy(id.data + sizeof prefix, &sequence, sizeof sequence);
+
+        return id;
+      }
+
+    private:
+
+      static uint64_t __next_slot() {
+        static std::atomic<uint64_t> slot(0);
+        return slot.fetch_add(1, std::memory_order_relaxed) << 40;
+      }
+
+      static uint64_t __prefix() {
+        static const uint64_t prefix = __random_prefix();
+        return prefix;
+      }
+
+      static uint64_t __random_prefix() {
+        uuid seed = boost::uuids::random_generator()();
+
+        uint64_t prefix;
+        std::memcpy(&prefix, seed.data, sizeof prefix);
+
+        return prefix;
+      }
+    };
+
+    // random (version 4) session ids, the generator is seeded once per thread instead of once per id
+    class random_session_id_generator {
+    public:
+
+      uuid operator()() const {
+        thread_local boost::uuids::random_generator gen;
+        return gen();
+      }
+    };
+
+    // define ATLAS_RPC_RANDOM_SESSION_ID to use random session ids
+#ifdef ATLAS_RPC_RANDOM_SESSION_ID
+    typedef random_session_id_generator session_id_generator;
+#else
+    typedef sequential_session_id_generator session_id_generator;
+#endif
+
+    inline uuid next_session_id() {
+      return session_id_generator()();
+    }
+
+  } // rpc
+} // atlas
+
+#endif /* ATLAS_RPC_SESSION_ID_H_ */
@@ -0,0 +1,155 @@
+/*
+ * session_table.h
+ *
+ *  Created on: Oct 19, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_RPC_SESSION_TABLE_H_
+#define ATLAS_RPC_SESSION_TABLE_H_
+
+#include <mutex>
+#include <cstdint>
+#include <functional>
+
+#include <boost/uuid/uuid.hpp>
+
+#include <atlas/container/flat_map128.h>
+
+namespace atlas {
+  namespace rpc {
+
+    using boost::uuids::uuid;
+
+    // the hash of the tables, the shard is picked by its high bits, flat_map128 probes with the others
+    typedef atlas::hash128<uuid> session_id_hash;
+
+    // A session table split into Shards independently locked parts, picked by the session id hash.
+    // Every operation locks exactly one shard for a short time, the values are moved out before
+    // the caller acts on them, so no user code ever runs under a shard lock.
+    template<typename Value, size_t Shards = 64>
+    class session_table {
+    public:
+
+      static_assert(Shards > 0 && (Shards & (Shards - 1)) == 0, "Shards must be a power of 2");
+
+      typedef Value value_type;
+
+    public:
+
+      session_table() = default;
+
+      session_table(const session_table&) = delete;
+      session_table& operator=(const session_table&) = delete;
+
+    public:
+
+      // returns false if the session exists already
+      bool insert(const uuid& id, const Value& value) {
+        shard& s = __shard(id);
+
+        std::lock_guard<std::mutex> guard(s.mutex);
+        return s.sessions.emplace(id, value).second;
+      }
+
+      // remove the session and move its value out, returns false if there is no such session
+      bool take(const uuid& id, Value& value) {
+        shard& s = __shard(id);
+
+        std::lock_guard<std::mutex> guard(s.mutex);
+        auto it = s.sessions.find(id);
+        if (it == s.sessions.end()) return false;
+
+        value = std::move(it->second);
+        s.sessions.erase(typename map_type::const_iterator(it));
+
+        return true;
+      }
+
+      // Run f(value) under the shard lock, f returns true to remove the session.
+      // Keep f short, copy what is needed and act on it after the call returns.
+      template<typename F>
+      bool update(const uuid& id, F f) {
+        shard& s = __shard(id);
+
+        std::lock_guard<std::mutex> guard(s.mutex);
+        auto it = s.sessions.find(id);
+        if (it == s.sessions.end()) return false;
+
+        if (f(it->second)) s.sessions.erase(typename map_type::const_iterator(it));
+
+        return true;
+      }
+
+      bool erase(const uuid& id) {
+        shard& s = __shard(id);
+
+        std::lock_guard<std::mutex> guard(s.mutex);
+        return s.sessions.erase(id) > 0;
+      }
+
+      bool contains(const uuid& id) const {
+        const shard& s = __shard(id);
+
+        std::lock_guard<std::mutex> guard(s.mutex);
+        return s.sessions.find(id) != s.sessions.end();
+      }
+
+      // not a snapshot, the shards are visited one by one
+      size_t size() const {
+        size_t n = 0;
+        for (const shard& s : _shards) {
+          std::lock_guard<std::mutex> guard(s.mutex);
+          n += s.sessions.size();
+        }
+
+        return n;
+      }
+
+      void clear() {
+        for (shard& s : _shards) {
+          std::lock_guard<std::mutex> guard(s.mutex);
+          s.sessions.clear();
+        }
+      }
+
+    private:
+
+      typedef flat_map128<uuid, Value, session_id_hash> map_type;
+
+      // pad the shards, so that the locks of two shards never share a cache line
+      struct shard {
+        mutable std::mutex mutex;
+        map_type sessions;
+        char padding[64];
+      };
+
+      // the high bits of the hash pick the shard, the table of the shard uses the low ones
+      shard& __shard(const uuid& id) { return _shards[(session_id_hash()(id) >> (sizeof(size_t) * 8 - 16)) & (Shards - 1)]; }
+
+      const shard& __shard(const uuid& id) const { return const_cast<session_table*>(this)->__shard(id); }
+
+    private:
+
+      shard _shards[Shards];
+    };
+
+  } // rpc
+} // atlas
+
+#endif /* ATLAS_RPC_SESSION_TABLE_H_ */
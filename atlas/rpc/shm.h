@@ -0,0 +1,294 @@
+/*
+ * shm.h
+ *
+ *  Created on: Oct 25, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_RPC_SHM_H_
+#define ATLAS_RPC_SHM_H_
+
+#include <new>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <stdexcept>
+#include <system_error>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <atlas/container/spsc_ring.h>
+#include <atlas/rpc/rpc.h>
+#include <atlas/rpc/dispatcher.h>
+#include <atlas/rpc/loopback.h>
+
+namespace atlas {
+  namespace rpc {
+
+    // The first page of the mapped file, followed by the storage of the two rings.
+    // Only lock free atomics live here, they work across processes.
+    struct __shm_header {
+      static const uint64_t magic_value = 0x61746c6173726d31ULL; // "atlasrm1"
+
+      std::atomic<uint64_t> magic; // set last by the server, when the rings are ready
+      uint64_t ring_capacity;
+
+      spsc_ring_control rings[2]; // 0 : client to server, 1 : server to client
+
+      alignas(64) std::atomic<int> idle[2]; // futex words, 1 while the consumer of the ring sleeps
+    };
+
+    static_assert(sizeof(__shm_header) <= 4096, "the shared memory header must fit in a page");
+
+    // Futex wakeups, the words are shared between processes, so not FUTEX_PRIVATE
+    struct __shm_futex {
+
+      static void wait(std::atomic<int>& word, int value, std::chrono::milliseconds timeout) {
+        struct timespec ts;
+        ts.tv_sec = timeout.count() / 1000;
+        ts.tv_nsec = (timeout.count() % 1000) * 1000000;
+
+        ::syscall(SYS_futex, reinterpret_cast<int*>(&word), FUTEX_WAIT, value, &ts, nullptr, 0);
+      }
+
+      static void wake(std::atomic<int>& word) {
+        ::syscall(SYS_futex, reinterpret_cast<int*>(&word), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+      }
+    };
+
+    // a ring caller which wakes the consumer up if it sleeps, a system call is made only then
+    class shm_caller : public ring_caller {
+    public:
+
+      shm_caller(spsc_ring& ring, std::atomic<int>& idle, int client = 0, int response_expected = 1) :
+        ring_caller(ring, client, response_expected), _idle(idle)
+      {}
+
+      virtual ~shm_caller() { flush(); }
+
+    protected:
+
+      virtual void pushed() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (_idle.load(std::memory_order_relaxed) == 1) {
+          _idle.store(0, std::memory_order_relaxed);
+          __shm_futex::wake(_idle);
+        }
+      }
+
+    private:
+
+      std::atomic<int>& _idle;
+    };
+
+    /*
+     * A same host transport over a memory mapped file, which holds one SPSC ring per direction.
+     * The messages are the framed messages of the other transports, request_header included,
+     * copied once into the ring and dispatched in place on the other side, no kernel copy.
+     *
+     * The server creates the file, the client maps it. Each side has a polling thread, it spins
+     * for a while, then sleeps on a futex which the peer wakes up only when it sees it idle.
+     * Like the loopback, the client calls through caller() from one thread at a time and the
+     * callbacks must not call through it.
+     * */
+    class shm_transport {
+    public:
+
+      enum role { server, client };
+
+    public:
+
+      shm_transport(const std::string& path, role r, size_t ring_capacity = 1 << 20) :
+        _path(path), _role(r), _stopped(false), _served(0)
+      {
+        __map(ring_capacity);
+
+        __shm_header* h = __header();
+        char* data = static_cast<char*>(_base) + header_size;
+        size_t capacity = h->ring_capacity;
+
+        _rings[0].reset(new spsc_ring(&h->rings[0], data, capacity));
+        _rings[1].reset(new spsc_ring(&h->rings[1], data + capacity, capacity));
+
+        // a server reads the ring 0 and writes the ring 1, a client does the opposite
+        int in = (r == server) ? 0 : 1;
+        int out = 1 - in;
+
+        _caller.reset(new shm_caller(*_rings[out], h->idle[out]));
+        _caller->set_stop_flag(_stopped);
+        _thread = std::thread([this, in]() { __poll(in); });
+      }
+
+      ~shm_transport() {
+        _caller->flush();
+
+        _stopped = true;
+        __shm_futex::wake(__header()->idle[_role == server ? 0 : 1]);
+        _thread.join();
+
+        _caller.reset();
+        ::munmap(_base, _size);
+        if (_role == server) ::unlink(_path.c_str());
+      }
+
+      shm_transport(const shm_transport&) = delete;
+      shm_transport& operator=(const shm_transport&) = delete;
+
+    public:
+
+      // the requests of a client, the responses of a server
+      remote_caller& caller() { return *_caller; }
+
+      size_t messages_served() const { return _served.load(std::memory_order_relaxed); }
+
+    private:
+
+      static const size_t header_size = 4096;
+
+      __shm_header* __header() const { return static_cast<__shm_header*>(_base); }
+
+      void __map(size_t ring_capacity) {
+        size_t capacity = 64;
+        while (capacity < ring_capacity) capacity <<= 1;
+
+        int fd = (_role == server) ? ::open(_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)
+            : ::open(_path.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd < 0) throw std::system_error(errno, std::system_category(), "open " + _path);
+
+        if (_role == server) {
+          _size = header_size + 2 * capacity;
+          if (::ftruncate(fd, _size) < 0) {
+            ::close(fd);
+            throw std::system_error(errno, std::system_category(), "ftruncate " + _path);
+          }
+        }
+        else {
+          struct stat st;
+          ::fstat(fd, &st);
+          _size = st.st_size;
+          if (_size < header_size) {
+            ::close(fd);
+            throw std::runtime_error(_path + " is not an atlas rpc shared memory file");
+          }
+        }
+
+        _base = ::mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (_base == MAP_FAILED) throw std::system_error(errno, std::system_category(), "mmap " + _path);
+
+        if (_role == server) {
+          __shm_header* h = new (_base) __shm_header;
+          h->ring_capacity = capacity;
+          new (&h->rings[0]) spsc_ring_control;
+          new (&h->rings[1]) spsc_ring_control;
+          h->idle[0].store(0, std::memory_order_relaxed);
+          h->idle[1].store(0, std::memory_order_relaxed);
+          h->magic.store(__shm_header::magic_value, std::memory_order_release);
+        }
+        else if (__header()->magic.load(std::memory_order_acquire) != __shm_header::magic_value
+            || !__valid_capacity(__header()->ring_capacity, _size)) {
+          ::munmap(_base, _size);
+          throw std::runtime_error(_path + " is not ready or not an atlas rpc shared memory file");
+        }
+      }
+
+      // the rings index with capacity - 1, and both of them must fit in the file
+      static bool __valid_capacity(uint64_t capacity, size_t size) {
+        return capacity >= 64 && (capacity & (capacity - 1)) == 0
+            && capacity <= size && header_size + 2 * capacity <= size;
+      }
+
+      void __poll(int in) {
+        transport_thread marker;
+        spsc_ring& ring = *_rings[in];
+        std::atomic<int>& idle = __header()->idle[in];
+
+        // the responses are never answered, and the poller of a client must not touch its caller
+        struct no_response_caller : public remote_caller {
+          virtual void send(const char*, size_t) {}
+        } no_response;
+        remote_caller& responder = (_role == server) ? static_cast<remote_caller&>(*_caller) : no_response;
+
+        unsigned spins = 0;
+        while (!_stopped.load(std::memory_order_relaxed)) {
+          bool got = ring.try_pop([this, &responder](const char* p, size_t n) {
+            try {
+              dispatcher_manager::ref().execute(responder, message_view(p, n), _path);
+            }
+            catch (const std::exception&) {
+              // a malformed message is dropped, the transport goes on
+            }
+          });
+
+          if (got) {
+            _served.fetch_add(1, std::memory_order_relaxed);
+            spins = 0;
+            continue;
+          }
+
+          responder.flush();
+
+          // the peer wrote a corrupt frame, nothing more can be read from this mapping
+          if (ring.broken()) break;
+
+          if (++spins < 4096) {
+            if (spins > 256) std::this_thread::yield();
+            continue;
+          }
+
+          // announce the sleep, then check again, the producer checks the flag after its push
+          idle.store(1, std::memory_order_relaxed);
+          std::atomic_thread_fence(std::memory_order_seq_cst);
+          if (ring.empty() && !_stopped.load(std::memory_order_relaxed)) {
+            __shm_futex::wait(idle, 1, std::chrono::milliseconds(100));
+          }
+          idle.store(0, std::memory_order_relaxed);
+          spins = 0;
+        }
+      }
+
+    private:
+
+      std::string _path;
+      role _role;
+
+      void* _base;
+      size_t _size;
+
+      std::unique_ptr<spsc_ring> _rings[2];
+      std::unique_ptr<shm_caller> _caller;
+
+      std::atomic<bool> _stopped;
+      std::atomic<size_t> _served;
+      std::thread _thread;
+    };
+
+  } // rpc
+} // atlas
+
+#endif /* ATLAS_RPC_SHM_H_ */
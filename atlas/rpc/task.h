@@ -23,16 +23,22 @@
 #ifndef ATLAS_RPC_TASK_H_
 #define ATLAS_RPC_TASK_H_
 
-#include <map>
 #include <string>
+#include <vector>
 #include <mutex>
+#include <thread>
+#include <chrono>
 #include <functional>
 #include <future>
+#include <condition_variable>
 
 #include <boost/uuid/uuid.hpp>
 
 #include <atlas/singleton.h>
 #include <atlas/rpc/result.h>
+#include <atlas/rpc/admission.h>
+#include <atlas/rpc/session_table.h>
+#include <atlas/rpc/timer_wheel.h>
 
 namespace atlas {
   namespace rpc {
@@ -44,18 +50,22 @@ namespace atlas {
 
     struct __async_task {
 
-      __async_task(rpc_callback_type cb = nullptr, int response_received = 1, int response_expected = 0)
-        : cb(cb), response_received(response_received), response_expected(response_expected), record_count(0) {}
+      // the task is complete after quorum responses, 0 means all the expected responses
+      __async_task(rpc_callback_type cb = nullptr, int response_expected = 1, int quorum = 0)
+        : cb(cb), response_received(0), response_expected(response_expected),
+          quorum(quorum > 0 && quorum < response_expected ? quorum : response_expected), record_count(0) {}
 
       __async_task(const __async_task& d)
         : cb(d.cb), response_received(d.response_received), response_expected(d.response_expected),
-          record_count(0), data_list(d.data_list) {}
+          quorum(d.quorum), record_count(0), data_list(d.data_list) {}
 
       rpc_callback_type cb;
       int response_received;
       int response_expected;
+      int quorum;
       size_t record_count;
       std::vector<std::string> data_list;
+      std::mutex mutex; // serialize the callbacks of the task
     };
 
     class async_task {
@@ -63,8 +73,8 @@ namespace atlas {
 
       async_task(std::nullptr_t) {}
 
-      async_task(rpc_callback_type cb = nullptr, int response_received = 1)
-        : _pimpl(new __async_task(cb, response_received)) {}
+      async_task(rpc_callback_type cb = nullptr, int response_expected = 1, int quorum = 0)
+        : _pimpl(new __async_task(cb, response_expected, quorum)) {}
 
       async_task(const async_task& task) :
         _pimpl(new __async_task(*task._pimpl))
@@ -76,7 +86,8 @@ namespace atlas {
 
           _pimpl->cb = task._pimpl->cb;
           _pimpl->response_received = task._pimpl->response_received;
-          _pimpl->response_received = task._pimpl->response_received;
+          _pimpl->response_expected = task._pimpl->response_expected;
+          _pimpl->quorum = task._pimpl->quorum;
           _pimpl->record_count = task._pimpl->record_count;
           _pimpl->data_list = task._pimpl->data_list;
         }
@@ -96,9 +107,12 @@ namespace atlas {
 
       void increase_response() { ++_pimpl->response_received; }
 
-      bool ready() const { return _pimpl->response_received == _pimpl->response_received; }
+      // the responses after the quorum are dropped with the task
+      bool ready() const { return _pimpl->response_received >= _pimpl->quorum; }
 
+      // the callbacks of one task never run concurrently
       void run(const std::string& result, int err) {
+        std::lock_guard<std::mutex> guard(_pimpl->mutex);
         if (_pimpl->cb) _pimpl->cb(result, err, *this);
       }
 
@@ -110,6 +124,8 @@ namespace atlas {
 
       size_t expected_response_count() const { return _pimpl->response_expected; }
 
+      size_t quorum() const { return _pimpl->quorum; }
+
       size_t record_count() const { return _pimpl->record_count; }
 
       std::string merge_data(char sep = '\0') {
@@ -137,79 +153,189 @@ namespace atlas {
     public:
 
       typedef std::shared_ptr<std::promise<rpc_result>> promise_ptr;
+      typedef std::chrono::steady_clock clock_type;
 
     public:
 
-      rpc_result suspend(const uuid& id) {
+      // register the session before the request is sent, so that no response can be missed
+      std::future<rpc_result> expect(const uuid& id) {
         promise_ptr promise(new std::promise<rpc_result>());
+        _promises.insert(id, promise);
 
-        {
-          std::lock_guard<std::mutex> guard(_mutex);
-          _promises.insert(std::make_pair(id, promise));
+        return promise->get_future();
+      }
+
+      // Wait for the result of a session registered by expect().
+      // On timeout the session is removed and the result carries rpc_timeout,
+      // unless the response is being delivered right now, then it is waited for.
+      rpc_result wait_until(const uuid& id, std::future<rpc_result>& future, clock_type::time_point deadline) {
+        if (future.wait_until(deadline) == std::future_status::timeout && _promises.erase(id)) {
+          return rpc_result("", rpc_timeout);
         }
 
-        std::future<rpc_result> future = promise->get_future();
+        return future.get();
+      }
+
+      rpc_result suspend(const uuid& id) {
+        std::future<rpc_result> future = expect(id);
         future.wait();
 
         return std::move(future.get());
       }
 
+      // the promise is fulfilled out of the table lock
       void resume(const uuid& id, const std::string& result, int err_code = 0) {
         promise_ptr promise;
-
-        {
-          std::lock_guard<std::mutex> guard(_mutex);
-          promise = _promises[id];
-          _promises.erase(id);
-        }
+        if (!_promises.take(id, promise)) return;
 
         rpc_result r(result, err_code);
         promise->set_value(r);
       }
 
+      void resume(const uuid& id, std::string&& result, int err_code = 0) {
+        promise_ptr promise;
+        if (!_promises.take(id, promise)) return;
+
+        promise->set_value(rpc_result(std::move(result), err_code));
+      }
+
+      // wake up the waiting thread with rpc_cancelled, a late response is dropped
+      void cancel(const uuid& id) {
+        resume(id, "", rpc_cancelled);
+      }
+
+      // forget the session without waking anyone, e.g. the request could not be sent
+      void discard(const uuid& id) {
+        _promises.erase(id);
+      }
+
       void clear() {
-        std::lock_guard<std::mutex> guard(_mutex);
         _promises.clear();
       }
 
+      size_t size() const { return _promises.size(); }
+
     private:
 
-      std::mutex _mutex;
-      std::map<uuid , promise_ptr> _promises;
+      session_table<promise_ptr> _promises;
     };
 
     class async_task_manager : public atlas::singleton<async_task_manager> {
     public:
 
-      void suspend(const uuid& id, rpc_callback_type cb, int response_received = 1) {
-        std::lock_guard<std::mutex> guard(_mutex);
+      typedef std::shared_ptr<async_task> task_ptr;
+      typedef timer_wheel<uuid>::clock_type clock_type;
+
+      // the completed sessions leave their deadline behind, they are purged once they outnumber
+      // the live sessions, so the wheel holds at most twice the sessions in flight plus this
+      static const size_t purge_floor = 4096;
+
+    public:
+
+      async_task_manager() : _stopped(false) {}
 
-        async_task task(cb, response_received);
-        _sessions.insert(std::make_pair(id, task));
+      ~async_task_manager() {
+        {
+          std::lock_guard<std::mutex> guard(_timer_mutex);
+          _stopped = true;
+        }
+        _timer_cond.notify_one();
+
+        if (_timer_thread.joinable()) _timer_thread.join();
       }
 
+    public:
+
+      // the session is complete after quorum responses, 0 means all the expected responses
+      void suspend(const uuid& id, rpc_callback_type cb, int response_expected = 1, int quorum = 0) {
+        _sessions.insert(id, std::make_shared<async_task>(cb, response_expected, quorum));
+      }
+
+      // the callback is called with rpc_timeout if the session is not complete by the deadline
+      void suspend(const uuid& id, rpc_callback_type cb, int response_expected, int quorum, clock_type::time_point deadline) {
+        suspend(id, cb, response_expected, quorum);
+
+        std::call_once(_timer_started, [this]() { _timer_thread = std::thread(&async_task_manager::__run_timer, this); });
+        _timers.schedule(deadline, id);
+      }
+
+      // the table lock is held only to count the response,
+      // the callback runs after the lock is released
       void resume(const uuid& id, const std::string& result, int err_code = 0) {
-        std::lock_guard<std::mutex> guard(_mutex);
+        task_ptr task;
 
-        auto it = _sessions.find(id);
-        if (it != _sessions.end()) {
+        _sessions.update(id, [&task](task_ptr& t) {
           // increase response counter
-          it->second.increase_response();
-
-          // call callback
-          it->second.run(result, err_code);
+          t->increase_response();
+          task = t;
 
           // clean if need
-          if (it->second.ready()) {
-            _sessions.erase(it);
+          return t->ready();
+        });
+
+        // call callback
+        if (task) task->run(result, err_code);
+      }
+
+      // remove the session and call its callback with rpc_cancelled, late responses are dropped
+      void cancel(const uuid& id) {
+        __fail(id, rpc_cancelled);
+      }
+
+      // remove the session and call its callback with rpc_timeout
+      void expire(const uuid& id) {
+        __fail(id, rpc_timeout);
+      }
+
+      // forget the session without calling its callback
+      void discard(const uuid& id) {
+        _sessions.erase(id);
+      }
+
+      void clear() {
+        _sessions.clear();
+      }
+
+      size_t size() const { return _sessions.size(); }
+
+      // the deadlines waiting on the timer thread, including those of the completed sessions
+      size_t timer_count() const { return _timers.size(); }
+
+    private:
+
+      void __fail(const uuid& id, int err_code) {
+        task_ptr task;
+        if (_sessions.take(id, task)) task->run("", err_code);
+      }
+
+      // the sessions completed in time are not found by expire()
+      void __run_timer() {
+        transport_thread marker; // the callbacks of the expired sessions run here
+        std::unique_lock<std::mutex> lock(_timer_mutex);
+
+        while (!_stopped) {
+          _timer_cond.wait_for(lock, _timers.tick());
+          if (_stopped) break;
+
+          lock.unlock();
+          _timers.advance(clock_type::now(), [this](const uuid& id) { expire(id); });
+          if (_timers.size() > 2 * _sessions.size() + purge_floor) {
+            _timers.purge([this](const uuid& id) { return !_sessions.contains(id); });
           }
+          lock.lock();
         }
       }
 
     private:
 
-      std::mutex _mutex;
-      std::map<uuid, async_task> _sessions;
+      session_table<task_ptr> _sessions;
+
+      timer_wheel<uuid> _timers;
+      std::once_flag _timer_started;
+      std::thread _timer_thread;
+      std::mutex _timer_mutex;
+      std::condition_variable _timer_cond;
+      bool _stopped;
     };
 
   } // rpc
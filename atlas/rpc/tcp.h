@@ -0,0 +1,622 @@
+/*
+ * tcp.h
+ *
+ *  Created on: Oct 24, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_RPC_TCP_H_
+#define ATLAS_RPC_TCP_H_
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <system_error>
+#include <unordered_map>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include <atlas/rpc/rpc.h>
+#include <atlas/rpc/dispatcher.h>
+
+namespace atlas {
+  namespace rpc {
+
+    inline std::system_error __tcp_error(const char* what) {
+      return std::system_error(errno, std::system_category(), what);
+    }
+
+    /*
+     * One TCP connection, it is the caller for the messages going out on it : the client calls
+     * through the connection returned by tcp_transport::connect(), one thread at a time like any
+     * caller, and the IO thread answers the requests through the accepted connections.
+     *
+     * Sending writes directly to the socket if nothing is queued, the rest is queued and written
+     * with writev when the socket is writable again. Sending on a closed connection throws.
+     *
+     * close() only shuts the socket down, the IO thread closes the descriptor once it is out of
+     * its epoll set, so that the descriptor can not be reused under a read of the IO thread.
+     * */
+    class tcp_connection;
+    typedef std::shared_ptr<tcp_connection> tcp_connection_ptr;
+
+    // takes over the dispatch of the requests and the batches received on a connection, e.g. a pooled_dispatcher
+    typedef std::function<void(const tcp_connection_ptr&, const message_view&)> tcp_handler_type;
+
+    class tcp_connection : public remote_caller, public std::enable_shared_from_this<tcp_connection> {
+    public:
+
+      static const size_t read_chunk = 64 * 1024;
+      static const size_t max_message_size = 64 * 1024 * 1024;
+
+    public:
+
+      tcp_connection(int fd, const std::string& peer, int client = 0, int response_expected = 1,
+          tcp_handler_type handler = nullptr) :
+        remote_caller(client, response_expected), _fd(fd), _peer(peer), _handler(handler),
+        _closed(false), _in(read_chunk), _in_begin(0), _in_end(0), _out_offset(0)
+      {}
+
+      virtual ~tcp_connection() { __close(); }
+
+      tcp_connection(const tcp_connection&) = delete;
+      tcp_connection& operator=(const tcp_connection&) = delete;
+
+    public:
+
+      const std::string& peer() const { return _peer; }
+
+      bool is_open() const {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _fd >= 0 && !_closed;
+      }
+
+      void close() {
+        std::lock_guard<std::mutex> guard(_mutex);
+        __shutdown();
+      }
+
+      // the bytes waiting for the socket to be writable
+      size_t pending_bytes() const {
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        size_t n = 0;
+        for (const std::string& chunk : _out) n += chunk.size();
+        return n - _out_offset;
+      }
+
+    protected:
+
+      using remote_caller::send;
+
+      virtual void send(const char* message, size_t size) {
+        struct iovec iov = { const_cast<char*>(message), size };
+        send(&iov, 1);
+      }
+
+      virtual void send(const struct iovec* iov, int iovcnt) {
+        std::lock_guard<std::mutex> guard(_mutex);
+        if (_fd < 0 || _closed) throw std::runtime_error("tcp connection to " + _peer + " is closed");
+
+        int first = 0;
+        size_t offset = 0;
+
+        // keep the order, write directly only if nothing is queued
+        if (_out.empty()) {
+          ssize_t n = ::writev(_fd, iov, iovcnt);
+          if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+              __shutdown();
+              throw __tcp_error("writev");
+            }
+            n = 0;
+          }
+
+          size_t written = static_cast<size_t>(n);
+          while (first < iovcnt && written >= iov[first].iov_len) written -= iov[first++].iov_len;
+          offset = written;
+        }
+
+        for (int i = first; i < iovcnt; ++i) {
+          const char* p = static_cast<const char*>(iov[i].iov_base);
+          if (i == first) _out.push_back(std::string(p + offset, iov[i].iov_len - offset));
+          else _out.push_back(std::string(p, iov[i].iov_len));
+        }
+      }
+
+    private:
+
+      friend class tcp_transport;
+
+      // called by the IO thread when the socket is writable, returns false if the connection is broken
+      bool __write_pending() {
+        std::lock_guard<std::mutex> guard(_mutex);
+        if (_fd < 0 || _closed) return false;
+
+        while (!_out.empty()) {
+          struct iovec iov[64];
+          int iovcnt = 0;
+          for (size_t i = 0; i < _out.size() && iovcnt < 64; ++i, ++iovcnt) {
+            size_t skip = (i == 0) ? _out_offset : 0;
+            iov[iovcnt].iov_base = const_cast<char*>(_out[i].data() + skip);
+            iov[iovcnt].iov_len = _out[i].size() - skip;
+          }
+
+          ssize_t n = ::writev(_fd, iov, iovcnt);
+          if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            __shutdown();
+            return false;
+          }
+
+          size_t written = static_cast<size_t>(n);
+          while (!_out.empty() && written >= _out.front().size() - _out_offset) {
+            written -= _out.front().size() - _out_offset;
+            _out.pop_front();
+            _out_offset = 0;
+          }
+          _out_offset += written;
+        }
+
+        return true;
+      }
+
+      // Called by the IO thread when the socket is readable : read until EAGAIN, dispatch every
+      // complete message in place from the read buffer. Returns false if the connection is done.
+      // Only the IO thread closes the descriptor, so it is read without the lock.
+      bool __read_and_dispatch() {
+        for (;;) {
+          if (!is_open()) return false;
+          if (_in.size() - _in_end < read_chunk / 4) __make_room();
+
+          ssize_t n = ::read(_fd, _in.data() + _in_end, _in.size() - _in_end);
+          if (n == 0) return false;
+          if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+          }
+
+          _in_end += n;
+          if (!__dispatch()) return false;
+        }
+      }
+
+      bool __dispatch() {
+        while (_in_end - _in_begin >= message::request_header_size) {
+          int32_t length;
+          std::memcpy(&length, _in.data() + _in_begin, sizeof length);
+
+          if (length < static_cast<int32_t>(message::request_header_size) || static_cast<size_t>(length) > max_message_size) {
+            return false;
+          }
+          if (_in_end - _in_begin < static_cast<size_t>(length)) {
+            // make sure the whole message fits, so that the next reads complete it
+            if (_in.size() - _in_begin < static_cast<size_t>(length)) _in.resize(_in_begin + length);
+            break;
+          }
+
+          try {
+            message_view msg(_in.data() + _in_begin, length);
+
+            // the builtin functions, i.e. the responses, always run inline, the batches of calls
+            // go to the handler like the calls
+            int32_t fn_id = msg.header()->fn_id;
+            if (_handler && (fn_id >= 0 || fn_id == fn_ids::batch)) _handler(shared_from_this(), msg);
+            else dispatcher_manager::ref().execute(*this, msg, _peer);
+          }
+          catch (const std::exception&) {
+            // a malformed message, or a handler which throws, drops its frame, the connection goes on
+          }
+
+          _in_begin += length;
+        }
+
+        if (_in_begin == _in_end) _in_begin = _in_end = 0;
+
+        return true;
+      }
+
+      // move the partial message to the front, or grow the buffer
+      void __make_room() {
+        if (_in_begin > 0) {
+          std::memmove(_in.data(), _in.data() + _in_begin, _in_end - _in_begin);
+          _in_end -= _in_begin;
+          _in_begin = 0;
+        }
+
+        if (_in.size() - _in_end < read_chunk / 4) _in.resize(_in.size() * 2);
+      }
+
+      // stop the reads and the writes, the IO thread sees the hang up and releases the connection
+      void __shutdown() {
+        if (_fd < 0 || _closed) return;
+
+        ::shutdown(_fd, SHUT_RDWR);
+        _closed = true;
+        _out.clear();
+        _out_offset = 0;
+      }
+
+      // close the descriptor, by the IO thread once it is out of the epoll set, or at the end
+      void __close() {
+        if (_fd < 0) return;
+
+        ::close(_fd);
+        _fd = -1;
+        _closed = true;
+        _out.clear();
+        _out_offset = 0;
+      }
+
+      void __release() {
+        std::lock_guard<std::mutex> guard(_mutex);
+        __close();
+      }
+
+      int __fd() const { return _fd; }
+
+    private:
+
+      mutable std::mutex _mutex; // guards the fd, the close state and the output
+      int _fd;
+      bool _closed;
+      std::string _peer;
+      tcp_handler_type _handler;
+
+      // read side, touched by the IO thread only
+      std::vector<char> _in;
+      size_t _in_begin;
+      size_t _in_end;
+
+      // write side
+      std::deque<std::string> _out;
+      size_t _out_offset;
+    };
+
+    /*
+     * An edge triggered epoll transport. Every IO thread has its own epoll set, the connections
+     * are spread over them round robin and never move, so all the reads and dispatches of one
+     * connection happen on one thread, in order. The messages are framed by request_header::length.
+     * */
+    class tcp_transport {
+    public:
+
+      explicit tcp_transport(size_t io_threads = 1) : _reserve_fd(-1), _stopped(false), _next(0) {
+        if (io_threads == 0) io_threads = 1;
+
+        _reserve_fd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+        for (size_t i = 0; i < io_threads; ++i) {
+          std::unique_ptr<io_thread> t(new io_thread);
+
+          t->epfd = ::epoll_create1(EPOLL_CLOEXEC);
+          t->wakeup = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+          if (t->epfd < 0 || t->wakeup < 0) throw __tcp_error("epoll_create1");
+
+          struct epoll_event ev;
+          ev.events = EPOLLIN;
+          ev.data.u64 = wakeup_tag;
+          ::epoll_ctl(t->epfd, EPOLL_CTL_ADD, t->wakeup, &ev);
+
+          _threads.push_back(std::move(t));
+        }
+
+        for (auto& t : _threads) {
+          io_thread* p = t.get();
+          p->thread = std::thread([this, p]() { __run(*p); });
+        }
+      }
+
+      ~tcp_transport() {
+        _stopped = true;
+
+        for (auto& t : _threads) {
+          uint64_t one = 1;
+          ssize_t r = ::write(t->wakeup, &one, sizeof one);
+          (void) r;
+        }
+
+        for (auto& t : _threads) {
+          t->thread.join();
+          for (auto& c : t->connections) c.second->__release();
+
+          ::close(t->epfd);
+          ::close(t->wakeup);
+        }
+
+        for (int fd : _listeners) ::close(fd);
+        if (_reserve_fd >= 0) ::close(_reserve_fd);
+      }
+
+      tcp_transport(const tcp_transport&) = delete;
+      tcp_transport& operator=(const tcp_transport&) = delete;
+
+    public:
+
+      // listen on host:port, port 0 picks a free port, returns the bound port
+      uint16_t listen(const std::string& host, uint16_t port, int backlog = 128) {
+        struct sockaddr_in addr = __resolve(host, port);
+
+        int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) throw __tcp_error("socket");
+
+        int on = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+
+        if (::bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof addr) < 0 || ::listen(fd, backlog) < 0) {
+          std::system_error e = __tcp_error("bind/listen");
+          ::close(fd);
+          throw e;
+        }
+
+        socklen_t len = sizeof addr;
+        ::getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &len);
+
+        {
+          std::lock_guard<std::mutex> guard(_mutex);
+          _listeners.push_back(fd);
+        }
+
+        // the first IO thread accepts, the events carry the fd and a listener bit
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.u64 = (static_cast<uint64_t>(fd) << 1) | 1;
+        if (::epoll_ctl(_threads[0]->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) throw __tcp_error("epoll_ctl");
+
+        return ntohs(addr.sin_port);
+      }
+
+      // a blocking connect, then the connection is served by an IO thread
+      tcp_connection_ptr connect(const std::string& host, uint16_t port, int client = 0, int response_expected = 1) {
+        struct sockaddr_in addr = __resolve(host, port);
+
+        int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) throw __tcp_error("socket");
+
+        if (::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof addr) < 0) {
+          std::system_error e = __tcp_error("connect");
+          ::close(fd);
+          throw e;
+        }
+
+        return __adopt(fd, __address(addr), client, response_expected);
+      }
+
+      size_t io_threads() const { return _threads.size(); }
+
+      // Dispatch the requests of the connections made from now on through the handler instead
+      // of running them on the IO thread, e.g.
+      //
+      //    pooled_dispatcher<> pool(8);
+      //    transport.set_handler([&pool](const tcp_connection_ptr& c, const message_view& m) {
+      //      pool.execute(c, m, c->peer());
+      //    });
+      //
+      void set_handler(tcp_handler_type handler) {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _handler = handler;
+      }
+
+    private:
+
+      static const uint64_t wakeup_tag = ~uint64_t(0);
+
+      struct io_thread {
+        int epfd;
+        int wakeup;
+        std::thread thread;
+        std::mutex mutex; // guards connections
+        std::unordered_map<int, tcp_connection_ptr> connections;
+      };
+
+      // the connection owns the fd, which is closed if it can not be adopted
+      tcp_connection_ptr __adopt(int fd, const std::string& peer, int client = 0, int response_expected = 1) {
+        int flags = ::fcntl(fd, F_GETFL, 0);
+        ::fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+        int on = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+
+        tcp_handler_type handler;
+        {
+          std::lock_guard<std::mutex> guard(_mutex);
+          handler = _handler;
+        }
+
+        tcp_connection_ptr c;
+        try {
+          c = std::make_shared<tcp_connection>(fd, peer, client, response_expected, handler);
+        }
+        catch (...) {
+          ::close(fd);
+          throw;
+        }
+
+        io_thread& t = *_threads[_next.fetch_add(1, std::memory_order_relaxed) % _threads.size()];
+
+        {
+          std::lock_guard<std::mutex> guard(t.mutex);
+          t.connections[fd] = c;
+        }
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.u64 = static_cast<uint64_t>(fd) << 1;
+        if (::epoll_ctl(t.epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+          std::system_error e = __tcp_error("epoll_ctl");
+          {
+            std::lock_guard<std::mutex> guard(t.mutex);
+            t.connections.erase(fd);
+          }
+          throw e;
+        }
+
+        return c;
+      }
+
+      void __run(io_thread& t) {
+        transport_thread marker;
+        struct epoll_event events[256];
+
+        while (!_stopped.load(std::memory_order_relaxed)) {
+          int n = ::epoll_wait(t.epfd, events, 256, -1);
+          if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+          }
+
+          for (int i = 0; i < n; ++i) {
+            uint64_t tag = events[i].data.u64;
+            if (tag == wakeup_tag) continue;
+
+            int fd = static_cast<int>(tag >> 1);
+
+            if (tag & 1) {
+              __accept(fd);
+              continue;
+            }
+
+            tcp_connection_ptr c;
+            {
+              std::lock_guard<std::mutex> guard(t.mutex);
+              auto it = t.connections.find(fd);
+              if (it == t.connections.end()) continue;
+              c = it->second;
+            }
+
+            bool alive = !(events[i].events & EPOLLERR);
+            if (alive && (events[i].events & EPOLLOUT)) alive = c->__write_pending();
+            if (alive && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))) alive = c->__read_and_dispatch();
+            if (alive) alive = c->__write_pending();
+
+            if (!alive) {
+              {
+                std::lock_guard<std::mutex> guard(t.mutex);
+                t.connections.erase(fd);
+              }
+
+              // out of the set first, the fd can be reused as soon as it is closed
+              ::epoll_ctl(t.epfd, EPOLL_CTL_DEL, fd, nullptr);
+              c->__release();
+            }
+          }
+        }
+      }
+
+      void __accept(int listener) {
+        for (;;) {
+          struct sockaddr_in addr;
+          socklen_t len = sizeof addr;
+
+          int fd = ::accept4(listener, reinterpret_cast<struct sockaddr*>(&addr), &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+          if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if ((errno == EMFILE || errno == ENFILE) && __shed(listener)) continue;
+            return; // EAGAIN, or no descriptor to shed with
+          }
+
+          // a connection which can not be adopted is closed, the others are still accepted
+          try {
+            __adopt(fd, __address(addr));
+          }
+          catch (const std::exception&) {
+          }
+        }
+      }
+
+      // Out of descriptors : the listener is edge triggered, so the pending connections would wait
+      // for the next one to come in. Free the reserve descriptor to accept one and close it at
+      // once, the peer sees the refusal and the backlog drains. False if there is no reserve.
+      bool __shed(int listener) {
+        if (_reserve_fd < 0) return false;
+
+        ::close(_reserve_fd);
+        int fd = ::accept(listener, nullptr, nullptr);
+        int err = errno;
+        if (fd >= 0) ::close(fd);
+        _reserve_fd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+        return fd >= 0 || err == EINTR || err == ECONNABORTED;
+      }
+
+      static struct sockaddr_in __resolve(const std::string& host, uint16_t port) {
+        struct sockaddr_in addr;
+        std::memset(&addr, 0, sizeof addr);
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+
+        if (host.empty() || host == "*") {
+          addr.sin_addr.s_addr = htonl(INADDR_ANY);
+          return addr;
+        }
+
+        if (::inet_pton(AF_INET, host.c_str(), &addr.sin_addr) == 1) return addr;
+
+        struct addrinfo hints, *res = nullptr;
+        std::memset(&hints, 0, sizeof hints);
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if (::getaddrinfo(host.c_str(), nullptr, &hints, &res) != 0 || !res) {
+          throw std::runtime_error("can not resolve " + host);
+        }
+
+        addr.sin_addr = reinterpret_cast<struct sockaddr_in*>(res->ai_addr)->sin_addr;
+        ::freeaddrinfo(res);
+
+        return addr;
+      }
+
+      static std::string __address(const struct sockaddr_in& addr) {
+        char ip[INET_ADDRSTRLEN] = { 0 };
+        ::inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof ip);
+
+        return std::string(ip) + ":" + std::to_string(ntohs(addr.sin_port));
+      }
+
+    private:
+
+      std::vector<std::unique_ptr<io_thread>> _threads;
+      std::vector<int> _listeners;
+      int _reserve_fd; // kept to shed the pending connections when out of descriptors, used by the first IO thread
+      tcp_handler_type _handler;
+      std::mutex _mutex; // guards the listeners and the handler
+      std::atomic<bool> _stopped;
+      std::atomic<size_t> _next;
+    };
+
+  } // rpc
+} // atlas
+
+#endif /* ATLAS_RPC_TCP_H_ */
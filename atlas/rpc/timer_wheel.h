@@ -0,0 +1,164 @@
+/*
+ * timer_wheel.h
+ *
+ *  Created on: Oct 21, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_RPC_TIMER_WHEEL_H_
+#define ATLAS_RPC_TIMER_WHEEL_H_
+
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+#include <iterator>
+#include <algorithm>
+
+namespace atlas {
+  namespace rpc {
+
+    // A hashed timing wheel : the time is cut in ticks, a timer due at tick t lives in slot t % Slots.
+    // Scheduling is O(1), expiring costs O(1) per timer as long as most of the timeouts are shorter
+    // than a revolution (tick * slots), longer ones just stay in their slot for more rounds.
+    // There is no cancellation, the entries are expected to be ids which the owner checks when
+    // they expire, e.g. a session which has completed in the meantime is simply not found.
+    // Such entries stay until their deadline, the owner bounds them with purge().
+    template<typename Entry>
+    class timer_wheel {
+    public:
+
+      typedef std::chrono::steady_clock clock_type;
+      typedef Entry entry_type;
+
+    public:
+
+      explicit timer_wheel(clock_type::duration tick = std::chrono::milliseconds(10), size_t slots = 1024) :
+        _origin(clock_type::now()), _tick(tick), _slots(__round_up(slots)), _current(0), _size(0)
+      {}
+
+      timer_wheel(const timer_wheel&) = delete;
+      timer_wheel& operator=(const timer_wheel&) = delete;
+
+    public:
+
+      // an entry never expires before its deadline, but may expire up to one tick after it
+      void schedule(clock_type::time_point deadline, const Entry& entry) {
+        uint64_t tick = __tick_of(deadline);
+
+        std::lock_guard<std::mutex> guard(_mutex);
+        if (tick <= _current) tick = _current + 1;
+
+        _slots[tick & (_slots.size() - 1)].push_back(item { tick, entry });
+        ++_size;
+      }
+
+      // Expire all the entries due by now, f(entry) is called after the lock is released.
+      // Returns the number of expired entries.
+      template<typename F>
+      size_t advance(clock_type::time_point now, F f) {
+        std::vector<item> expired;
+
+        {
+          std::lock_guard<std::mutex> guard(_mutex);
+
+          uint64_t target = __elapsed_ticks(now);
+          if (target <= _current) return 0;
+
+          // a full revolution visits every slot, no need to go further
+          uint64_t steps = std::min<uint64_t>(target - _current, _slots.size());
+          for (uint64_t i = 1; i <= steps; ++i) {
+            std::vector<item>& slot = _slots[(_current + i) & (_slots.size() - 1)];
+
+            auto due = std::partition(slot.begin(), slot.end(), [target](const item& it) { return it.tick > target; });
+            std::move(due, slot.end(), std::back_inserter(expired));
+            slot.erase(due, slot.end());
+          }
+
+          _current = target;
+          _size -= expired.size();
+        }
+
+        for (const item& it : expired) f(it.entry);
+
+        return expired.size();
+      }
+
+      // Drop the entries for which gone(entry) is true, e.g. the completed sessions, it visits all
+      // of them under the lock, so call it when they are many, not on every tick.
+      template<typename F>
+      size_t purge(F gone) {
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        size_t n = 0;
+        for (std::vector<item>& slot : _slots) {
+          auto end = std::remove_if(slot.begin(), slot.end(), [&gone](const item& it) { return gone(it.entry); });
+          n += slot.end() - end;
+          slot.erase(end, slot.end());
+        }
+        _size -= n;
+
+        return n;
+      }
+
+      clock_type::duration tick() const { return _tick; }
+
+      size_t size() const {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _size;
+      }
+
+    private:
+
+      struct item {
+        uint64_t tick;
+        Entry entry;
+      };
+
+      // the first tick not earlier than the time point
+      uint64_t __tick_of(clock_type::time_point tp) const {
+        if (tp <= _origin) return 0;
+        return ((tp - _origin) + _tick - clock_type::duration(1)) / _tick;
+      }
+
+      // the number of the whole ticks elapsed
+      uint64_t __elapsed_ticks(clock_type::time_point tp) const {
+        if (tp <= _origin) return 0;
+        return (tp - _origin) / _tick;
+      }
+
+      static size_t __round_up(size_t n) {
+        size_t r = 1;
+        while (r < n) r <<= 1;
+        return r;
+      }
+
+    private:
+
+      mutable std::mutex _mutex;
+      const clock_type::time_point _origin;
+      const clock_type::duration _tick;
+      std::vector<std::vector<item>> _slots;
+      uint64_t _current; // all the ticks up to this one have expired
+      size_t _size;
+    };
+
+  } // rpc
+} // atlas
+
+#endif /* ATLAS_RPC_TIMER_WHEEL_H_ */
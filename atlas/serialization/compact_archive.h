@@ -0,0 +1,473 @@
+/*
+ * compact_archive.h
+ *
+ *  Created on: Oct 18, 2013
+ *      Author: vincent
+ */
+
+/*
+ * A light weight binary archive pair.
+ *
+ * Unlike boost::archive::binary_oarchive, nothing but the data is written: no archive header,
+ * no class information and no tracking, and constructing an archive costs nothing.
+ * The encoding of every type is selected at compile time :
+ *
+ *    bool and byte sized types       one byte
+ *    other integers                  varint (zigzag for signed ones) or fixed width, see IntCoding
+ *    enums                           as the underlying integer
+ *    floating points                 raw bytes
+ *    std::string                     varint length followed by the bytes
+ *    std::vector<bool>               varint length followed by the bits, 8 by byte
+ *    std::vector, arrays             varint length (vector only) followed by the elements,
+ *                                    memcpy if they are encoded as their raw bytes anyway
+ *    bitwise serializable types      raw bytes, opt in with BOOST_IS_BITWISE_SERIALIZABLE(T)
+ *    anything else                   the usual boost::serialization serialize hook,
+ *                                    e.g. std::tuple in atlas/serialization/tuple.h
+ *
+ * A trivially copyable class is not copied as raw bytes unless it opts in, its serialize()
+ * is used like for any other class.
+ *
+ * Both sides must agree on IntCoding. The byte order is the host's one.
+ *
+ * Example:
+ *
+ *    std::string out;
+ *    atlas::serialization::string_sink sink(out);
+ *    atlas::serialization::compact_oarchive<atlas::serialization::string_sink> oa(sink);
+ *    oa << std::make_tuple(1, std::string("hello"));
+ *
+ *    atlas::serialization::compact_iarchive<> ia(out.data(), out.size());
+ *    std::tuple<int, std::string> t;
+ *    ia >> t;
+ */
+
+#ifndef ATLAS_SERIALIZATION_COMPACT_ARCHIVE_H_
+#define ATLAS_SERIALIZATION_COMPACT_ARCHIVE_H_
+
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <istream>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+
+#include <boost/mpl/bool.hpp>
+#include <boost/serialization/serialization.hpp>
+#include <boost/serialization/nvp.hpp>
+#include <boost/serialization/is_bitwise_serializable.hpp>
+
+namespace atlas {
+  namespace serialization {
+
+    // thrown when the input is truncated or malformed
+    class archive_error : public std::runtime_error {
+    public:
+
+      explicit archive_error(const char* what) : std::runtime_error(what) {}
+    };
+
+    // integer coding policies
+    struct varint_coding {};
+    struct fixed_int_coding {};
+
+    // the simplest sink : append to a std::string
+    class string_sink {
+    public:
+
+      explicit string_sink(std::string& s) : _s(s) {}
+
+      void append(const char* data, size_t size) { _s.append(data, size); }
+
+    private:
+
+      std::string& _s;
+    };
+
+    namespace detail {
+
+      struct byte_tag {};
+      struct integer_tag {};
+      struct enum_tag {};
+      struct raw_tag {};
+      struct string_tag {};
+      struct vector_tag {};
+      struct bool_vector_tag {};
+      struct array_tag {};
+      struct nvp_tag {};
+      struct serializable_tag {};
+
+      template<typename T>
+      struct encoding {
+        typedef typename std::conditional<std::is_enum<T>::value, enum_tag,
+            typename std::conditional<std::is_arithmetic<T>::value && sizeof(T) == 1, byte_tag,
+            typename std::conditional<std::is_integral<T>::value, integer_tag,
+            typename std::conditional<std::is_array<T>::value, array_tag,
+            typename std::conditional<boost::serialization::is_bitwise_serializable<T>::value, raw_tag,
+            serializable_tag>::type>::type>::type>::type>::type type;
+      };
+
+      template<typename Ch, typename Traits, typename Alloc>
+      struct encoding<std::basic_string<Ch, Traits, Alloc>> { typedef string_tag type; };
+
+      template<typename T, typename Alloc>
+      struct encoding<std::vector<T, Alloc>> { typedef vector_tag type; };
+
+      template<typename Alloc>
+      struct encoding<std::vector<bool, Alloc>> { typedef bool_vector_tag type; };
+
+      template<typename T>
+      struct encoding<boost::serialization::nvp<T>> { typedef nvp_tag type; };
+
+      // elements which can be copied as a block : those encoded as their raw bytes one by one
+      template<typename T, typename IntCoding>
+      struct is_block_copyable : std::integral_constant<bool,
+        (std::is_arithmetic<T>::value || std::is_enum<T>::value || boost::serialization::is_bitwise_serializable<T>::value) &&
+        !std::is_array<T>::value &&
+        (!(std::is_integral<T>::value || std::is_enum<T>::value) || sizeof(T) == 1 || std::is_same<IntCoding, fixed_int_coding>::value)> {};
+
+      inline uint64_t zigzag(int64_t v) { return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63); }
+
+      inline int64_t unzigzag(uint64_t v) { return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1); }
+
+      // write at most 10 bytes, returns the count
+      inline size_t encode_varint(uint64_t v, char* buf) {
+        size_t n = 0;
+
+        while (v >= 0x80) {
+          buf[n++] = static_cast<char>(v | 0x80);
+          v >>= 7;
+        }
+        buf[n++] = static_cast<char>(v);
+
+        return n;
+      }
+
+    } // detail
+
+    template<typename Sink, typename IntCoding = varint_coding>
+    class compact_oarchive {
+    public:
+
+      typedef boost::mpl::bool_<true> is_saving;
+      typedef boost::mpl::bool_<false> is_loading;
+
+      explicit compact_oarchive(Sink& sink) : _sink(sink) {}
+
+    public:
+
+      template<typename T>
+      compact_oarchive& operator<<(const T& t) {
+        __save(t, typename detail::encoding<T>::type());
+        return *this;
+      }
+
+      template<typename T>
+      compact_oarchive& operator&(const T& t) { return *this << t; }
+
+      void save_binary(const void* data, size_t size) {
+        _sink.append(static_cast<const char*>(data), size);
+      }
+
+      void save_size(uint64_t n) { __save_varint(n); }
+
+      unsigned int get_library_version() const { return 0; }
+
+    private:
+
+      template<typename T>
+      void __save(const T& t, detail::byte_tag) { save_binary(&t, 1); }
+
+      template<typename T>
+      void __save(const T& t, detail::integer_tag) { __save_integer(t, IntCoding()); }
+
+      template<typename T>
+      void __save(const T& t, detail::enum_tag) {
+        typedef typename std::underlying_type<T>::type underlying_type;
+        *this << static_cast<underlying_type>(t);
+      }
+
+      template<typename T>
+      void __save(const T& t, detail::raw_tag) { save_binary(&t, sizeof(T)); }
+
+      template<typename T>
+      void __save(const T& s, detail::string_tag) {
+        __save_varint(s.size());
+        save_binary(s.data(), s.size() * sizeof(typename T::value_type));
+      }
+
+      template<typename T>
+      void __save(const T& v, detail::vector_tag) {
+        __save_varint(v.size());
+        __save_elements(v.data(), v.size());
+      }
+
+      template<typename T>
+      void __save(const T& v, detail::bool_vector_tag) {
+        __save_varint(v.size());
+
+        char buf[512];
+        size_t len = 0;
+        for (size_t i = 0; i < v.size(); i += 8) {
+          char bits = 0;
+          for (size_t j = i; j < i + 8 && j < v.size(); ++j) bits |= static_cast<char>(v[j]) << (j - i);
+          buf[len++] = bits;
+
+          if (len == sizeof(buf)) {
+            save_binary(buf, len);
+            len = 0;
+          }
+        }
+
+        save_binary(buf, len);
+      }
+
+      template<typename T>
+      void __save(const T& a, detail::array_tag) {
+        __save_elements(&a[0], std::extent<T>::value);
+      }
+
+      template<typename T>
+      void __save(const T& t, detail::nvp_tag) { *this << t.const_value(); }
+
+      template<typename T>
+      void __save(const T& t, detail::serializable_tag) {
+        boost::serialization::serialize_adl(*this, const_cast<T&>(t), 0);
+      }
+
+      template<typename T>
+      void __save_elements(const T* p, size_t n) {
+        __save_elements(p, n, detail::is_block_copyable<T, IntCoding>());
+      }
+
+      template<typename T>
+      void __save_elements(const T* p, size_t n, std::true_type) { save_binary(p, n * sizeof(T)); }
+
+      template<typename T>
+      void __save_elements(const T* p, size_t n, std::false_type) {
+        __save_each(p, n, std::is_integral<T>());
+      }
+
+      template<typename T>
+      void __save_each(const T* p, size_t n, std::false_type) {
+        for (size_t i = 0; i < n; ++i) *this << p[i];
+      }
+
+      // encode a run of varints in a local buffer, one append per chunk instead of per element
+      template<typename T>
+      void __save_each(const T* p, size_t n, std::true_type) {
+        char buf[640];
+        size_t len = 0;
+
+        for (size_t i = 0; i < n; ++i) {
+          uint64_t v = std::is_signed<T>::value ? detail::zigzag(p[i]) : static_cast<uint64_t>(p[i]);
+          len += detail::encode_varint(v, buf + len);
+
+          if (len > sizeof(buf) - 10) {
+            save_binary(buf, len);
+            len = 0;
+          }
+        }
+
+        save_binary(buf, len);
+      }
+
+      template<typename T>
+      void __save_integer(T t, varint_coding) {
+        __save_integer_varint(t, std::is_signed<T>());
+      }
+
+      template<typename T>
+      void __save_integer(T t, fixed_int_coding) { save_binary(&t, sizeof(T)); }
+
+      template<typename T>
+      void __save_integer_varint(T t, std::true_type) { __save_varint(detail::zigzag(t)); }
+
+      template<typename T>
+      void __save_integer_varint(T t, std::false_type) { __save_varint(t); }
+
+      void __save_varint(uint64_t v) {
+        char buf[10];
+        save_binary(buf, detail::encode_varint(v, buf));
+      }
+
+    private:
+
+      Sink& _sink;
+    };
+
+    template<typename IntCoding = varint_coding>
+    class compact_iarchive {
+    public:
+
+      typedef boost::mpl::bool_<false> is_saving;
+      typedef boost::mpl::bool_<true> is_loading;
+
+      compact_iarchive(const char* data, size_t size) : _pos(data), _end(data + size) {}
+
+      // Source must provide data() and size(), e.g. std::string
+      template<typename Source>
+      explicit compact_iarchive(const Source& source,
+          typename std::enable_if<!std::is_base_of<std::istream, Source>::value, std::nullptr_t>::type = nullptr) :
+          _pos(source.data()), _end(source.data() + source.size()) {}
+
+      // the rest of the stream is copied, prefer the other constructors
+      explicit compact_iarchive(std::istream& is) :
+          _owned(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>()),
+          _pos(_owned.data()), _end(_owned.data() + _owned.size()) {}
+
+    public:
+
+      template<typename T>
+      compact_iarchive& operator>>(T& t) {
+        __load(t, typename detail::encoding<T>::type());
+        return *this;
+      }
+
+      template<typename T>
+      compact_iarchive& operator>>(const boost::serialization::nvp<T>& t) {
+        return *this >> t.value();
+      }
+
+      template<typename T>
+      compact_iarchive& operator&(T& t) { return *this >> t; }
+
+      template<typename T>
+      compact_iarchive& operator&(const boost::serialization::nvp<T>& t) { return *this >> t.value(); }
+
+      void load_binary(void* data, size_t size) {
+        __check(size);
+
+        std::memcpy(data, _pos, size);
+        _pos += size;
+      }
+
+      uint64_t load_size() { return __load_varint(); }
+
+      // bytes not consumed yet
+      size_t remaining() const { return _end - _pos; }
+
+      const char* position() const { return _pos; }
+
+      unsigned int get_library_version() const { return 0; }
+
+    private:
+
+      template<typename T>
+      void __load(T& t, detail::byte_tag) { load_binary(&t, 1); }
+
+      template<typename T>
+      void __load(T& t, detail::integer_tag) { __load_integer(t, IntCoding()); }
+
+      template<typename T>
+      void __load(T& t, detail::enum_tag) {
+        typename std::underlying_type<T>::type v;
+        *this >> v;
+        t = static_cast<T>(v);
+      }
+
+      template<typename T>
+      void __load(T& t, detail::raw_tag) { load_binary(&t, sizeof(T)); }
+
+      template<typename T>
+      void __load(T& s, detail::string_tag) {
+        typedef typename T::value_type char_type;
+
+        uint64_t n = __load_varint();
+        __check(n * sizeof(char_type));
+
+        s.assign(reinterpret_cast<const char_type*>(_pos), n);
+        _pos += n * sizeof(char_type);
+      }
+
+      // every element takes one byte at least, which bounds the size before allocating
+      template<typename T>
+      void __load(T& v, detail::vector_tag) {
+        uint64_t n = __load_varint();
+        __check(n);
+
+        v.resize(n);
+        __load_elements(v.data(), n);
+      }
+
+      template<typename T>
+      void __load(T& v, detail::bool_vector_tag) {
+        uint64_t n = __load_varint();
+        uint64_t bytes = n / 8 + (n % 8 != 0);
+        __check(bytes);
+
+        v.resize(n);
+        for (size_t i = 0; i < n; ++i) v[i] = (_pos[i / 8] >> (i % 8)) & 1;
+        _pos += bytes;
+      }
+
+      template<typename T>
+      void __load(T& a, detail::array_tag) {
+        __load_elements(&a[0], std::extent<T>::value);
+      }
+
+      template<typename T>
+      void __load(T& t, detail::nvp_tag) { *this >> t.value(); }
+
+      template<typename T>
+      void __load(T& t, detail::serializable_tag) {
+        boost::serialization::serialize_adl(*this, t, 0);
+      }
+
+      template<typename T>
+      void __load_elements(T* p, size_t n) {
+        __load_elements(p, n, detail::is_block_copyable<T, IntCoding>());
+      }
+
+      template<typename T>
+      void __load_elements(T* p, size_t n, std::true_type) { load_binary(p, n * sizeof(T)); }
+
+      template<typename T>
+      void __load_elements(T* p, size_t n, std::false_type) {
+        for (size_t i = 0; i < n; ++i) *this >> p[i];
+      }
+
+      template<typename T>
+      void __load_integer(T& t, varint_coding) {
+        __load_integer_varint(t, std::is_signed<T>());
+      }
+
+      template<typename T>
+      void __load_integer(T& t, fixed_int_coding) { load_binary(&t, sizeof(T)); }
+
+      template<typename T>
+      void __load_integer_varint(T& t, std::true_type) { t = static_cast<T>(detail::unzigzag(__load_varint())); }
+
+      template<typename T>
+      void __load_integer_varint(T& t, std::false_type) { t = static_cast<T>(__load_varint()); }
+
+      uint64_t __load_varint() {
+        uint64_t v = 0;
+
+        for (int shift = 0; shift < 64; shift += 7) {
+          __check(1);
+
+          uint8_t b = static_cast<uint8_t>(*_pos++);
+          v |= static_cast<uint64_t>(b & 0x7f) << shift;
+          if (!(b & 0x80)) return v;
+        }
+
+        throw archive_error("malformed varint");
+      }
+
+      void __check(uint64_t size) const {
+        if (size > static_cast<uint64_t>(_end - _pos)) throw archive_error("input truncated");
+      }
+
+    private:
+
+      std::string _owned;
+      const char* _pos;
+      const char* _end;
+    };
+
+  } // serialization
+} // atlas
+
+#endif /* ATLAS_SERIALIZATION_COMPACT_ARCHIVE_H_ */
@@ -13,6 +13,7 @@
 #include <algorithm>
 #include <type_traits>
 #include <limits>
+#include <stdexcept>
 
 #include <atlas/string_algo.h>
 
@@ -9,6 +9,8 @@
 #define ATLAS_ALGORITHM_H_
 
 #include <string>
+#include <limits>
+#include <cstddef>
 #include <type_traits>
 #include <algorithm>
 
@@ -16,14 +18,16 @@ namespace atlas {
 
   namespace {
 
+    // the difference of two lengths clamped to an int, like std::basic_string::_S_compare :
+    // it is taken as signed, so that a shorter length gives a negative result
     template<typename UnsignedLong>
     int compare_unsigned_long(UnsignedLong n, UnsignedLong n2) {
       static_assert(std::is_unsigned<UnsignedLong>::value, "used for unsigned");
 
-      const static size_t min_int = std::numeric_limits<int>::min();
-      const static size_t max_int = std::numeric_limits<int>::max();
+      const static std::ptrdiff_t min_int = std::numeric_limits<int>::min();
+      const static std::ptrdiff_t max_int = std::numeric_limits<int>::max();
 
-      const size_t d = size_t(n - n2);
+      const std::ptrdiff_t d = std::ptrdiff_t(n - n2);
 
       if (d > max_int) return std::numeric_limits<int>::max();
       else if (d < min_int) return std::numeric_limits<int>::min();
@@ -31,18 +35,20 @@ namespace atlas {
     }
   } // anonymous
 
+  // < 0, 0 or > 0 as n orders before, like or after n2, equal values must give 0 : the
+  // inplace_strings test their equality with it
   template<typename T>
   int compare(T n, T n2) {
-    return n < n2;
+    return n < n2 ? -1 : (n2 < n ? 1 : 0);
   }
 
   template<>
-  int compare(unsigned long n, unsigned long n2) {
+  inline int compare(unsigned long n, unsigned long n2) {
     return compare_unsigned_long(n, n2);
   }
 
   template<>
-  int compare(unsigned long long n, unsigned long long n2) {
+  inline int compare(unsigned long long n, unsigned long long n2) {
     return compare_unsigned_long(n, n2);
   }
 
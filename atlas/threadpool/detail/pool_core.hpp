@@ -25,6 +25,7 @@
 
 #include <vector>
 #include <map>
+#include <iostream>
 #include <atomic>
 #include <memory>
 #include <thread>
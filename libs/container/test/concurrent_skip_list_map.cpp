@@ -0,0 +1,118 @@
+/*
+ * concurrent_skip_list_map.cpp
+ *
+ *  Created on: Nov 5, 2013
+ *      Author: vincent
+ */
+
+// atlas::concurrent_skip_list_map : the map operations against std::map, then counters updated
+// in place by several threads while another one keeps inserting and erasing other keys.
+
+#include <map>
+#include <string>
+#include <vector>
+#include <thread>
+#include <random>
+#include <atomic>
+#include <iostream>
+
+#include <atlas/container/concurrenct_skip_list.h>
+
+typedef atlas::concurrent_skip_list_map<int, std::string> string_map;
+typedef atlas::concurrent_skip_list_map<int, long> counter_map;
+
+int check_against_std_map() {
+  int failures = 0;
+
+  auto accessor = string_map::create();
+  std::map<int, std::string> expected;
+
+  std::mt19937 rng(7);
+  for (int i = 0; i < 20000; ++i) {
+    int key = rng() % 1000;
+    std::string value = std::to_string(i);
+
+    switch (rng() % 4) {
+    case 0:
+      if (accessor.emplace(key, value).second != expected.emplace(key, value).second) ++failures;
+      break;
+    case 1:
+      if (accessor.insert_or_assign(key, value).second != (expected.count(key) == 0)) ++failures;
+      expected[key] = value;
+      break;
+    case 2:
+      if (accessor.compute_if_present(key, [&value](std::string& v) { v += value; }) != (expected.count(key) > 0)) ++failures;
+      if (expected.count(key)) expected[key] += value;
+      break;
+    default:
+      if (accessor.erase(key) != expected.erase(key)) ++failures;
+      break;
+    }
+  }
+
+  if (accessor.size() != expected.size()) ++failures;
+
+  // ordered like the std::map
+  auto it = expected.begin();
+  for (const auto& entry : accessor) {
+    if (it == expected.end() || entry.first != it->first || entry.second != it->second) ++failures;
+    ++it;
+  }
+  if (it != expected.end()) ++failures;
+
+  std::string value;
+  if (!expected.empty() && (!accessor.get(expected.begin()->first, value) || value != expected.begin()->second)) ++failures;
+  if (accessor.get(-1, value) || accessor.find(-1) != accessor.end()) ++failures;
+
+  return failures;
+}
+
+int check_concurrent_updates() {
+  int failures = 0;
+
+  const int keys = 64;
+  const int threads = 4;
+  const int rounds = 100000;
+
+  auto accessor = counter_map::create();
+  for (int k = 0; k < keys; ++k) accessor.emplace(k, 0L);
+
+  // one Accessor shared by all the threads
+  std::atomic<bool> stop(false);
+  std::thread churn([&accessor, &stop]() {
+    for (int i = 0; !stop.load(std::memory_order_relaxed); ++i) {
+      int key = 1000 + i % 512;
+      if (i % 3 == 2) accessor.erase(key);
+      else accessor.insert_or_assign(key, long(i));
+    }
+  });
+
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([&accessor, t]() {
+      for (int i = 0; i < rounds; ++i) accessor.compute_if_present((i + t) % keys, [](long& v) { ++v; });
+    });
+  }
+  for (std::thread& t : workers) t.join();
+
+  stop = true;
+  churn.join();
+
+  long total = 0, value = 0;
+  for (int k = 0; k < keys; ++k) {
+    if (!accessor.get(k, value)) ++failures;
+    total += value;
+  }
+  if (total != long(threads) * rounds) ++failures;
+
+  std::cout << threads << " threads : " << total << " increments in place, " << accessor.size() << " keys" << std::endl;
+
+  return failures;
+}
+
+int main() {
+  int failures = check_against_std_map() + check_concurrent_updates();
+
+  std::cout << (failures ? "FAIL" : "PASS") << std::endl;
+  return failures;
+}
@@ -0,0 +1,189 @@
+/*
+ * epoch.cpp
+ *
+ *  Created on: Nov 6, 2013
+ *      Author: vincent
+ */
+
+// atlas::epoch_domain under a concurrent_skip_list : threads insert, erase and look up keys with
+// short lived Accessors, the removed nodes must be freed while they run and the live nodes stay
+// bounded, and all of them must be freed once the threads and the list are gone. Then one Accessor
+// is shared by threads, and copies of it are made and destroyed by other threads. Last, a map
+// Accessor kept alive through the churn does not hold back the reclamation.
+
+#include <thread>
+#include <random>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <iostream>
+
+#include <atlas/container/concurrenct_skip_list.h>
+
+typedef std::chrono::steady_clock clock_type;
+
+std::atomic<long> live(0);
+
+struct counted {
+  counted() : key(0) { ++live; }
+  counted(int k) : key(k) { ++live; }
+  counted(const counted& c) : key(c.key) { ++live; }
+  ~counted() { --live; }
+
+  bool operator<(const counted& c) const { return key < c.key; }
+
+  int key;
+};
+
+typedef atlas::concurrent_skip_list<counted> skip_list_type;
+
+int main() {
+  int failures = 0;
+
+  const int threads = 4;
+  const int keys = 4096;
+  auto run_for = std::chrono::milliseconds(1500);
+
+  atlas::epoch_domain& domain = atlas::epoch_domain::ref();
+  atlas::epoch_stats before = domain.stats();
+
+  long max_live = 0;
+  uint64_t operations = 0;
+  {
+    auto sl = skip_list_type::createInstance();
+
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> done(0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+      workers.emplace_back([sl, t, &stop, &done]() {
+        std::mt19937 rng(t);
+        uint64_t n = 0;
+        while (!stop.load(std::memory_order_relaxed)) {
+          skip_list_type::Accessor accessor(sl);
+          for (int i = 0; i < 64; ++i, ++n) {
+            counted c(rng() % keys);
+            switch (rng() % 3) {
+            case 0: accessor.insert(c); break;
+            case 1: accessor.erase(c); break;
+            default: accessor.contains(c); break;
+            }
+          }
+        }
+        done += n;
+      });
+    }
+
+    // the removed nodes are freed on the way, live counts the nodes in the list and those pending
+    auto start = clock_type::now();
+    while (clock_type::now() - start < run_for) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      long l = live.load();
+      if (l > max_live) max_live = l;
+    }
+    atlas::epoch_stats during = domain.stats();
+
+    stop = true;
+    for (std::thread& t : workers) t.join();
+    operations = done;
+
+    if (during.reclaimed == before.reclaimed || during.epoch == before.epoch) ++failures;
+    if (max_live > keys + long(atlas::epoch_domain::high_watermark)) ++failures;
+  }
+
+  // the exited threads handed their bags over, the collector frees them
+  auto start = clock_type::now();
+  atlas::epoch_stats after = domain.stats();
+  while (after.reclaimed != after.retired && clock_type::now() - start < std::chrono::seconds(5)) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    after = domain.stats();
+  }
+  if (after.reclaimed != after.retired || live != 0) ++failures;
+
+  // an Accessor shared by threads, its copies destroyed by other threads, keeps the nodes it reaches
+  {
+    auto sl = skip_list_type::createInstance();
+    skip_list_type::Accessor shared(sl);
+    for (int k = 0; k < keys; ++k) shared.insert(counted(k));
+
+    std::atomic<bool> stop(false);
+    std::atomic<long> seen(0), bad(0);
+    std::vector<std::thread> users;
+    for (int t = 0; t < threads; ++t) {
+      users.emplace_back([&shared, t, &stop, &seen, &bad]() {
+        std::mt19937 rng(t);
+        while (!stop.load(std::memory_order_relaxed)) {
+          if (t == 0) {
+            counted c(rng() % keys);
+            if (rng() % 2) shared.erase(c);
+            else shared.insert(c);
+            continue;
+          }
+
+          // read through the shared Accessor, the erased nodes are not freed under the reader
+          long n = 0;
+          for (auto it = shared.begin(); it != shared.end() && n < 256; ++it, ++n) {
+            if (it->key < 0 || it->key >= keys) ++bad;
+          }
+          seen += n;
+        }
+      });
+    }
+
+    // copies made here, handed to other threads and destroyed there
+    for (int i = 0; i < 200; ++i) {
+      skip_list_type::Accessor* copy = new skip_list_type::Accessor(shared);
+      std::thread([copy]() {
+        copy->contains(counted(1));
+        delete copy;
+      }).join();
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    stop = true;
+    for (std::thread& t : users) t.join();
+
+    if (seen == 0 || bad != 0) ++failures;
+  }
+
+  // the shared Accessor is gone, the nodes removed meanwhile are freed, with the old heads
+  // retired by this thread while it filled the list
+  atlas::epoch_domain::flush();
+  start = clock_type::now();
+  after = domain.stats();
+  while ((after.reclaimed != after.retired || live != 0) && clock_type::now() - start < std::chrono::seconds(5)) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    after = domain.stats();
+  }
+  if (after.reclaimed != after.retired || live != 0) ++failures;
+
+  // the Accessor lives on, the erased entries are freed anyway
+  uint64_t churned = 0;
+  {
+    auto accessor = atlas::concurrent_skip_list_map<int, counted>::create();
+    atlas::epoch_stats start_stats = domain.stats();
+
+    for (int i = 0; i < 100000; ++i) {
+      accessor.emplace(i % keys, i);
+      accessor.erase(i % keys);
+    }
+    atlas::epoch_domain::flush();
+
+    start = clock_type::now();
+    after = domain.stats();
+    while (after.reclaimed != after.retired && clock_type::now() - start < std::chrono::seconds(5)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      after = domain.stats();
+    }
+    churned = after.reclaimed - start_stats.reclaimed;
+
+    if (after.reclaimed != after.retired || churned < 100000) ++failures;
+  }
+
+  std::cout << churned << " entries erased under a live Accessor are freed" << std::endl;
+  std::cout << threads << " threads : " << operations << " operations, " << after.retired - before.retired
+      << " nodes retired, at most " << max_live << " live, epoch " << after.epoch << std::endl;
+
+  std::cout << (failures ? "FAIL" : "PASS") << std::endl;
+  return failures;
+}
@@ -0,0 +1,132 @@
+/*
+ * flat_map128.cpp
+ *
+ *  Created on: Oct 31, 2013
+ *      Author: vincent
+ */
+
+// atlas::flat_map128 against std::map under random inserts and erases, then a session table
+// benchmark : N live uuid keys, every round inserts a new session and erases the oldest one,
+// like the task managers do, for flat_map128, std::map and std::unordered_map.
+// Build with <variant>release for meaningful numbers.
+
+#include <map>
+#include <deque>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <unordered_map>
+
+#include <boost/uuid/uuid.hpp>
+#include <boost/uuid/random_generator.hpp>
+
+#include <atlas/container/flat_map128.h>
+
+using boost::uuids::uuid;
+
+typedef std::chrono::steady_clock clock_type;
+
+struct uuid_hash {
+  size_t operator()(const uuid& id) const { return atlas::hash128<uuid>()(id); }
+};
+
+std::vector<uuid> make_keys(size_t n) {
+  boost::uuids::random_generator gen;
+
+  std::vector<uuid> keys;
+  keys.reserve(n);
+  for (size_t i = 0; i < n; ++i) keys.push_back(gen());
+
+  return keys;
+}
+
+int check() {
+  int failures = 0;
+
+  std::vector<uuid> keys = make_keys(20000);
+  std::mt19937 rng(3);
+
+  atlas::flat_map128<uuid, int> flat;
+  std::map<uuid, int> ref;
+
+  for (int round = 0; round < 200000; ++round) {
+    const uuid& k = keys[rng() % keys.size()];
+
+    switch (rng() % 3) {
+    case 0:
+    case 1:
+      if (flat.emplace(k, round).second != ref.insert(std::make_pair(k, round)).second) ++failures;
+      break;
+    default:
+      if (flat.erase(k) != ref.erase(k)) ++failures;
+      break;
+    }
+  }
+
+  if (flat.size() != ref.size()) ++failures;
+
+  size_t seen = 0;
+  for (const auto& kv : flat) {
+    auto it = ref.find(kv.first);
+    if (it == ref.end() || it->second != kv.second) ++failures;
+    ++seen;
+  }
+  if (seen != ref.size()) ++failures;
+
+  for (const uuid& k : keys) {
+    if (flat.count(k) != ref.count(k)) ++failures;
+  }
+
+  // erase everything through find, the table must end up empty
+  for (const uuid& k : keys) {
+    auto it = flat.find(k);
+    if (it != flat.end()) flat.erase(it);
+  }
+  if (!flat.empty() || flat.begin() != flat.end()) ++failures;
+
+  return failures;
+}
+
+// the ns per round of : insert a new key, find it, erase the oldest live key
+template<typename Map>
+double churn(size_t live, const std::vector<uuid>& keys) {
+  Map map;
+  for (size_t i = 0; i < live; ++i) map.insert(std::make_pair(keys[i], static_cast<int>(i)));
+
+  const size_t rounds = 1000000;
+  size_t oldest = 0, next = live, hits = 0;
+
+  auto start = clock_type::now();
+  for (size_t r = 0; r < rounds; ++r) {
+    const uuid& k = keys[next++ % keys.size()];
+    map.insert(std::make_pair(k, static_cast<int>(r)));
+    hits += map.count(k);
+    map.erase(keys[oldest++ % keys.size()]);
+  }
+  double ns = std::chrono::duration<double, std::nano>(clock_type::now() - start).count() / rounds;
+
+  return hits == rounds ? ns : -1;
+}
+
+int main() {
+  int failures = check();
+
+  std::cout << std::setw(10) << "live" << std::setw(14) << "flat_map128" << std::setw(14) << "std::map"
+      << std::setw(20) << "std::unordered_map" << "   ns per insert + find + erase" << std::endl;
+
+  for (size_t live : { size_t(1000), size_t(10000), size_t(100000), size_t(1000000) }) {
+    // the keys cycle, so the ring of keys must be longer than the live set plus the rounds
+    std::vector<uuid> keys = make_keys(live + 1000000);
+
+    std::cout << std::setw(10) << live << std::fixed << std::setprecision(1)
+        << std::setw(14) << churn<atlas::flat_map128<uuid, int>>(live, keys)
+        << std::setw(14) << churn<std::map<uuid, int>>(live, keys)
+        << std::setw(20) << churn<std::unordered_map<uuid, int, uuid_hash>>(live, keys) << std::endl;
+  }
+
+  std::cout << (failures ? "FAIL" : "PASS") << std::endl;
+  return failures ? 1 : 0;
+}
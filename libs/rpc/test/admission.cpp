@@ -0,0 +1,157 @@
+/*
+ * admission.cpp
+ *
+ *  Created on: Oct 29, 2013
+ *      Author: vincent
+ */
+
+// atlas::rpc::admission_control on a remote_caller : a full window rejects or blocks the calls
+// until a session completes, the token bucket limits the call rate. A callback never blocks,
+// its calls are rejected on the response thread.
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <iostream>
+#include <cstdlib>
+
+#include <atlas/rpc.h>
+#include <atlas/rpc/loopback.h>
+
+using namespace atlas::rpc;
+
+struct service {
+  static rpc_result echo(int a, const rpc_context&) { return rpc_result(std::to_string(a)); }
+};
+
+namespace admission_test {
+  ATLAS_REGISTER_REMOTE_FUNC(echo, 3301);
+  ATLAS_BIND_REMOTE_FUNC(echo, service::echo);
+}
+
+// a destination which never answers, the sessions stay open until completed by hand
+class silent_caller : public remote_caller {
+protected:
+  virtual void send(const char*, size_t) {}
+};
+
+int main() {
+  int failures = 0;
+
+  std::atomic<int> ok(0), rejected(0);
+  rpc_callback_type count = [&](const std::string&, int err, async_task&) {
+    if (err == rpc_rejected) ++rejected;
+    else if (err == 0) ++ok;
+  };
+
+  // reject : the fifth call finds the window full
+  {
+    silent_caller caller;
+    std::shared_ptr<admission_control> control = std::make_shared<admission_control>(4, admission_control::reject);
+    caller.set_admission(control);
+
+    std::vector<uuid> sessions;
+    for (int i = 0; i < 5; ++i) {
+      caller.call(service::echo, admission_test::fn_ids::echo, count, i, nilctx);
+      sessions.push_back(caller.session_id());
+    }
+
+    if (rejected != 1 || control->stats().in_flight != 4 || control->stats().rejected != 1) ++failures;
+
+    // a completed session frees its slot
+    async_task_manager::ref().resume(sessions[0], "0");
+    if (control->stats().in_flight != 3) ++failures;
+
+    rpc_future<rpc_result> f = caller.async_call(service::echo, admission_test::fn_ids::echo, 5, nilctx);
+    if (f.ready() || control->stats().in_flight != 4) ++failures;
+
+    // so does a cancelled or discarded one
+    async_task_manager::ref().cancel(sessions[1]);
+    async_task_manager::ref().discard(sessions[2]);
+    if (control->stats().in_flight != 2) ++failures;
+
+    for (int i = 3; i < 5; ++i) async_task_manager::ref().resume(sessions[i], "");
+    async_task_manager::ref().resume(caller.session_id(), "5");
+    if (control->stats().in_flight != 0 || !f.ready() || f.get().data() != "5") ++failures;
+  }
+
+  // block : the caller waits for a slot, bounded by its timeout
+  {
+    silent_caller caller;
+    std::shared_ptr<admission_control> control = std::make_shared<admission_control>(1, admission_control::block);
+    caller.set_admission(control);
+
+    caller.call(service::echo, admission_test::fn_ids::echo, count, 1, nilctx);
+    uuid first = caller.session_id();
+
+    std::thread releaser([&control, first]() {
+      while (control->stats().waiting == 0) std::this_thread::yield();
+      async_task_manager::ref().resume(first, "1");
+    });
+
+    caller.call(service::echo, admission_test::fn_ids::echo, count, 2, nilctx);
+    releaser.join();
+    if (control->stats().admitted != 2 || control->stats().in_flight != 1) ++failures;
+
+    caller.set_timeout(std::chrono::milliseconds(20));
+    rpc_result r = caller.sync_call(service::echo, admission_test::fn_ids::echo, 3, nilctx);
+    if (!r || r.err() != rpc_rejected) ++failures;
+
+    async_task_manager::ref().resume(caller.session_id(), "2");
+    if (control->stats().in_flight != 0) ++failures;
+  }
+
+  // block, from a callback : the response thread would wait for itself, the call is rejected
+  {
+    silent_caller caller;
+    std::shared_ptr<admission_control> control = std::make_shared<admission_control>(1, admission_control::block);
+    caller.set_admission(control);
+
+    caller.call(service::echo, admission_test::fn_ids::echo, count, 1, nilctx);
+    uuid first = caller.session_id();
+
+    std::atomic<int> inner_err(1);
+    rpc_callback_type inner = [&inner_err](const std::string&, int err, async_task&) { inner_err = err; };
+    rpc_callback_type outer = [&caller, &inner](const std::string&, int, async_task&) {
+      caller.call(service::echo, admission_test::fn_ids::echo, inner, 2, nilctx);
+    };
+
+    loopback_transport transport;
+    transport.client().call(service::echo, admission_test::fn_ids::echo, outer, 1, nilctx);
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (inner_err == 1 && std::chrono::steady_clock::now() < deadline) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if (inner_err == 1) {
+      std::cout << "FAILED : a callback blocks on the admission" << std::endl;
+      std::_Exit(1);
+    }
+    if (inner_err != rpc_rejected) ++failures;
+
+    async_task_manager::ref().resume(first, "1");
+    if (control->stats().in_flight != 0) ++failures;
+  }
+
+  // rate : a burst of 10, then 1000 calls per second
+  {
+    silent_caller caller;
+    std::shared_ptr<admission_control> control = std::make_shared<admission_control>(0, admission_control::reject);
+    control->set_rate_limit(1000, 10);
+    caller.set_admission(control);
+
+    rejected = 0;
+    for (int i = 0; i < 20; ++i) caller.call(service::echo, admission_test::fn_ids::echo, count, i, nilctx);
+    if (rejected < 9) ++failures;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    admission_stats before = control->stats();
+    caller.call(service::echo, admission_test::fn_ids::echo, count, 0, nilctx);
+    if (control->stats().admitted != before.admitted + 1) ++failures;
+
+    async_task_manager::ref().clear();
+  }
+
+  std::cout << (failures ? "FAIL" : "PASS") << std::endl;
+  return failures ? 1 : 0;
+}
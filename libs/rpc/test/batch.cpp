@@ -0,0 +1,231 @@
+/*
+ * batch.cpp
+ *
+ *  Created on: Nov 7, 2013
+ *      Author: vincent
+ */
+
+// Batched calls : over a loopback transport the calls wait for flush(), the size threshold or
+// flush_if_expired(), and are answered in order. A batch is then executed directly, nested in
+// another one, and with malformed lengths, which throw, like a frame shorter than a header. The
+// responses of a caller are batched by several threads at once.
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <stdexcept>
+#include <iostream>
+
+#include <atlas/rpc.h>
+#include <atlas/rpc/loopback.h>
+
+using namespace atlas::rpc;
+
+typedef std::chrono::steady_clock clock_type;
+
+struct service {
+  static rpc_result echo(int i, const rpc_context& c) { return rpc_result(std::to_string(i)); }
+};
+
+namespace batch_test {
+  ATLAS_REGISTER_REMOTE_FUNC(echo, 4101);
+  ATLAS_BIND_REMOTE_FUNC(echo, service::echo);
+}
+
+static int failures = 0;
+
+void check(bool ok, const char* what) {
+  if (!ok) {
+    ++failures;
+    std::cout << "FAILED : " << what << std::endl;
+  }
+}
+
+template<typename F>
+bool wait_for(F ready) {
+  auto start = clock_type::now();
+  while (!ready() && clock_type::now() - start < std::chrono::seconds(5)) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  return ready();
+}
+
+// keeps the frames it sends
+class recording_caller : public remote_caller {
+public:
+
+  std::vector<std::string> frames;
+
+protected:
+
+  virtual void send(const char* message, size_t size) {
+    std::lock_guard<std::mutex> guard(_mutex);
+    frames.push_back(std::string(message, size));
+  }
+
+private:
+
+  std::mutex _mutex;
+};
+
+// a call frame of echo(i) which expects a response
+std::string call_frame(int i) {
+  message_builder builder(7);
+  builder.set_return_type(rpc_async_callback);
+
+  return builder.build(service::echo, batch_test::fn_ids::echo, i, nilctx);
+}
+
+std::string batch_frame(const std::vector<std::string>& frames) {
+  message_buffer buffer;
+  for (const std::string& f : frames) buffer.append(f.data(), f.size());
+  buffer.set_header(message::make_header(fn_ids::batch, nil_uuid()));
+
+  return buffer.str();
+}
+
+bool throws_out_of_range(const std::string& frame) {
+  recording_caller responder;
+  try {
+    dispatcher_manager::ref().execute(responder, message_view(frame), "test");
+  }
+  catch (const std::out_of_range&) {
+    return true;
+  }
+
+  return false;
+}
+
+void check_transport() {
+  loopback_transport transport;
+  remote_caller& client = transport.client();
+
+  std::mutex mutex;
+  std::vector<std::string> answers;
+  rpc_callback_type cb = [&mutex, &answers](const std::string& r, int err, async_task&) {
+    std::lock_guard<std::mutex> guard(mutex);
+    answers.push_back(err ? "error" : r);
+  };
+  auto answered = [&mutex, &answers]() {
+    std::lock_guard<std::mutex> guard(mutex);
+    return answers.size();
+  };
+
+  // nothing is sent before the flush
+  client.enable_batching(1 << 20, std::chrono::seconds(10));
+  for (int i = 0; i < 10; ++i) client.call(service::echo, batch_test::fn_ids::echo, cb, i, nilctx);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  check(client.pending_calls() == 10 && transport.requests_served() == 0, "the calls wait for the flush");
+  check(client.next_flush_deadline() > clock_type::now() + std::chrono::seconds(5), "the flush deadline");
+
+  client.flush();
+  check(wait_for([&]() { return answered() == 10; }), "the batch is answered");
+  check(transport.requests_served() == 1 && client.pending_calls() == 0, "one frame for the batch");
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    bool ordered = true;
+    for (int i = 0; i < 10; ++i) ordered = ordered && answers[i] == std::to_string(i);
+    check(ordered, "the answers are in order");
+  }
+
+  // the size threshold sends the batch
+  client.enable_batching(256, std::chrono::seconds(10));
+  int calls = 0;
+  while (client.pending_calls() > 0 || calls == 0) {
+    client.call(service::echo, batch_test::fn_ids::echo, cb, 100 + calls++, nilctx);
+  }
+  check(calls > 1 && wait_for([&]() { return answered() == 10u + calls; }), "the size threshold flushes");
+
+  // a lone call is sent by flush_if_expired() past the delay only
+  client.enable_batching(1 << 20, std::chrono::milliseconds(20));
+  client.call(service::echo, batch_test::fn_ids::echo, cb, 1000, nilctx);
+  check(!client.flush_if_expired(), "not expired yet");
+
+  std::this_thread::sleep_until(client.next_flush_deadline());
+  check(client.flush_if_expired() && client.next_flush_deadline() == clock_type::time_point::max(), "expired");
+  check(wait_for([&]() { return answered() == 11u + calls; }), "the lone call is answered");
+
+  client.disable_batching();
+}
+
+void check_execute_batch() {
+  // a nested batch is executed in order like the others
+  std::string inner = batch_frame({ call_frame(2), call_frame(3) });
+  std::string outer = batch_frame({ call_frame(1), inner, call_frame(4) });
+
+  recording_caller responder;
+  dispatcher_manager::ref().execute(responder, message_view(outer), "test");
+
+  check(responder.frames.size() == 4, "every call of the nested batches is answered");
+  for (size_t i = 0; i < responder.frames.size() && i < 4; ++i) {
+    message_view response(responder.frames[i]);
+    std::string data(response.body() + sizeof(int32_t), response.body_size() - sizeof(int32_t));
+    check((response.header()->flags & flag_response) && data == std::to_string(i + 1), "a response of the batch");
+  }
+
+  // an inner length past the end of the batch, shorter than a header, or a truncated header
+  std::string frame = call_frame(1);
+  std::string bad = batch_frame({ frame });
+  reinterpret_cast<request_header*>(&bad[message::request_header_size])->length = static_cast<int32_t>(frame.size() + 1);
+  check(throws_out_of_range(bad), "inner length past the end");
+
+  reinterpret_cast<request_header*>(&bad[message::request_header_size])->length = 4;
+  check(throws_out_of_range(bad), "inner length shorter than a header");
+
+  check(throws_out_of_range(batch_frame({ frame.substr(0, 5) })), "truncated inner header");
+  check(throws_out_of_range(frame.substr(0, 5)), "frame shorter than a header");
+
+  // the length of a nested batch is checked against the outer one
+  std::string nested = batch_frame({ batch_frame({ frame }) });
+  reinterpret_cast<request_header*>(&nested[message::request_header_size])->length += 1;
+  check(throws_out_of_range(nested), "nested batch length past the end");
+}
+
+void check_concurrent_responses() {
+  // the responses of one caller are batched and compressed by several threads at once
+  recording_caller responder;
+  responder.enable_batching(4096, std::chrono::seconds(10));
+  responder.enable_compression(64);
+
+  const int threads = 4, responses = 2000;
+  std::vector<std::thread> senders;
+  for (int t = 0; t < threads; ++t) {
+    senders.emplace_back([&responder, t]() {
+      for (int i = 0; i < responses; ++i) {
+        std::string data = (i % 2) ? std::string(200, static_cast<char>('a' + t)) : std::to_string(i);
+        responder.send_response(rpc_async_callback, nil_uuid(), rpc_result(data));
+      }
+    });
+  }
+  for (std::thread& t : senders) t.join();
+  responder.flush();
+
+  size_t count = 0;
+  bool intact = true;
+  for (const std::string& frame : responder.frames) {
+    message_view batch(frame);
+    intact = intact && batch.header()->fn_id == fn_ids::batch && static_cast<size_t>(batch.header()->length) == frame.size();
+
+    const char* p = batch.body();
+    const char* end = p + batch.body_size();
+    while (intact && p < end) {
+      message_view response(p, reinterpret_cast<const request_header*>(p)->length);
+      intact = (response.header()->flags & flag_response) && response.body_size() >= sizeof(int32_t)
+          && response.body() + response.body_size() <= end;
+      p = response.body() + response.body_size();
+      ++count;
+    }
+  }
+  check(intact && count == static_cast<size_t>(threads * responses), "responses batched by several threads");
+}
+
+int main() {
+  check_transport();
+  check_execute_batch();
+  check_concurrent_responses();
+
+  std::cout << (failures ? "FAIL" : "PASS") << std::endl;
+  return failures;
+}
@@ -0,0 +1,103 @@
+/*
+ * capture.cpp
+ *
+ *  Created on: Nov 1, 2013
+ *      Author: vincent
+ */
+
+// atlas::rpc::capture_tap : the calls through a loopback_transport are captured on both sides,
+// then replayed through the dispatcher at max speed and at 10x.
+
+#include <string>
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+
+#include <atlas/rpc.h>
+#include <atlas/rpc/loopback.h>
+#include <atlas/rpc/replay.h>
+
+using namespace atlas::rpc;
+
+std::atomic<int> served(0);
+
+struct service {
+  static rpc_result echo(const std::string& s, const rpc_context&) {
+    ++served;
+    return rpc_result(s);
+  }
+};
+
+namespace capture_test {
+  ATLAS_REGISTER_REMOTE_FUNC(echo, 3301);
+  ATLAS_BIND_REMOTE_FUNC(echo, service::echo);
+}
+
+int main() {
+  int failures = 0;
+  const std::string path = "capture_test.cap";
+  const int calls = 200;
+
+  capture_tap::ref().start(path);
+  {
+    loopback_transport transport;
+    remote_caller& caller = transport.client();
+    caller.set_timeout(std::chrono::milliseconds(5000));
+
+    for (int i = 0; i < calls; ++i) {
+      rpc_result r = caller.sync_call(service::echo, capture_test::fn_ids::echo, std::to_string(i), nilctx);
+      if (!r || r.err() != 0) ++failures;
+    }
+  }
+  capture_tap::ref().stop();
+
+  // every request and response, once sent and once received
+  if (capture_tap::ref().records() != 4 * calls) ++failures;
+  if (served != calls) ++failures;
+
+  int requests = 0, responses = 0;
+  {
+    capture_reader reader(path);
+    captured_message m;
+    uint64_t last = 0;
+    while (reader.next(m)) {
+      const request_header* h = reinterpret_cast<const request_header*>(m.frame.data());
+      if (static_cast<size_t>(h->length) != m.frame.size() || m.time_ns < last) ++failures;
+      last = m.time_ns;
+
+      if (h->flags & flag_response) ++responses;
+      else if (h->fn_id == capture_test::fn_ids::echo) ++requests;
+    }
+  }
+  if (requests != 2 * calls || responses != 2 * calls) ++failures;
+
+  replay_options options;
+  options.speed = 0;
+  replay_report report = capture_replayer(options).run(path);
+  if (served != 2 * calls || report.executed != static_cast<uint64_t>(calls) || report.skipped != 3u * calls
+      || report.failed != 0 || report.responses != static_cast<uint64_t>(calls)) ++failures;
+
+  std::cout << "max : " << report.executed << " frames, " << static_cast<uint64_t>(report.throughput()) << " frames/s, p50 "
+      << report.latency_percentile_ns(0.5) << " ns, p99 " << report.latency_percentile_ns(0.99) << " ns" << std::endl;
+
+  // the requests the client sent, paced ten times faster than captured
+  options.speed = 10;
+  options.direction = captured_sent;
+  report = capture_replayer(options).run(path);
+  if (served != 3 * calls || report.executed != static_cast<uint64_t>(calls)) ++failures;
+
+  std::cout << "10x : " << report.executed << " frames in " << report.elapsed_ns / 1000 << " us, max lag "
+      << report.max_lag_ns << " ns" << std::endl;
+
+  try {
+    capture_reader reader("capture.cpp");
+    ++failures;
+  }
+  catch (const std::runtime_error&) {
+  }
+
+  std::remove(path.c_str());
+
+  std::cout << (failures ? "FAIL" : "PASS") << std::endl;
+  return failures;
+}
@@ -0,0 +1,111 @@
+/*
+ * compression.cpp
+ *
+ *  Created on: Oct 27, 2013
+ *      Author: vincent
+ */
+
+// atlas::rpc::lz_codec round trips and rejects corrupt input, and compressed calls go through a
+// loopback_transport. Prints the compression ratio and the time spent per function id.
+
+#include <string>
+#include <random>
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+
+#include <atlas/rpc.h>
+#include <atlas/rpc/loopback.h>
+
+using namespace atlas::rpc;
+
+struct service {
+  static rpc_result size_of(const std::string& s, const rpc_context&) { return rpc_result(std::to_string(s.size())); }
+};
+
+namespace compression_test {
+  ATLAS_REGISTER_REMOTE_FUNC(size_of, 3101);
+  ATLAS_BIND_REMOTE_FUNC(size_of, service::size_of);
+}
+
+// a payload looking like a serialized record set, compressible but not trivially
+std::string records(size_t n) {
+  std::mt19937 rng(7);
+  std::string s;
+  for (size_t i = 0; s.size() < n; ++i) {
+    s += "{\"id\":" + std::to_string(i) + ",\"name\":\"user" + std::to_string(rng() % 1000) + "\",\"active\":true}";
+  }
+  s.resize(n);
+  return s;
+}
+
+std::string noise(size_t n) {
+  std::mt19937 rng(11);
+  std::string s(n, '\0');
+  for (char& c : s) c = static_cast<char>(rng());
+  return s;
+}
+
+bool round_trip(const std::string& raw) {
+  std::string packed;
+  lz_codec::compress(raw.data(), raw.size(), packed);
+
+  std::string out(raw.size(), '\0');
+  lz_codec::decompress(packed.data(), packed.size(), &out[0], out.size());
+
+  return out == raw;
+}
+
+int main() {
+  int failures = 0;
+
+  const std::string inputs[] = { "", "a", "abcd", std::string(100000, 'x'), records(1 << 20), noise(70000) };
+  for (const std::string& raw : inputs) {
+    if (!round_trip(raw)) {
+      std::cout << "round trip of " << raw.size() << " bytes failed" << std::endl;
+      ++failures;
+    }
+  }
+
+  // every truncation of a valid stream must be rejected, not read out of bounds
+  {
+    std::string raw = records(4096), packed;
+    lz_codec::compress(raw.data(), raw.size(), packed);
+
+    std::string out(raw.size(), '\0');
+    for (size_t n = 0; n < packed.size(); ++n) {
+      try {
+        lz_codec::decompress(packed.data(), n, &out[0], out.size());
+        ++failures;
+      }
+      catch (const std::runtime_error&) {}
+    }
+  }
+
+  {
+    loopback_transport transport;
+    remote_caller& caller = transport.client();
+    caller.set_timeout(std::chrono::milliseconds(5000));
+    caller.enable_compression(1024);
+
+    for (size_t n : { size_t(100), size_t(64 * 1024), size_t(1 << 20) }) {
+      rpc_result r = caller.sync_call(service::size_of, compression_test::fn_ids::size_of, records(n), nilctx);
+      if (!r || r.err() != 0 || r.data() != std::to_string(n)) ++failures;
+    }
+
+    rpc_result r = caller.sync_call(service::size_of, compression_test::fn_ids::size_of, noise(8192), nilctx);
+    if (!r || r.err() != 0 || r.data() != "8192") ++failures;
+  }
+
+  auto stats = compression_stats::ref().snapshot();
+  const compression_counters& c = stats[compression_test::fn_ids::size_of];
+  if (c.compressed != 2 || c.incompressible != 1 || c.decompressed != 2) ++failures;
+
+  std::cout << "fn " << compression_test::fn_ids::size_of << " : " << c.compressed << " compressed, "
+      << c.incompressible << " incompressible, ratio " << std::fixed << std::setprecision(2) << c.ratio()
+      << ", " << std::setprecision(0) << (c.raw_bytes / 1048576.0) / (c.compress_ns / 1e9) << " MB/s compress, "
+      << c.decompress_ns << " ns decompress" << std::endl;
+
+  std::cout << (failures ? "FAIL" : "PASS") << std::endl;
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,151 @@
+/*
+ * future.cpp
+ *
+ *  Created on: Nov 7, 2013
+ *      Author: vincent
+ */
+
+// atlas::rpc::rpc_future : then() chains, when_all() and when_any() fan in, first on plain
+// promises, then on async calls over a loopback transport, where the errors and the timeouts
+// go through the chains like any other result.
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <stdexcept>
+#include <iostream>
+
+#include <atlas/rpc.h>
+#include <atlas/rpc/loopback.h>
+
+using namespace atlas::rpc;
+
+struct service {
+  static rpc_result echo(int i, const rpc_context& c) { return rpc_result(std::to_string(i)); }
+
+  static rpc_result fail(int err, const rpc_context& c) { return rpc_result("failed", err); }
+
+  static rpc_result sleep(int ms, const rpc_context& c) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    return rpc_result(std::to_string(ms));
+  }
+};
+
+namespace future_test {
+  ATLAS_REGISTER_REMOTE_FUNC(echo, 4301);
+  ATLAS_REGISTER_REMOTE_FUNC(fail, 4302);
+  ATLAS_REGISTER_REMOTE_FUNC(sleep, 4303);
+  ATLAS_BIND_REMOTE_FUNC(echo, service::echo);
+  ATLAS_BIND_REMOTE_FUNC(fail, service::fail);
+  ATLAS_BIND_REMOTE_FUNC(sleep, service::sleep);
+}
+
+static int failures = 0;
+
+void check(bool ok, const char* what) {
+  if (!ok) {
+    ++failures;
+    std::cout << "FAILED : " << what << std::endl;
+  }
+}
+
+void check_promises() {
+  // a chain set up before the value, and one after
+  rpc_promise<int> p;
+  rpc_future<std::string> chained = p.get_future().then([](int v) { return v * 2; }).then([](int v) { return std::to_string(v); });
+  check(!chained.ready(), "not ready before the value");
+
+  check(p.set_value(21) && !p.set_value(0), "the first value wins");
+  check(chained.ready() && chained.get() == "42", "then chain");
+  check(p.get_future().then([](int v) { return v + 1; }).get() == 22, "then on a ready future");
+
+  // fan in, in the order of the futures whatever the order of the values
+  std::vector<rpc_promise<int>> promises(3);
+  std::vector<rpc_future<int>> futures;
+  for (auto& promise : promises) futures.push_back(promise.get_future());
+
+  rpc_future<std::vector<int>> all = when_all(futures);
+  rpc_future<std::pair<size_t, int>> any = when_any(futures);
+
+  promises[2].set_value(3);
+  check(any.ready() && any.get().first == 2 && any.get().second == 3, "when_any takes the first value");
+  check(!all.ready(), "when_all waits for all");
+
+  promises[0].set_value(1);
+  promises[1].set_value(2);
+  check(all.ready() && all.get() == std::vector<int>({ 1, 2, 3 }), "when_all in order");
+  check(any.get().first == 2, "when_any is not changed by the later values");
+
+  check(when_all(std::vector<rpc_future<int>>()).get().empty(), "when_all of nothing is ready");
+
+  bool thrown = false;
+  try {
+    when_any(std::vector<rpc_future<int>>());
+  }
+  catch (const std::invalid_argument&) {
+    thrown = true;
+  }
+  check(thrown, "when_any of nothing is rejected");
+
+  // completed from another thread
+  rpc_promise<int> later;
+  std::thread setter([later]() mutable {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    later.set_value(7);
+  });
+  check(!later.get_future().wait_for(std::chrono::milliseconds(0)) && later.get_future().get() == 7, "wait for another thread");
+  setter.join();
+}
+
+void check_calls() {
+  loopback_transport transport;
+  remote_caller& client = transport.client();
+
+  // a chain of calls, the next one is issued by the response thread through another caller
+  loopback_transport other;
+  rpc_future<rpc_future<rpc_result>> nested = client.async_call(service::echo, future_test::fn_ids::echo, 5, nilctx)
+      .then([&other](const rpc_result& r) {
+        return other.client().async_call(service::echo, future_test::fn_ids::echo, std::stoi(r.data()) + 1, nilctx);
+      });
+  check(nested.get().get().data() == "6", "chained calls");
+
+  // the errors go through the chain
+  rpc_future<int> err = client.async_call(service::fail, future_test::fn_ids::fail, 42, nilctx)
+      .then([](const rpc_result& r) { return r.err(); });
+  check(err.get() == 42, "the error goes through then()");
+
+  // fan in of calls, one of them times out, the slow ones go to the other transport which serves
+  // one call at a time
+  client.set_timeout(std::chrono::milliseconds(20));
+  other.client().set_timeout(std::chrono::milliseconds(20));
+  std::vector<rpc_future<rpc_result>> futures;
+  futures.push_back(client.async_call(service::echo, future_test::fn_ids::echo, 1, nilctx));
+  futures.push_back(other.client().async_call(service::sleep, future_test::fn_ids::sleep, 200, nilctx));
+  futures.push_back(client.async_call(service::echo, future_test::fn_ids::echo, 3, nilctx));
+
+  std::vector<rpc_result> results = when_all(futures).get();
+  check(results.size() == 3 && results[0].data() == "1" && results[2].data() == "3", "when_all of calls");
+  check(results[1].err() == rpc_timeout, "the timeout goes through when_all");
+
+  // the fast call wins, the slow one times out later
+  futures.clear();
+  futures.push_back(other.client().async_call(service::sleep, future_test::fn_ids::sleep, 200, nilctx));
+  futures.push_back(client.async_call(service::echo, future_test::fn_ids::echo, 2, nilctx));
+  std::pair<size_t, rpc_result> first = when_any(futures).get();
+  check(first.first == 1 && first.second.data() == "2", "when_any of calls");
+
+  rpc_future<bool> timed_out = futures[0].then([](const rpc_result& r) { return r.err() == rpc_timeout; });
+  check(timed_out.get(), "the timeout goes through then()");
+
+  // wait for the late responses before the transports go
+  std::this_thread::sleep_for(std::chrono::milliseconds(450));
+}
+
+int main() {
+  check_promises();
+  check_calls();
+
+  std::cout << (failures ? "FAIL" : "PASS") << std::endl;
+  return failures;
+}
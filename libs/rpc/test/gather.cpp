@@ -0,0 +1,149 @@
+/*
+ * gather.cpp
+ *
+ *  Created on: Nov 7, 2013
+ *      Author: vincent
+ */
+
+// atlas::rpc::scatter_gather through remote_caller::gather_call() : the broadcast frames are
+// kept by the caller and the responses are delivered to the task manager by hand, for a quorum
+// below, equal to and above the expected responses, of 0 for all of them, with errors, and with
+// a timeout.
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iostream>
+
+#include <atlas/rpc.h>
+
+using namespace atlas::rpc;
+
+struct service {
+  static rpc_result count(int i, const rpc_context& c) { return rpc_result(std::to_string(i)); }
+};
+
+namespace gather_test {
+  ATLAS_REGISTER_REMOTE_FUNC(count, 4401);
+  ATLAS_BIND_REMOTE_FUNC(count, service::count);
+}
+
+// the frames go nowhere, the test answers them
+class broadcast_caller : public remote_caller {
+public:
+
+  explicit broadcast_caller(int response_expected = 1) : remote_caller(0, response_expected) {}
+
+protected:
+
+  virtual void send(const char*, size_t) {}
+};
+
+static int failures = 0;
+
+void check(bool ok, const char* what) {
+  if (!ok) {
+    ++failures;
+    std::cout << "FAILED : " << what << std::endl;
+  }
+}
+
+// sum the responses, the ones with an error count for nothing
+scatter_gather<int> summing(size_t quorum) {
+  return scatter_gather<int>(quorum, 0, [](int& acc, const std::string& data, int err) {
+    if (err == 0) acc += std::stoi(data);
+  });
+}
+
+int main() {
+  async_task_manager& tasks = async_task_manager::ref();
+
+  // quorum 2 of 3 : the second response completes, the third one is dropped
+  {
+    broadcast_caller caller;
+    auto f = caller.gather_call(summing(2), 3, service::count, gather_test::fn_ids::count, 0, nilctx);
+    uuid id = caller.session_id();
+
+    tasks.resume(id, "1");
+    check(!f.ready(), "quorum 2 : not after 1 response");
+    tasks.resume(id, "2");
+    check(f.ready() && f.get().value == 3 && f.get().responses == 2 && f.get().err == 0, "quorum 2 of 3");
+    check(tasks.size() == 0, "quorum 2 : the session ends with the quorum");
+    tasks.resume(id, "100");
+    check(f.get().value == 3, "quorum 2 : the third response is dropped");
+  }
+
+  // quorum 3 of 3
+  {
+    broadcast_caller caller;
+    auto f = caller.gather_call(summing(3), 3, service::count, gather_test::fn_ids::count, 0, nilctx);
+    uuid id = caller.session_id();
+
+    tasks.resume(id, "1");
+    tasks.resume(id, "2");
+    check(!f.ready(), "quorum 3 : not after 2 responses");
+    tasks.resume(id, "3");
+    check(f.ready() && f.get().value == 6 && f.get().responses == 3 && f.get().err == 0, "quorum 3 of 3");
+  }
+
+  // quorum 0 : all the expected responses, like for the task
+  {
+    broadcast_caller caller;
+    auto f = caller.gather_call(summing(0), 3, service::count, gather_test::fn_ids::count, 0, nilctx);
+    uuid id = caller.session_id();
+
+    tasks.resume(id, "1");
+    tasks.resume(id, "2");
+    check(!f.ready(), "quorum 0 : not after 2 of 3 responses");
+    tasks.resume(id, "3");
+    check(f.ready() && f.get().value == 6 && f.get().responses == 3 && f.get().err == 0, "quorum 0 of 3");
+    check(tasks.size() == 0, "quorum 0 : the session ends with the last response");
+  }
+
+  // quorum 5 of 3 : completed by the last response, short of the quorum
+  {
+    broadcast_caller caller;
+    auto f = caller.gather_call(summing(5), 3, service::count, gather_test::fn_ids::count, 0, nilctx);
+    uuid id = caller.session_id();
+
+    for (int i = 1; i <= 3; ++i) tasks.resume(id, std::to_string(i));
+    check(f.ready() && f.get().value == 6 && f.get().responses == 3 && f.get().err == rpc_no_quorum, "quorum 5 of 3");
+    check(tasks.size() == 0, "quorum 5 of 3 : the session is over");
+  }
+
+  // the caller expects 1 response by default, the quorum of 3 can not be reached
+  {
+    broadcast_caller caller;
+    auto f = caller.gather_call(summing(3), service::count, gather_test::fn_ids::count, 0, nilctx);
+
+    tasks.resume(caller.session_id(), "7");
+    check(f.ready() && f.get().responses == 1 && f.get().err == rpc_no_quorum, "quorum 3 of the caller default");
+  }
+
+  // the responses of the caller, with errors folded too
+  {
+    broadcast_caller caller(4);
+    auto f = caller.gather_call(summing(4), service::count, gather_test::fn_ids::count, 0, nilctx);
+    uuid id = caller.session_id();
+
+    tasks.resume(id, "1");
+    tasks.resume(id, "", 42);
+    tasks.resume(id, "3");
+    tasks.resume(id, "", 43);
+    check(f.ready() && f.get().value == 4 && f.get().responses == 4 && f.get().errors == 2 && f.get().err == 0, "reducer with errors");
+  }
+
+  // the timeout completes with the partial result
+  {
+    broadcast_caller caller;
+    caller.set_timeout(std::chrono::milliseconds(20));
+    auto f = caller.gather_call(summing(2), 3, service::count, gather_test::fn_ids::count, 0, nilctx);
+
+    tasks.resume(caller.session_id(), "5");
+    check(f.wait_for(std::chrono::seconds(5)), "timeout : completed");
+    check(f.get().value == 5 && f.get().responses == 1 && f.get().err == rpc_timeout, "timeout : partial result");
+  }
+
+  std::cout << (failures ? "FAIL" : "PASS") << std::endl;
+  return failures;
+}
@@ -0,0 +1,139 @@
+/*
+ * hedge.cpp
+ *
+ *  Created on: Nov 3, 2013
+ *      Author: vincent
+ */
+
+// atlas::rpc::hedged_caller : two loopback replicas, one of them 50ms late for the keys below 100.
+// The idempotent calls are answered by the fast one after the hedge delay, once each, the other
+// calls are not hedged. The hedged caller compresses the frames it builds.
+
+#include <string>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <iostream>
+
+#include <atlas/rpc.h>
+#include <atlas/rpc/loopback.h>
+#include <atlas/rpc/hedge.h>
+
+using namespace atlas::rpc;
+
+typedef std::chrono::steady_clock clock_type;
+
+std::atomic<int> served(0);
+
+struct service {
+  static rpc_result get(int key, const rpc_context& c) {
+    ++served;
+    if (key < 100 && c.source_ip_port() == "loopback:slow") std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    return rpc_result(std::to_string(key));
+  }
+
+  static rpc_result put(int key, const rpc_context& c) { return get(key, c); }
+
+  static rpc_result echo(const std::string& s, const rpc_context& c) { return rpc_result(s); }
+};
+
+namespace hedge_test {
+  ATLAS_REGISTER_TYPED_IDEMPOTENT_REMOTE_FUNC(get, 3401, rpc_result(int, const rpc_context&));
+  ATLAS_REGISTER_REMOTE_FUNC(put, 3402);
+  ATLAS_REGISTER_REMOTE_FUNC(echo, 3403);
+  ATLAS_BIND_REMOTE_FUNC(get, service::get);
+  ATLAS_BIND_REMOTE_FUNC(put, service::put);
+  ATLAS_BIND_REMOTE_FUNC(echo, service::echo);
+}
+
+int main() {
+  int failures = 0;
+  const int calls = 10;
+
+  if (!idempotent_functions::ref().contains(hedge_test::fn_ids::get) || idempotent_functions::ref().contains(hedge_test::fn_ids::put)) {
+    ++failures;
+  }
+
+  loopback_transport slow(1 << 20, "loopback:slow");
+  loopback_transport fast(1 << 20, "loopback:fast");
+  {
+    hedged_caller caller({ &slow.client(), &fast.client() });
+    caller.set_timeout(std::chrono::milliseconds(5000));
+    caller.set_hedge_delay(std::chrono::milliseconds(5));
+
+    // every other call goes to the slow replica first
+    std::atomic<int> answered(0);
+    auto start = clock_type::now();
+    for (int i = 0; i < calls; ++i) {
+      rpc_callback_type cb = [&answered, i](const std::string& r, int err, async_task&) {
+        if (err == 0 && r == std::to_string(i)) ++answered;
+      };
+      caller.call(service::get, hedge_test::fn_ids::get, cb, i, nilctx);
+    }
+    while (answered < calls && clock_type::now() - start < std::chrono::seconds(5)) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    auto elapsed = clock_type::now() - start;
+
+    hedge_stats s = caller.stats();
+    if (answered != calls || s.calls != static_cast<uint64_t>(calls) || s.hedged < calls / 2u) ++failures;
+    if (elapsed >= std::chrono::milliseconds(50 * calls / 2)) ++failures;
+
+    std::cout << "async : " << calls << " calls in " << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count()
+        << " ms, " << s.hedged << " hedged" << std::endl;
+
+    // the typed stub works through the hedged caller too
+    start = clock_type::now();
+    rpc_result r = hedge_test::fn_stubs::get::sync_call(caller, 7);
+    if (r.err() != 0 || r.data() != "7") ++failures;
+    r = hedge_test::fn_stubs::get::sync_call(caller, 8);
+    if (r.err() != 0 || r.data() != "8") ++failures;
+    if (clock_type::now() - start >= std::chrono::milliseconds(50)) ++failures;
+
+    // not idempotent, the slow replica answers
+    start = clock_type::now();
+    for (int i = 0; i < 2; ++i) {
+      r = caller.sync_call(service::put, hedge_test::fn_ids::put, i, nilctx);
+      if (r.err() != 0 || r.data() != std::to_string(i)) ++failures;
+    }
+    if (clock_type::now() - start < std::chrono::milliseconds(50) || caller.stats().not_idempotent != 2) ++failures;
+
+    // the delay follows the median of the answers, once both replicas are fast
+    if (caller.hedge_delay(hedge_test::fn_ids::get) != std::chrono::milliseconds(5)) ++failures;
+    caller.set_hedge_percentile(0.5);
+    for (int i = 0; i < 64; ++i) hedge_test::fn_stubs::get::async_call(caller, 100 + i).get();
+    auto delay = caller.hedge_delay(hedge_test::fn_ids::get);
+    if (delay >= std::chrono::milliseconds(5)) ++failures;
+
+    std::cout << "hedge delay after " << caller.stats().calls << " calls : "
+        << std::chrono::duration_cast<std::chrono::microseconds>(delay).count() << " us, "
+        << caller.stats().hedged << " hedged" << std::endl;
+
+    // wait for the late copies, they are dropped
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    if (async_task_manager::ref().size() != 0 || sync_task_manager::ref().size() != 0) ++failures;
+  }
+
+  // a budget of 0.01 allows no hedge for the first calls
+  {
+    hedged_caller caller({ &slow.client(), &fast.client() });
+    caller.set_hedge_delay(std::chrono::milliseconds(1));
+    caller.set_hedge_budget(0.01);
+
+    rpc_result r = hedge_test::fn_stubs::get::sync_call(caller, 1);
+    if (r.err() != 0 || caller.stats().hedged != 0 || caller.stats().over_budget != 1) ++failures;
+  }
+
+  // the hedged caller compresses its own frames, the setting of a target does not apply
+  {
+    hedged_caller caller({ &fast.client() });
+    caller.enable_compression(1024);
+
+    std::string big(16 * 1024, 'x');
+    rpc_result r = caller.sync_call(service::echo, hedge_test::fn_ids::echo, big, nilctx);
+    if (r.err() != 0 || r.data() != big) ++failures;
+    if (compression_stats::ref().snapshot()[hedge_test::fn_ids::echo].compressed != 1) ++failures;
+  }
+
+  std::cout << (failures ? "FAIL" : "PASS") << std::endl;
+  return failures;
+}
@@ -0,0 +1,156 @@
+/*
+ * loopback.cpp
+ *
+ *  Created on: Oct 23, 2013
+ *      Author: vincent
+ */
+
+// Round trips through atlas::rpc::loopback_transport : sync_call latency percentiles,
+// async call throughput and bytes per message for typical argument shapes.
+// The whole client path is measured, message_builder, dispatcher_manager and the task managers.
+// A transport destroyed while its response ring is full must stop, not wait for room forever.
+// Build with <variant>release for meaningful numbers.
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdlib>
+
+#include <atlas/rpc.h>
+#include <atlas/rpc/loopback.h>
+
+using namespace atlas::rpc;
+
+typedef std::chrono::steady_clock clock_type;
+
+static const size_t sync_rounds = 20000;
+static const size_t async_rounds = 200000;
+
+struct bench {
+  static rpc_result add(int a, int b, const rpc_context&) { return rpc_result(std::to_string(a + b)); }
+
+  static rpc_result echo(const std::string& s, const rpc_context&) { return rpc_result(s); }
+
+  static rpc_result sum(const std::vector<int>& v, const rpc_context&) {
+    long s = 0;
+    for (int i : v) s += i;
+    return rpc_result(std::to_string(s));
+  }
+};
+
+namespace bench_ids {
+  ATLAS_REGISTER_REMOTE_FUNC(add, 1001);
+  ATLAS_REGISTER_REMOTE_FUNC(echo, 1002);
+  ATLAS_REGISTER_REMOTE_FUNC(sum, 1003);
+
+  ATLAS_BIND_REMOTE_FUNC(add, bench::add);
+  ATLAS_BIND_REMOTE_FUNC(echo, bench::echo);
+  ATLAS_BIND_REMOTE_FUNC(sum, bench::sum);
+}
+
+// sync_call round trips, one at a time, returns the sorted latencies in ns
+template<typename Functor, typename ... Args>
+std::vector<double> sync_latencies(remote_caller& caller, Functor f, int fn_id, Args ... args) {
+  std::vector<double> ns;
+  ns.reserve(sync_rounds);
+
+  for (size_t i = 0; i < sync_rounds; ++i) {
+    auto start = clock_type::now();
+    rpc_result r = caller.sync_call(f, fn_id, args...);
+    ns.push_back(std::chrono::duration<double, std::nano>(clock_type::now() - start).count());
+
+    if (!r || r.err() != 0) std::cout << "bad sync result" << std::endl;
+  }
+
+  std::sort(ns.begin(), ns.end());
+  return ns;
+}
+
+template<typename Functor, typename ... Args>
+void report(const char* shape, loopback_transport& transport, Functor f, int fn_id, Args ... args) {
+  message_builder builder(0);
+  message_buffer buffer;
+  builder.set_return_type(rpc_sync);
+  builder.build(buffer, f, fn_id, args...);
+
+  std::vector<double> ns = sync_latencies(transport.client(), f, fn_id, args...);
+
+  std::cout << std::left << std::setw(24) << shape << std::right
+      << std::setw(8) << buffer.size() << " bytes"
+      << std::setw(10) << std::fixed << std::setprecision(0) << ns[ns.size() / 2] << " ns p50"
+      << std::setw(10) << ns[ns.size() * 99 / 100] << " ns p99" << std::endl;
+}
+
+void async_throughput(loopback_transport& transport) {
+  std::atomic<size_t> done(0);
+  rpc_callback_type cb = [&done](const std::string&, int, async_task&) { done.fetch_add(1, std::memory_order_relaxed); };
+
+  auto start = clock_type::now();
+  for (size_t i = 0; i < async_rounds; ++i) {
+    transport.client().call(bench::add, bench_ids::fn_ids::add, cb, static_cast<int>(i), 1, nilctx);
+  }
+  while (done.load(std::memory_order_relaxed) < async_rounds) std::this_thread::yield();
+  double seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+
+  std::cout << "async (int, int)        " << std::setw(10) << std::fixed << std::setprecision(0)
+      << async_rounds / seconds << " calls/s" << std::endl;
+}
+
+// The first callback is slow, the server fills the response ring meanwhile and waits for room to
+// push the last response, which freeing the first one does not make : the transport stops then.
+void stop_with_full_ring() {
+  std::atomic<bool> stopped(false);
+  std::thread t([&stopped]() {
+    {
+      loopback_transport transport(4096);
+      rpc_callback_type cb = [](const std::string&, int, async_task&) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      };
+
+      size_t sizes[] = { 64, 1900, 1900, 1950 };
+      for (size_t n : sizes) {
+        transport.client().call(bench::echo, bench_ids::fn_ids::echo, cb, std::string(n, 'x'), nilctx);
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    stopped = true;
+  });
+
+  auto deadline = clock_type::now() + std::chrono::seconds(5);
+  while (!stopped && clock_type::now() < deadline) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  if (!stopped) {
+    std::cout << "FAILED : the transport does not stop with a full response ring" << std::endl;
+    t.detach();
+    std::_Exit(1);
+  }
+  t.join();
+  std::cout << "stopped with a full response ring" << std::endl;
+
+  // the dropped responses leave their sessions behind
+  async_task_manager::ref().clear();
+}
+
+int main() {
+  stop_with_full_ring();
+
+  loopback_transport transport;
+
+  report("(int, int)", transport, bench::add, bench_ids::fn_ids::add, 1, 2, nilctx);
+  report("(string[32])", transport, bench::echo, bench_ids::fn_ids::echo, std::string(32, 'x'), nilctx);
+  report("(string[4K])", transport, bench::echo, bench_ids::fn_ids::echo, std::string(4096, 'x'), nilctx);
+  report("(vector<int>[256])", transport, bench::sum, bench_ids::fn_ids::sum, std::vector<int>(256, 1000), nilctx);
+
+  async_throughput(transport);
+
+  if (sync_task_manager::ref().size() != 0 || async_task_manager::ref().size() != 0) {
+    std::cout << "sessions left behind" << std::endl;
+  }
+
+  return 0;
+}
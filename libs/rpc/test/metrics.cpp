@@ -0,0 +1,136 @@
+/*
+ * metrics.cpp
+ *
+ *  Created on: Oct 28, 2013
+ *      Author: vincent
+ */
+
+// atlas::rpc::rpc_metrics : the calls served through a loopback_transport and the calls dispatched
+// by short lived threads show up in a snapshot, and so do the calls a caller rejects or times out
+// itself. Prints what recording costs per dispatched call.
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+#include <atlas/rpc.h>
+#include <atlas/rpc/loopback.h>
+
+using namespace atlas::rpc;
+
+typedef std::chrono::steady_clock clock_type;
+
+struct service {
+  static rpc_result check(int a, const rpc_context&) {
+    if (a < 0) return rpc_result("negative", 7);
+    return rpc_result(std::to_string(a));
+  }
+};
+
+namespace metrics_test {
+  ATLAS_REGISTER_REMOTE_FUNC(check, 3201);
+  ATLAS_REGISTER_REMOTE_FUNC(unanswered, 3202);
+  ATLAS_BIND_REMOTE_FUNC(check, service::check);
+}
+
+// the requests go nowhere, no response ever comes back
+struct null_caller : public remote_caller {
+  virtual void send(const char*, size_t) {}
+};
+
+double ns_per_dispatch(const std::string& body) {
+  const int n = 1000000;
+
+  auto start = clock_type::now();
+  for (int i = 0; i < n; ++i) dispatcher_manager::ref().dispatch(metrics_test::fn_ids::check, body, nilctx);
+
+  return std::chrono::duration<double, std::nano>(clock_type::now() - start).count() / n;
+}
+
+int main() {
+  int failures = 0;
+
+  // off until asked for
+  if (rpc_metrics::enabled()) ++failures;
+  rpc_metrics::set_enabled(true);
+
+  {
+    loopback_transport transport;
+    remote_caller& caller = transport.client();
+    caller.set_timeout(std::chrono::milliseconds(5000));
+
+    for (int i = -10; i < 90; ++i) {
+      rpc_result r = caller.sync_call(service::check, metrics_test::fn_ids::check, i, nilctx);
+      if (!r || r.err() != (i < 0 ? 7 : 0)) ++failures;
+    }
+  }
+
+  rpc_metrics_snapshot s = rpc_metrics::ref().snapshot();
+  const rpc_fn_metrics& m = s.functions[metrics_test::fn_ids::check];
+  if (m.calls != 100 || m.errors != 10 || m.sent != 100 || m.in_flight != 0 || m.bytes_in == 0 || m.bytes_out == 0) ++failures;
+  if (s.functions[fn_ids::resume_thread].calls != 100) ++failures;
+  if (s.sync_in_flight != 0 || s.async_in_flight != 0) ++failures;
+
+  std::cout << "fn " << metrics_test::fn_ids::check << " : " << m.calls << " calls, " << m.errors << " errors, "
+      << m.bytes_in << " bytes in, " << m.bytes_out << " bytes out, p50 " << m.latency_percentile_ns(0.5)
+      << " ns, p99 " << m.latency_percentile_ns(0.99) << " ns" << std::endl;
+
+  // the timeouts and the rejections of the caller itself, no server probe sees these calls
+  {
+    null_caller caller;
+    caller.set_timeout(std::chrono::milliseconds(20));
+    caller.set_admission(std::make_shared<admission_control>(1, admission_control::reject));
+
+    std::atomic<int> timeouts(0), rejected(0);
+    rpc_callback_type cb = [&timeouts, &rejected](const std::string&, int err, async_task&) {
+      if (err == rpc_timeout) ++timeouts;
+      if (err == rpc_rejected) ++rejected;
+    };
+
+    rpc_result r = caller.sync_call(service::check, metrics_test::fn_ids::unanswered, 1, nilctx);
+    if (!r || r.err() != rpc_timeout) ++failures;
+
+    caller.call(service::check, metrics_test::fn_ids::unanswered, cb, 1, nilctx);
+    caller.call(service::check, metrics_test::fn_ids::unanswered, cb, 2, nilctx);
+    r = caller.sync_call(service::check, metrics_test::fn_ids::unanswered, 3, nilctx);
+    if (!r || r.err() != rpc_rejected) ++failures;
+
+    auto deadline = clock_type::now() + std::chrono::seconds(5);
+    while (timeouts < 1 && clock_type::now() < deadline) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if (timeouts != 1 || rejected != 1) ++failures;
+
+    rpc_fn_metrics u = rpc_metrics::ref().snapshot().functions[metrics_test::fn_ids::unanswered];
+    if (u.timeouts != 2 || u.rejected != 2 || u.errors != 4 || u.calls != 0) {
+      std::cout << "FAILED : the caller side errors are " << u.timeouts << " timeouts, " << u.rejected << " rejected" << std::endl;
+      ++failures;
+    }
+  }
+
+  // the counts of the exited threads are kept
+  std::string body = message_builder(0).build(service::check, metrics_test::fn_ids::check, 1, nilctx).substr(message::request_header_size);
+  {
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+      threads.emplace_back([&body]() {
+        for (int i = 0; i < 1000; ++i) dispatcher_manager::ref().dispatch(metrics_test::fn_ids::check, body, nilctx);
+      });
+    }
+    for (std::thread& t : threads) t.join();
+  }
+
+  if (rpc_metrics::ref().snapshot().functions[metrics_test::fn_ids::check].calls != 4100) ++failures;
+
+  double on = ns_per_dispatch(body);
+  rpc_metrics::set_enabled(false);
+  double off = ns_per_dispatch(body);
+  rpc_metrics::set_enabled(true);
+
+  std::cout << std::fixed << std::setprecision(1) << "dispatch " << on << " ns with metrics, " << off << " ns without" << std::endl;
+
+  std::cout << (failures ? "FAIL" : "PASS") << std::endl;
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * pooled_dispatcher.cpp
+ *
+ *  Created on: Oct 26, 2013
+ *      Author: vincent
+ */
+
+// atlas::rpc::pooled_dispatcher behind a tcp_transport : a slow client does not stall
+// a fast one, the calls of a client run in order, and an overloaded dispatcher rejects, the
+// calls of a batch like the others.
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <iostream>
+
+#include <atlas/rpc.h>
+#include <atlas/rpc/tcp.h>
+#include <atlas/rpc/pooled_dispatcher.h>
+
+using namespace atlas::rpc;
+
+typedef std::chrono::steady_clock clock_type;
+
+static std::mutex order_mutex;
+static std::map<int, std::vector<int>> order; // client id -> sequence numbers in execution order
+
+struct service {
+  static rpc_result work(int seq, int sleep_ms, const rpc_context& c) {
+    if (sleep_ms) std::this_thread::sleep_for(std::chrono::milliseconds(sleep_ms));
+
+    std::lock_guard<std::mutex> guard(order_mutex);
+    order[c.client_id()].push_back(seq);
+
+    return rpc_result(std::to_string(seq));
+  }
+};
+
+namespace pool_test {
+  ATLAS_REGISTER_REMOTE_FUNC(work, 4001);
+  ATLAS_BIND_REMOTE_FUNC(work, service::work);
+}
+
+static int failures = 0;
+
+void check(bool ok, const char* what) {
+  if (!ok) {
+    ++failures;
+    std::cout << "FAILED : " << what << std::endl;
+  }
+}
+
+int main() {
+  {
+    pooled_dispatcher<atlas::prio_thread_pool> pool(4);
+
+    tcp_transport server(1);
+    server.set_handler([&pool](const tcp_connection_ptr& c, const message_view& m) { pool.execute(c, m, c->peer()); });
+    uint16_t port = server.listen("127.0.0.1", 0);
+
+    tcp_transport client(1);
+    tcp_connection_ptr slow = client.connect("127.0.0.1", port, 1);
+    tcp_connection_ptr fast = client.connect("127.0.0.1", port, 2);
+
+    std::atomic<int> done(0);
+    rpc_callback_type cb = [&done](const std::string&, int, async_task&) { ++done; };
+
+    // 10 slow calls of client 1 take 500ms in a row, the fast ones of client 2 should not wait for them
+    for (int i = 0; i < 10; ++i) slow->call(service::work, pool_test::fn_ids::work, cb, i, 50, nilctx);
+
+    auto start = clock_type::now();
+    for (int i = 0; i < 1000; ++i) fast->call(service::work, pool_test::fn_ids::work, cb, i, 0, nilctx);
+    fast->set_priority(10);
+    rpc_result r = fast->sync_call(service::work, pool_test::fn_ids::work, 1000, 0, nilctx);
+    auto fast_ms = std::chrono::duration_cast<std::chrono::milliseconds>(clock_type::now() - start).count();
+
+    check(r && r.data() == "1000", "fast sync call");
+    check(fast_ms < 250, "fast calls are not stalled by the slow ones");
+
+    while (done < 1010 && clock_type::now() - start < std::chrono::seconds(10)) std::this_thread::yield();
+    pool.wait();
+
+    std::lock_guard<std::mutex> guard(order_mutex);
+    check(order[1].size() == 10 && order[2].size() == 1001, "all the calls ran");
+
+    bool ordered = true;
+    for (auto& kv : order) {
+      for (size_t i = 0; i < kv.second.size(); ++i) ordered = ordered && kv.second[i] == static_cast<int>(i);
+    }
+    check(ordered, "per client order");
+
+    std::cout << "fast client done in " << fast_ms << "ms while the slow one was busy" << std::endl;
+  }
+
+  {
+    // reject beyond 2 pending calls
+    pooled_dispatcher<> pool(1, 2, pooled_dispatcher<>::per_client, pooled_dispatcher<>::reject);
+
+    tcp_transport server(1);
+    server.set_handler([&pool](const tcp_connection_ptr& c, const message_view& m) { pool.execute(c, m, c->peer()); });
+    uint16_t port = server.listen("127.0.0.1", 0);
+
+    tcp_transport client(1);
+    tcp_connection_ptr c = client.connect("127.0.0.1", port, 3);
+
+    std::atomic<int> ok(0), rejected(0);
+    rpc_callback_type cb = [&](const std::string&, int err, async_task&) {
+      if (err == rpc_rejected) ++rejected;
+      else ++ok;
+    };
+
+    for (int i = 0; i < 10; ++i) c->call(service::work, pool_test::fn_ids::work, cb, i, 20, nilctx);
+
+    auto start = clock_type::now();
+    while (ok + rejected < 10 && clock_type::now() - start < std::chrono::seconds(10)) std::this_thread::yield();
+
+    check(ok >= 2 && rejected > 0 && ok + rejected == 10, "overload rejects");
+    std::cout << ok << " calls executed, " << rejected << " rejected" << std::endl;
+  }
+
+  {
+    // the batches go through the pool too, so their calls are limited like the others
+    pooled_dispatcher<> pool(1, 2, pooled_dispatcher<>::per_client, pooled_dispatcher<>::reject);
+
+    tcp_transport server(1);
+    server.set_handler([&pool](const tcp_connection_ptr& c, const message_view& m) { pool.execute(c, m, c->peer()); });
+    uint16_t port = server.listen("127.0.0.1", 0);
+
+    tcp_transport client(1);
+    tcp_connection_ptr c = client.connect("127.0.0.1", port, 4);
+    c->enable_batching(64 * 1024, std::chrono::seconds(10));
+
+    std::atomic<int> ok(0), rejected(0);
+    rpc_callback_type cb = [&](const std::string&, int err, async_task&) {
+      if (err == rpc_rejected) ++rejected;
+      else ++ok;
+    };
+
+    for (int i = 0; i < 10; ++i) c->call(service::work, pool_test::fn_ids::work, cb, i, 20, nilctx);
+    c->flush();
+
+    auto start = clock_type::now();
+    while (ok + rejected < 10 && clock_type::now() - start < std::chrono::seconds(10)) std::this_thread::yield();
+    pool.wait();
+
+    check(ok >= 2 && rejected > 0 && ok + rejected == 10, "a batch goes through the pool");
+
+    std::lock_guard<std::mutex> guard(order_mutex);
+    bool ordered = true;
+    for (size_t i = 1; i < order[4].size(); ++i) ordered = ordered && order[4][i - 1] < order[4][i];
+    check(ordered, "the calls of a batch run in order");
+
+    std::cout << "batched : " << ok << " calls executed, " << rejected << " rejected" << std::endl;
+  }
+
+  std::cout << (failures ? "FAIL" : "PASS") << std::endl;
+
+  return failures;
+}
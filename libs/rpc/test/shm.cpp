@@ -0,0 +1,162 @@
+/*
+ * shm.cpp
+ *
+ *  Created on: Oct 25, 2013
+ *      Author: vincent
+ */
+
+// atlas::rpc::shm_transport between two processes : the child serves, the parent calls.
+// Prints the sync_call round trip percentiles and the async call throughput. A mapping with a
+// ring capacity which is not a power of two is refused, and a ring whose peer wrote a corrupt
+// frame length is marked broken instead of read past its storage.
+// Build with <variant>release for meaningful numbers.
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include <atlas/rpc.h>
+#include <atlas/rpc/shm.h>
+
+using namespace atlas::rpc;
+
+typedef std::chrono::steady_clock clock_type;
+
+struct service {
+  static rpc_result add(int a, int b, const rpc_context&) { return rpc_result(std::to_string(a + b)); }
+};
+
+namespace shm_test {
+  ATLAS_REGISTER_REMOTE_FUNC(add, 3001);
+  ATLAS_BIND_REMOTE_FUNC(add, service::add);
+}
+
+int main() {
+  std::string path = "/tmp/atlas-rpc-shm-test." + std::to_string(::getpid());
+
+  // the child tells when the file is ready, the parent tells when it is done
+  int ready[2], done[2];
+  if (::pipe(ready) < 0 || ::pipe(done) < 0) return 1;
+
+  pid_t pid = ::fork();
+  if (pid == 0) {
+    shm_transport s(path, shm_transport::server);
+
+    char c = 1;
+    if (::write(ready[1], &c, 1) != 1) return 1;
+
+    // serve until the parent is done
+    if (::read(done[0], &c, 1) != 1) return 1;
+    return 0;
+  }
+
+  char c;
+  if (::read(ready[0], &c, 1) != 1) return 1;
+
+  int failures = 0;
+
+  // a mapping whose ring capacity is not a power of two is refused
+  {
+    std::string bad = path + ".bad";
+    alignas(64) char file[4096 + 2 * 100] = { 0 };
+    __shm_header* h = new (file) __shm_header;
+    h->ring_capacity = 100;
+    h->magic.store(__shm_header::magic_value);
+
+    FILE* f = std::fopen(bad.c_str(), "wb");
+    if (!f || std::fwrite(file, 1, sizeof file, f) != sizeof file) ++failures;
+    if (f) std::fclose(f);
+
+    bool thrown = false;
+    try {
+      shm_transport client(bad, shm_transport::client);
+    }
+    catch (const std::runtime_error&) {
+      thrown = true;
+    }
+    if (!thrown) ++failures;
+    std::remove(bad.c_str());
+  }
+
+  // a corrupt length in the shared storage breaks the ring, nothing is read
+  {
+    alignas(64) char data[256] = { 0 };
+    atlas::spsc_ring_control control;
+    atlas::spsc_ring ring(&control, data, sizeof data);
+
+    int popped = 0;
+    auto pop = [&popped](const char*, size_t) { ++popped; };
+
+    if (!ring.try_push("abc", 3) || !ring.try_pop(pop) || popped != 1) ++failures;
+
+    uint32_t n = 1000;
+    if (!ring.try_push("abc", 3)) ++failures;
+    std::memcpy(data + 16, &n, sizeof n);
+    if (ring.try_pop(pop) || popped != 1 || !ring.broken()) ++failures;
+    if (!ring.try_push("abc", 3) || ring.try_pop(pop) || popped != 1) ++failures;
+
+    // a skip mark which is not followed by a frame
+    atlas::spsc_ring_control control2;
+    atlas::spsc_ring ring2(&control2, data, sizeof data);
+    n = 0xffffffff;
+    std::memcpy(data + 128, &n, sizeof n);
+    control2.head.store(128);
+    control2.tail.store(256);
+    if (ring2.try_pop(pop) || popped != 1 || !ring2.broken()) ++failures;
+  }
+
+  {
+    shm_transport client(path, shm_transport::client);
+    remote_caller& caller = client.caller();
+    caller.set_timeout(std::chrono::milliseconds(5000));
+
+    std::vector<double> ns;
+    for (int i = 0; i < 20000; ++i) {
+      auto start = clock_type::now();
+      rpc_result r = caller.sync_call(service::add, shm_test::fn_ids::add, i, 1, nilctx);
+      ns.push_back(std::chrono::duration<double, std::nano>(clock_type::now() - start).count());
+
+      if (!r || r.err() != 0 || r.data() != std::to_string(i + 1)) ++failures;
+    }
+    std::sort(ns.begin(), ns.end());
+
+    std::cout << "sync round trip " << std::fixed << std::setprecision(0)
+        << ns[ns.size() / 2] << " ns p50, " << ns[ns.size() * 99 / 100] << " ns p99" << std::endl;
+
+    const int calls = 200000;
+    std::atomic<int> responses(0);
+    rpc_callback_type cb = [&responses](const std::string&, int, async_task&) { ++responses; };
+
+    auto start = clock_type::now();
+    for (int i = 0; i < calls; ++i) caller.call(service::add, shm_test::fn_ids::add, cb, i, 1, nilctx);
+    while (responses < calls && clock_type::now() - start < std::chrono::seconds(30)) std::this_thread::yield();
+    double seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+
+    if (responses != calls) ++failures;
+    std::cout << "async " << static_cast<long>(calls / seconds) << " calls/s" << std::endl;
+
+    // an idle server goes to sleep, a call must wake it up
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    rpc_result r = caller.sync_call(service::add, shm_test::fn_ids::add, 1, 1, nilctx);
+    if (!r || r.data() != "2") ++failures;
+  }
+
+  c = 0;
+  if (::write(done[1], &c, 1) != 1) ::kill(pid, SIGTERM);
+  ::waitpid(pid, nullptr, 0);
+
+  std::cout << (failures ? "FAIL" : "PASS") << std::endl;
+
+  return failures;
+}
@@ -0,0 +1,99 @@
+/*
+ * stub.cpp
+ *
+ *  Created on: Oct 30, 2013
+ *      Author: vincent
+ */
+
+// Typed remote functions : the fn_stubs of ATLAS_REGISTER_TYPED_REMOTE_FUNC through a loopback_transport,
+// and the cost of a remote_func_skeleton dispatch against the rf_wrapper based one it replaces.
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <iostream>
+#include <iomanip>
+
+#include <atlas/rpc.h>
+#include <atlas/rpc/loopback.h>
+
+using namespace atlas::rpc;
+
+typedef std::chrono::steady_clock clock_type;
+
+struct service {
+  static rpc_result add(int a, int b, const rpc_context&) { return rpc_result(std::to_string(a + b)); }
+
+  static rpc_result concat(std::string s, const std::vector<int>& v, const rpc_context&) {
+    for (int i : v) s += std::to_string(i);
+    return rpc_result(s);
+  }
+};
+
+namespace stub_test {
+  ATLAS_REGISTER_TYPED_REMOTE_FUNC(add, 3401, rpc_result(int, int, const rpc_context&));
+  ATLAS_BIND_REMOTE_FUNC(add, service::add);
+
+  ATLAS_REGISTER_TYPED_REMOTE_FUNC(concat, 3402, rpc_result(std::string, const std::vector<int>&, const rpc_context&));
+  ATLAS_BIND_REMOTE_FUNC(concat, service::concat);
+}
+
+// the dispatch before the skeletons
+rpc_result wrapper_invoke(const message_view& message, const rpc_context& context) {
+  input_buffer ib(message);
+  rpc_iarchive ia(ib);
+
+  rf_wrapper<decltype(service::concat)> rpc(service::concat, ia, context);
+  return rpc();
+}
+
+template<typename Invoker>
+double ns_per_invoke(Invoker invoke, const message_view& message) {
+  const int n = 1000000;
+  size_t bytes = 0;
+
+  auto start = clock_type::now();
+  for (int i = 0; i < n; ++i) bytes += invoke(message, nilctx).data().size();
+
+  return std::chrono::duration<double, std::nano>(clock_type::now() - start).count() / n + (bytes == 0);
+}
+
+int main() {
+  int failures = 0;
+
+  {
+    loopback_transport transport;
+    remote_caller& caller = transport.client();
+    caller.set_timeout(std::chrono::milliseconds(5000));
+
+    // a long and a char are converted to the declared ints before they are serialized
+    rpc_result r = stub_test::fn_stubs::add::sync_call(caller, 40L, '\x02');
+    if (!r || r.data() != "42") ++failures;
+
+    rpc_future<rpc_result> f = stub_test::fn_stubs::concat::async_call(caller, "v", std::vector<int> { 1, 2, 3 });
+    if (f.get().data() != "v123") ++failures;
+
+    // no cast of the callback is needed
+    std::atomic<int> called(0);
+    stub_test::fn_stubs::add::call(caller, [&called](const std::string& data, int err, async_task&) {
+      if (err == 0 && data == "3") ++called;
+    }, 1, 2);
+
+    if (stub_test::fn_stubs::add::sync_call(caller, 0, 0).data() != "0" || called != 1) ++failures;
+  }
+
+  std::string frame = message_builder(0).build(service::concat, stub_test::fn_ids::concat,
+      std::string("payload"), std::vector<int> { 1, 2, 3, 4, 5, 6, 7, 8 }, nilctx);
+  message_view message(frame);
+
+  typedef remote_func_skeleton<decltype(service::concat), service::concat> skeleton;
+  if (skeleton::invoke(message, nilctx).data() != wrapper_invoke(message, nilctx).data()) ++failures;
+
+  double wrapped = ns_per_invoke(wrapper_invoke, message);
+  double direct = ns_per_invoke(skeleton::invoke, message);
+  std::cout << std::fixed << std::setprecision(1) << "rf_wrapper " << wrapped << " ns, skeleton " << direct << " ns per call" << std::endl;
+
+  std::cout << (failures ? "FAIL" : "PASS") << std::endl;
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,25 @@
+/*
+ * stub_mismatch.cpp
+ *
+ *  Created on: Oct 30, 2013
+ *      Author: vincent
+ */
+
+// must not compile : the handler does not match the registered signature
+
+#include <atlas/rpc.h>
+
+using namespace atlas::rpc;
+
+struct service {
+  static rpc_result add(int a, long b, const rpc_context&) { return rpc_result(std::to_string(a + b)); }
+};
+
+namespace stub_test {
+  ATLAS_REGISTER_TYPED_REMOTE_FUNC(add, 3401, rpc_result(int, int, const rpc_context&));
+  ATLAS_BIND_REMOTE_FUNC(add, service::add);
+}
+
+int main() {
+  return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * task.cpp
+ *
+ *  Created on: Oct 19, 2013
+ *      Author: vincent
+ */
+
+// Contention benchmark of the task managers : every thread suspends sessions and
+// resumes them, as a client does with the outgoing calls and the incoming responses.
+// A single mutex std::map manager, the former implementation, is the baseline.
+// Build with <variant>release for meaningful numbers.
+
+#include <map>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+#include <boost/uuid/uuid.hpp>
+#include <boost/uuid/random_generator.hpp>
+
+#include <atlas/rpc/task.h>
+
+using namespace atlas::rpc;
+
+typedef std::chrono::high_resolution_clock clock_type;
+
+static const size_t ops_per_thread = 100000;
+static const size_t in_flight = 64;
+
+class single_lock_task_manager {
+public:
+
+  void suspend(const uuid& id, rpc_callback_type cb, int response_expected = 1) {
+    std::lock_guard<std::mutex> guard(_mutex);
+    _sessions.insert(std::make_pair(id, async_task(cb, response_expected)));
+  }
+
+  void resume(const uuid& id, const std::string& result, int err_code = 0) {
+    std::lock_guard<std::mutex> guard(_mutex);
+
+    auto it = _sessions.find(id);
+    if (it != _sessions.end()) {
+      it->second.increase_response();
+      it->second.run(result, err_code);
+      if (it->second.ready()) _sessions.erase(it);
+    }
+  }
+
+private:
+
+  std::mutex _mutex;
+  std::map<uuid, async_task> _sessions;
+};
+
+template<typename Manager>
+double run(Manager& manager, size_t threads) {
+  std::atomic<size_t> calls(0);
+  rpc_callback_type cb = [&calls](const std::string&, int, async_task&) { calls.fetch_add(1, std::memory_order_relaxed); };
+
+  // ids are generated up front, only the tables are measured
+  std::vector<std::vector<uuid>> ids(threads);
+  uuid id = boost::uuids::random_generator()();
+  uint64_t seq = 0;
+  for (auto& v : ids) {
+    for (size_t i = 0; i < ops_per_thread; ++i) {
+      ++seq;
+      std::memcpy(id.data, &seq, sizeof seq);
+      v.push_back(id);
+    }
+  }
+
+  auto start = clock_type::now();
+
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < threads; ++t) {
+    workers.emplace_back([&manager, &ids, &cb, t]() {
+      const std::vector<uuid>& v = ids[t];
+
+      // keep a window of sessions in flight
+      for (size_t i = 0; i < v.size(); ++i) {
+        manager.suspend(v[i], cb);
+        if (i >= in_flight) manager.resume(v[i - in_flight], "", 0);
+      }
+      for (size_t i = v.size() - in_flight; i < v.size(); ++i) manager.resume(v[i], "", 0);
+    });
+  }
+  for (auto& w : workers) w.join();
+
+  double seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+  if (calls != threads * ops_per_thread) std::cout << "lost callbacks : " << calls << std::endl;
+
+  return threads * ops_per_thread / seconds / 1e6;
+}
+
+int main() {
+  std::cout << std::setw(8) << "threads" << std::setw(16) << "single lock" << std::setw(16) << "sharded"
+      << "    (M suspend/resume pairs per second)" << std::endl;
+
+  for (size_t threads = 1; threads <= 64; threads *= 2) {
+    single_lock_task_manager baseline;
+    double base = run(baseline, threads);
+    double sharded = run(async_task_manager::ref(), threads);
+
+    std::cout << std::setw(8) << threads << std::setw(16) << std::fixed << std::setprecision(2) << base
+        << std::setw(16) << sharded << std::endl;
+  }
+
+  return 0;
+}
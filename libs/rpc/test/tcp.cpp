@@ -0,0 +1,182 @@
+/*
+ * tcp.cpp
+ *
+ *  Created on: Oct 24, 2013
+ *      Author: vincent
+ */
+
+// atlas::rpc::tcp_transport over localhost : sync calls, a burst of async calls
+// spread over several connections, large messages split over many reads, and connections
+// closed and opened again. A handler which throws drops its frame, not the connection, and a
+// server out of descriptors closes the pending connections instead of leaving them in the backlog.
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <iostream>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include <atlas/rpc.h>
+#include <atlas/rpc/tcp.h>
+
+using namespace atlas::rpc;
+
+typedef std::chrono::steady_clock clock_type;
+
+struct service {
+  static rpc_result add(int a, int b, const rpc_context&) { return rpc_result(std::to_string(a + b)); }
+
+  static rpc_result echo(const std::string& s, const rpc_context&) { return rpc_result(s); }
+};
+
+namespace tcp_test {
+  ATLAS_REGISTER_REMOTE_FUNC(add, 2001);
+  ATLAS_REGISTER_REMOTE_FUNC(echo, 2002);
+
+  ATLAS_BIND_REMOTE_FUNC(add, service::add);
+  ATLAS_BIND_REMOTE_FUNC(echo, service::echo);
+}
+
+static int failures = 0;
+
+void check(bool ok, const char* what) {
+  if (!ok) {
+    ++failures;
+    std::cout << "FAILED : " << what << std::endl;
+  }
+}
+
+int main() {
+  tcp_transport server(2);
+  tcp_transport client(2);
+
+  uint16_t port = server.listen("127.0.0.1", 0);
+
+  std::vector<tcp_connection_ptr> connections;
+  for (int i = 0; i < 4; ++i) {
+    connections.push_back(client.connect("localhost", port));
+    connections.back()->set_timeout(std::chrono::milliseconds(5000));
+  }
+
+  // sync calls
+  rpc_result r = connections[0]->sync_call(service::add, tcp_test::fn_ids::add, 20, 22, nilctx);
+  check(r && r.err() == 0 && r.data() == "42", "sync add");
+
+  std::string big(3 * 1024 * 1024, 'x');
+  r = connections[1]->sync_call(service::echo, tcp_test::fn_ids::echo, big, nilctx);
+  check(r && r.err() == 0 && r.data() == big, "sync echo of 3M");
+
+  // async calls over all the connections
+  const int calls = 100000;
+  std::atomic<int> done(0);
+  std::atomic<long> sum(0);
+  rpc_callback_type cb = [&](const std::string& data, int err, async_task&) {
+    if (err == 0) sum += std::stol(data);
+    ++done;
+  };
+
+  auto start = clock_type::now();
+  for (int i = 0; i < calls; ++i) {
+    connections[i % connections.size()]->call(service::add, tcp_test::fn_ids::add, cb, i, 1, nilctx);
+  }
+  while (done < calls && clock_type::now() - start < std::chrono::seconds(30)) std::this_thread::yield();
+  double seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+
+  check(done == calls, "all async responses");
+  check(sum == static_cast<long>(calls) * (calls + 1) / 2, "async sum");
+
+  std::cout << calls << " async calls over " << connections.size() << " connections in "
+      << seconds << "s, " << static_cast<long>(calls / seconds) << " calls/s" << std::endl;
+
+  // a closed connection refuses to send
+  connections[0]->close();
+  bool thrown = false;
+  try {
+    connections[0]->call(service::add, tcp_test::fn_ids::add, 1, 2, nilctx);
+  }
+  catch (const std::exception&) {
+    thrown = true;
+  }
+  check(thrown, "send on a closed connection");
+  check(!connections[0]->is_open(), "the connection is closed");
+
+  // the IO thread releases the closed connections, the new ones may reuse their descriptors
+  for (int i = 0; i < 20; ++i) {
+    tcp_connection_ptr c = client.connect("127.0.0.1", port);
+    c->set_timeout(std::chrono::milliseconds(5000));
+    r = c->sync_call(service::add, tcp_test::fn_ids::add, i, 1, nilctx);
+    check(r && r.err() == 0 && r.data() == std::to_string(i + 1), "call on a new connection");
+    c->close();
+  }
+
+  // the frame whose handler throws is dropped, the next one is served on the same connection
+  {
+    tcp_transport throwing;
+    std::atomic<int> handled(0);
+    throwing.set_handler([&handled](const tcp_connection_ptr& c, const message_view& m) {
+      if (handled++ == 0) throw std::runtime_error("handler failure");
+      dispatcher_manager::ref().execute(*c, m, c->peer());
+    });
+    uint16_t throwing_port = throwing.listen("127.0.0.1", 0);
+
+    tcp_connection_ptr c = client.connect("127.0.0.1", throwing_port);
+    c->set_timeout(std::chrono::milliseconds(200));
+    r = c->sync_call(service::add, tcp_test::fn_ids::add, 1, 1, nilctx);
+    check(r && r.err() == rpc_timeout, "no response to the frame whose handler throws");
+
+    c->set_timeout(std::chrono::milliseconds(5000));
+    r = c->sync_call(service::add, tcp_test::fn_ids::add, 2, 1, nilctx);
+    check(r && r.err() == 0 && r.data() == "3", "call after a handler which throws");
+    check(c->is_open(), "the connection survives a handler which throws");
+    c->close();
+  }
+
+  // out of descriptors, the pending connection is accepted with the reserve descriptor and closed
+  {
+    tcp_transport full;
+    uint16_t full_port = full.listen("127.0.0.1", 0);
+
+    int s = ::socket(AF_INET, SOCK_STREAM, 0);
+    struct timeval tv = { 5, 0 };
+    ::setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+
+    // no descriptor left from the lowest free one on
+    int lowest = ::dup(0);
+    ::close(lowest);
+    struct rlimit saved, limit;
+    ::getrlimit(RLIMIT_NOFILE, &saved);
+    limit = saved;
+    limit.rlim_cur = lowest;
+    ::setrlimit(RLIMIT_NOFILE, &limit);
+
+    struct sockaddr_in addr = sockaddr_in();
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(full_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bool connected = ::connect(s, reinterpret_cast<struct sockaddr*>(&addr), sizeof addr) == 0;
+
+    char byte;
+    ssize_t n = ::read(s, &byte, 1);
+    check(connected && (n == 0 || (n < 0 && errno == ECONNRESET)), "the pending connection is closed");
+
+    ::setrlimit(RLIMIT_NOFILE, &saved);
+    ::close(s);
+
+    tcp_connection_ptr c = client.connect("127.0.0.1", full_port);
+    c->set_timeout(std::chrono::milliseconds(5000));
+    r = c->sync_call(service::add, tcp_test::fn_ids::add, 3, 4, nilctx);
+    check(r && r.err() == 0 && r.data() == "7", "call once descriptors are back");
+    c->close();
+  }
+
+  std::cout << (failures ? "FAIL" : "PASS") << std::endl;
+
+  return failures;
+}
@@ -0,0 +1,125 @@
+/*
+ * timeout.cpp
+ *
+ *  Created on: Nov 7, 2013
+ *      Author: vincent
+ */
+
+// Timeouts and cancellations over a loopback transport : a sync call and a callback call to a
+// slow function complete with rpc_timeout, a cancelled one with rpc_cancelled, and the late
+// responses are dropped. The deadlines of the completed calls do not pile up in the timer wheel.
+
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <iostream>
+
+#include <boost/uuid/random_generator.hpp>
+
+#include <atlas/rpc.h>
+#include <atlas/rpc/loopback.h>
+
+using namespace atlas::rpc;
+
+typedef std::chrono::steady_clock clock_type;
+
+struct service {
+  static rpc_result sleep(int ms, const rpc_context& c) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    return rpc_result(std::to_string(ms));
+  }
+};
+
+namespace timeout_test {
+  ATLAS_REGISTER_REMOTE_FUNC(sleep, 4201);
+  ATLAS_BIND_REMOTE_FUNC(sleep, service::sleep);
+}
+
+static int failures = 0;
+
+void check(bool ok, const char* what) {
+  if (!ok) {
+    ++failures;
+    std::cout << "FAILED : " << what << std::endl;
+  }
+}
+
+template<typename F>
+bool wait_for(F ready) {
+  auto start = clock_type::now();
+  while (!ready() && clock_type::now() - start < std::chrono::seconds(5)) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  return ready();
+}
+
+int main() {
+  loopback_transport transport;
+  remote_caller& client = transport.client();
+
+  std::atomic<int> calls(0), last_err(-1);
+  rpc_callback_type cb = [&calls, &last_err](const std::string&, int err, async_task&) {
+    last_err = err;
+    ++calls;
+  };
+
+  // a sync call gives up after the timeout, the late response finds no session
+  client.set_timeout(std::chrono::milliseconds(20));
+  auto start = clock_type::now();
+  rpc_result r = client.sync_call(service::sleep, timeout_test::fn_ids::sleep, 100, nilctx);
+  auto elapsed = clock_type::now() - start;
+  check(r.err() == rpc_timeout && elapsed < std::chrono::milliseconds(90), "sync call timeout");
+
+  check(wait_for([&]() { return transport.responses_delivered() == 1; }), "the late sync response arrives");
+  check(sync_task_manager::ref().size() == 0, "the late sync response is dropped");
+
+  // a callback call is called back with rpc_timeout by the timer thread, once
+  client.call(service::sleep, timeout_test::fn_ids::sleep, cb, 100, nilctx);
+  check(wait_for([&]() { return calls == 1; }) && last_err == rpc_timeout, "callback timeout");
+  check(clock_type::now() - start < std::chrono::milliseconds(190), "callback timeout in time");
+
+  check(wait_for([&]() { return transport.responses_delivered() == 2; }), "the late async response arrives");
+  check(calls == 1 && async_task_manager::ref().size() == 0, "the late async response is dropped");
+
+  // cancel a callback call in flight
+  client.set_timeout(std::chrono::milliseconds(0));
+  client.call(service::sleep, timeout_test::fn_ids::sleep, cb, 50, nilctx);
+  async_task_manager::ref().cancel(client.session_id());
+  check(calls == 2 && last_err == rpc_cancelled, "async cancel");
+
+  check(wait_for([&]() { return transport.responses_delivered() == 3; }), "the cancelled response arrives");
+  check(calls == 2 && async_task_manager::ref().size() == 0, "the cancelled response is dropped");
+
+  // cancel a waiting sync session from another thread, then its response comes too late
+  {
+    uuid id = boost::uuids::random_generator()();
+    std::future<rpc_result> future = sync_task_manager::ref().expect(id);
+
+    std::thread canceller([id]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      sync_task_manager::ref().cancel(id);
+    });
+    r = sync_task_manager::ref().wait_until(id, future, clock_type::now() + std::chrono::seconds(5));
+    canceller.join();
+
+    check(r.err() == rpc_cancelled, "sync cancel");
+
+    sync_task_manager::ref().resume(id, "late", 0);
+    check(sync_task_manager::ref().size() == 0, "the response of a cancelled sync session is dropped");
+  }
+
+  // the calls which complete long before their deadline do not keep it in the wheel
+  client.set_timeout(std::chrono::seconds(30));
+  const int fast_calls = 20000;
+  for (int i = 0; i < fast_calls; ++i) client.call(service::sleep, timeout_test::fn_ids::sleep, cb, 0, nilctx);
+  check(wait_for([&]() { return calls == 2 + fast_calls; }), "the fast calls are answered");
+
+  // the next tick purges them once they are more than the floor
+  check(wait_for([]() { return async_task_manager::ref().timer_count() <= async_task_manager::purge_floor; }),
+      "the deadlines of the completed calls are purged");
+  size_t timers = async_task_manager::ref().timer_count();
+
+  std::cout << fast_calls << " completed calls with a 30s timeout : " << timers << " deadlines left" << std::endl;
+
+  std::cout << (failures ? "FAIL" : "PASS") << std::endl;
+  return failures;
+}
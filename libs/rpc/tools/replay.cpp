@@ -0,0 +1,101 @@
+/*
+ * replay.cpp
+ *
+ *  Created on: Nov 1, 2013
+ *      Author: vincent
+ */
+
+// Replay a capture of atlas::rpc::capture_tap through the dispatcher of this process, and report
+// the throughput and the distribution of the time spent per call.
+//
+//    replay <capture> [--speed 1|N|max] [--sent]
+//
+// --speed : 1 keeps the captured pace, N runs N times faster, max runs back to back
+// --sent  : replay the frames the capturing process sent, instead of the ones it received
+//
+// The handlers of the captured function ids must be linked in, see the Jamfile.
+
+#include <map>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+
+#include <atlas/rpc.h>
+#include <atlas/rpc/replay.h>
+
+using namespace atlas::rpc;
+
+namespace {
+
+  int usage() {
+    std::cerr << "usage : replay <capture> [--speed 1|N|max] [--sent]" << std::endl;
+    return 2;
+  }
+
+  double us(uint64_t ns) { return ns / 1000.0; }
+
+}
+
+int main(int argc, char* argv[]) {
+  std::string path;
+  replay_options options;
+
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+      std::string speed = argv[++i];
+      options.speed = speed == "max" ? 0.0 : std::atof(speed.c_str());
+      if (speed != "max" && options.speed <= 0) return usage();
+    }
+    else if (std::strcmp(argv[i], "--sent") == 0) {
+      options.direction = captured_sent;
+    }
+    else if (path.empty() && argv[i][0] != '-') {
+      path = argv[i];
+    }
+    else {
+      return usage();
+    }
+  }
+
+  if (path.empty()) return usage();
+
+  rpc_metrics::set_enabled(true);
+
+  replay_report report;
+  try {
+    report = capture_replayer(options).run(path);
+  }
+  catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  std::cout << std::fixed << std::setprecision(1)
+      << report.executed << " frames, " << report.bytes << " bytes in " << report.elapsed_ns / 1e6 << " ms : "
+      << report.throughput() << " frames/s" << std::endl
+      << report.skipped << " skipped, " << report.failed << " failed, " << report.responses << " responses" << std::endl
+      << "execute us : p50 " << us(report.latency_percentile_ns(0.5))
+      << ", p90 " << us(report.latency_percentile_ns(0.9))
+      << ", p99 " << us(report.latency_percentile_ns(0.99))
+      << ", p99.9 " << us(report.latency_percentile_ns(0.999))
+      << ", max " << us(report.latency_percentile_ns(1.0)) << std::endl;
+
+  if (options.speed > 0) std::cout << "max lag behind the schedule : " << us(report.max_lag_ns) << " us" << std::endl;
+
+  std::map<int, rpc_fn_metrics> functions = rpc_metrics::ref().snapshot().functions;
+  if (functions.empty()) return 0;
+
+  std::cout << std::setw(12) << "fn" << std::setw(12) << "calls" << std::setw(10) << "errors"
+      << std::setw(12) << "p50 us" << std::setw(12) << "p99 us" << std::endl;
+  for (const auto& f : functions) {
+    const rpc_fn_metrics& m = f.second;
+    if (m.calls == 0) continue;
+
+    std::cout << std::setw(12) << f.first << std::setw(12) << m.calls << std::setw(10) << m.errors
+        << std::setw(12) << us(m.latency_percentile_ns(0.5)) << std::setw(12) << us(m.latency_percentile_ns(0.99)) << std::endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * compact_archive.cpp
+ *
+ *  Created on: Oct 18, 2013
+ *      Author: vincent
+ */
+
+// Compare atlas::serialization::compact_[io]archive with boost binary archives on
+// typical remote function arguments : bytes per message and ns per encode/decode.
+// Build with <variant>release for meaningful numbers. The encodings of the classes and of
+// std::vector<bool> are checked first.
+
+#include <string>
+#include <vector>
+#include <tuple>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/vector.hpp>
+
+#include <boost/uuid/uuid.hpp>
+#include <boost/uuid/random_generator.hpp>
+
+#include <atlas/serialization/tuple.h>
+#include <atlas/serialization/uuid.h>
+#include <atlas/serialization/compact_archive.h>
+
+using namespace atlas::serialization;
+
+typedef std::chrono::high_resolution_clock clock_type;
+
+static const int rounds = 200000;
+
+template<typename Tuple>
+struct boost_codec {
+  static std::string encode(const Tuple& t) {
+    std::ostringstream oss;
+    boost::archive::binary_oarchive oa(oss);
+    oa << t;
+    return oss.str();
+  }
+
+  static void decode(const std::string& s, Tuple& t) {
+    std::istringstream iss(s);
+    boost::archive::binary_iarchive ia(iss);
+    ia >> t;
+  }
+};
+
+template<typename Tuple, typename IntCoding>
+struct compact_codec {
+  static std::string encode(const Tuple& t) {
+    std::string s;
+    string_sink sink(s);
+    compact_oarchive<string_sink, IntCoding> oa(sink);
+    oa << t;
+    return s;
+  }
+
+  static void decode(const std::string& s, Tuple& t) {
+    compact_iarchive<IntCoding> ia(s.data(), s.size());
+    ia >> t;
+  }
+};
+
+// trivially copyable, but its serialize() writes the fields by version : not copied as raw bytes
+struct versioned_point {
+  int32_t x;
+  int32_t y;
+
+  template<typename Archive>
+  void serialize(Archive& ar, const unsigned int version) {
+    ar & x;
+    if (version > 0 || x != 0) ar & y;
+  }
+};
+
+// opts in to the raw bytes
+struct raw_point {
+  int32_t x;
+  int32_t y;
+};
+BOOST_IS_BITWISE_SERIALIZABLE(raw_point)
+
+enum class color : int32_t { red = 1, blue = 1000 };
+
+template<typename T>
+std::string encode(const T& t) {
+  return compact_codec<T, varint_coding>::encode(t);
+}
+
+template<typename T>
+T decode(const std::string& s) {
+  T t;
+  compact_codec<T, varint_coding>::decode(s, t);
+  return t;
+}
+
+int check_encodings() {
+  int failures = 0;
+
+  // 2 varints each, through serialize()
+  std::vector<versioned_point> points { { 1, 2 }, { 300, -1 } };
+  std::string s = encode(points);
+  std::vector<versioned_point> points2 = decode<std::vector<versioned_point>>(s);
+  if (s.size() != 1 + 1 + 1 + 2 + 1 || points2.size() != 2 || points2[1].x != 300 || points2[1].y != -1) ++failures;
+
+  s = encode(raw_point { 1, 2 });
+  if (s.size() != sizeof(raw_point) || decode<raw_point>(s).y != 2) ++failures;
+
+  // the enums of a vector take varints like a single one
+  std::vector<color> colors { color::red, color::blue };
+  s = encode(colors);
+  if (s.size() != 1 + 1 + 2 || decode<std::vector<color>>(s) != colors) ++failures;
+
+  for (size_t n : { 0, 1, 8, 9, 5000 }) {
+    std::vector<bool> bits(n);
+    for (size_t i = 0; i < n; ++i) bits[i] = (i % 3 == 0);
+
+    s = encode(bits);
+    if (s.size() != (n < 128 ? 1 : 2) + (n + 7) / 8 || decode<std::vector<bool>>(s) != bits) ++failures;
+  }
+
+  // a bit count past the end of the input
+  s = encode(std::vector<bool>(64, true));
+  s.resize(s.size() - 1);
+  try {
+    decode<std::vector<bool>>(s);
+    ++failures;
+  } catch (const archive_error&) {}
+
+  return failures;
+}
+
+template<typename Codec, typename Tuple>
+void run(const char* shape, const char* codec, const Tuple& t) {
+  size_t bytes = Codec::encode(t).size();
+
+  auto start = clock_type::now();
+  size_t total = 0;
+  for (int i = 0; i < rounds; ++i) {
+    total += Codec::encode(t).size();
+  }
+  auto encode_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count() / rounds;
+
+  std::string s = Codec::encode(t);
+  Tuple t2;
+  start = clock_type::now();
+  for (int i = 0; i < rounds; ++i) {
+    Codec::decode(s, t2);
+  }
+  auto decode_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count() / rounds;
+
+  if (total != bytes * rounds || !(t2 == t)) {
+    std::cout << shape << " " << codec << " : round trip mismatch" << std::endl;
+  }
+
+  std::cout << std::left << std::setw(30) << shape << std::setw(10) << codec
+      << std::right << std::setw(8) << bytes << " bytes"
+      << std::setw(8) << encode_ns << " ns/encode"
+      << std::setw(8) << decode_ns << " ns/decode" << std::endl;
+}
+
+template<typename Tuple>
+void compare(const char* shape, const Tuple& t) {
+  run<boost_codec<Tuple>>(shape, "boost", t);
+  run<compact_codec<Tuple, varint_coding>>(shape, "varint", t);
+  run<compact_codec<Tuple, fixed_int_coding>>(shape, "fixed", t);
+}
+
+int main() {
+  int failures = check_encodings();
+
+  boost::uuids::uuid id = boost::uuids::random_generator()();
+
+  compare("(int, int)", std::make_tuple(1, 2));
+  compare("(int64, int, bool)", std::make_tuple(int64_t(-123456789), 300, true));
+  compare("(uuid, string)", std::make_tuple(id, std::string("/path/to/some/resource")));
+  compare("(int, vector<int>[64])", std::make_tuple(7, std::vector<int>(64, 1000)));
+  compare("(string[4K], vector<double>)", std::make_tuple(std::string(4096, 'x'), std::vector<double>(32, 3.14)));
+
+  std::cout << (failures ? "FAIL" : "PASS") << std::endl;
+  return failures;
+}
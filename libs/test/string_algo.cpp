@@ -0,0 +1,80 @@
+/*
+ * string_algo.cpp
+ *
+ *  Created on: Oct 30, 2013
+ *      Author: vincent
+ */
+
+#define BOOST_TEST_MODULE string_algo
+
+#include <limits>
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+#include <atlas/string_algo.h>
+#include <atlas/inplace_string.h>
+
+using atlas::string8;
+using atlas::string16;
+using atlas::string64;
+
+BOOST_AUTO_TEST_SUITE(string_algo)
+
+BOOST_AUTO_TEST_CASE(compare_generic)
+{
+  // the sign tells the order, equal values give 0
+  BOOST_CHECK_EQUAL(atlas::compare(1, 2), -1);
+  BOOST_CHECK_EQUAL(atlas::compare(2, 2), 0);
+  BOOST_CHECK_EQUAL(atlas::compare(3, 2), 1);
+
+  BOOST_CHECK_EQUAL(atlas::compare(-5, 5), -1);
+  BOOST_CHECK_EQUAL(atlas::compare(std::string("a"), std::string("b")), -1);
+  BOOST_CHECK_EQUAL(atlas::compare(std::string("b"), std::string("b")), 0);
+}
+
+BOOST_AUTO_TEST_CASE(compare_unsigned)
+{
+  // the lengths : the difference, clamped to an int, like std::basic_string::compare
+  BOOST_CHECK_EQUAL(atlas::compare(7ul, 7ul), 0);
+  BOOST_CHECK_EQUAL(atlas::compare(3ul, 7ul), -4);
+  BOOST_CHECK_EQUAL(atlas::compare(7ul, 3ul), 4);
+  BOOST_CHECK_EQUAL(atlas::compare(0ull, 1ull), -1);
+
+  unsigned long big = 1ul << 40;
+  BOOST_CHECK_EQUAL(atlas::compare(big, 0ul), std::numeric_limits<int>::max());
+  BOOST_CHECK_EQUAL(atlas::compare(0ul, big), std::numeric_limits<int>::min());
+}
+
+BOOST_AUTO_TEST_CASE(compare_chars)
+{
+  BOOST_CHECK(atlas::compare_unchecked("abc", 3, "abc", 3) == 0);
+  BOOST_CHECK(atlas::compare_unchecked("abc", 3, "abd", 3) < 0);
+  BOOST_CHECK(atlas::compare_unchecked("abd", 3, "abc", 3) > 0);
+
+  // a prefix comes first
+  BOOST_CHECK(atlas::compare_unchecked("ab", 2, "abc", 3) < 0);
+  BOOST_CHECK(atlas::compare_unchecked("abc", 3, "ab", 2) > 0);
+  BOOST_CHECK(atlas::compare_unchecked("", 0, "", 0) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(inplace_string_order)
+{
+  string16 a("127.0.0.1:80");
+  string64 b("127.0.0.1:80");
+  string8 c("127.0.0");
+
+  BOOST_CHECK(a == b);
+  BOOST_CHECK(!(a != b));
+  BOOST_CHECK_EQUAL(a.compare(b), 0);
+
+  BOOST_CHECK(c < a);
+  BOOST_CHECK(a > c);
+  BOOST_CHECK(!(a < b) && !(b < a));
+
+  // the same signs as std::string
+  std::string s("127.0.0.2");
+  BOOST_CHECK((a.compare(s) < 0) == (a.str().compare(s) < 0));
+  BOOST_CHECK((c.compare(s) < 0) == (c.str().compare(s) < 0));
+}
+
+BOOST_AUTO_TEST_SUITE_END()